@@ -17,6 +17,7 @@
 #include "sil.h"
 
 #include "lapi.h"
+#include "larray.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -773,6 +774,52 @@ SIL_API int sil_rawgeti (sil_State *L, int idx, sil_Integer n) {
 }
 
 
+/*
+** Copy the numbers 't[1]', ..., 't[n]' of the table 't' at 'idx' into
+** 'v', as floats, while they lie in the array part of 't'. Return how
+** many were copied: the copy stops at the first value that is not a
+** number or at the end of the array part, leaving the remaining
+** elements for the caller to get one by one.
+*/
+SIL_API sil_Unsigned sil_rawgetnums (sil_State *L, int idx, sil_Number *v,
+                                     sil_Unsigned n) {
+  Table *t;
+  unsigned i, lim;
+  sil_lock(L);
+  t = gettable(L, idx);
+  lim = (n < t->asize) ? cast_uint(n) : t->asize;
+  for (i = 0; i < lim; i++) {
+    lu_byte tag = *getArrTag(t, i);
+    if (tag == SIL_VNUMFLT)
+      v[i] = getArrVal(t, i)->n;
+    else if (tag == SIL_VNUMINT)
+      v[i] = cast_num(getArrVal(t, i)->i);
+    else
+      break;
+  }
+  sil_unlock(L);
+  return i;
+}
+
+
+/*
+** Same as 'sil_rawgetnums' for integers: the copy also stops at the
+** first float.
+*/
+SIL_API sil_Unsigned sil_rawgetints (sil_State *L, int idx, sil_Integer *v,
+                                     sil_Unsigned n) {
+  Table *t;
+  unsigned i, lim;
+  sil_lock(L);
+  t = gettable(L, idx);
+  lim = (n < t->asize) ? cast_uint(n) : t->asize;
+  for (i = 0; i < lim && *getArrTag(t, i) == SIL_VNUMINT; i++)
+    v[i] = getArrVal(t, i)->i;
+  sil_unlock(L);
+  return i;
+}
+
+
 SIL_API int sil_rawgetp (sil_State *L, int idx, const void *p) {
   Table *t;
   TValue k;
@@ -789,8 +836,7 @@ SIL_API void sil_createtable (sil_State *L, int narray, int nrec) {
   t = silH_new(L);
   sethvalue2s(L, L->top.p, t);
   api_incr_top(L);
-  if (narray > 0 || nrec > 0)
-    silH_resize(L, t, cast_uint(narray), cast_uint(nrec));
+  silH_presize(L, t, cast_uint(narray), cast_uint(nrec));
   silC_checkGC(L);
   sil_unlock(L);
 }
@@ -856,7 +902,9 @@ static void auxsetstr (sil_State *L, const TValue *t, const char *k) {
   api_checkpop(L, 1);
   silV_fastset(t, str, s2v(L->top.p - 1), hres, silH_psetstr);
   if (hres == HOK) {
-    silV_finishfastset(L, t, s2v(L->top.p - 1));
+    TValue key;
+    setsvalue(L, &key, str);
+    silV_finishfastset(L, t, &key, s2v(L->top.p - 1));
     L->top.p--;  /* pop value */
   }
   else {
@@ -885,7 +933,7 @@ SIL_API void sil_settable (sil_State *L, int idx) {
   t = index2value(L, idx);
   silV_fastset(t, s2v(L->top.p - 2), s2v(L->top.p - 1), hres, silH_pset);
   if (hres == HOK)
-    silV_finishfastset(L, t, s2v(L->top.p - 1));
+    silV_finishfastset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1));
   else
     silV_finishset(L, t, s2v(L->top.p - 2), s2v(L->top.p - 1), hres);
   L->top.p -= 2;  /* pop index and value */
@@ -907,7 +955,7 @@ SIL_API void sil_seti (sil_State *L, int idx, sil_Integer n) {
   t = index2value(L, idx);
   silV_fastseti(t, n, s2v(L->top.p - 1), hres);
   if (hres == HOK)
-    silV_finishfastset(L, t, s2v(L->top.p - 1));
+    silV_finishfastseti(L, t, n, s2v(L->top.p - 1));
   else {
     TValue temp;
     setivalue(&temp, n);
@@ -920,12 +968,15 @@ SIL_API void sil_seti (sil_State *L, int idx, sil_Integer n) {
 
 static void aux_rawset (sil_State *L, int idx, TValue *key, int n) {
   Table *t;
+  int hres;
   sil_lock(L);
   api_checkpop(L, n);
   t = gettable(L, idx);
-  silH_set(L, t, key, s2v(L->top.p - 1));
+  hres = silH_pset(t, key, s2v(L->top.p - 1));
+  if (hres != HOK)
+    silH_finishset(L, t, key, s2v(L->top.p - 1), hres);
   invalidateTMcache(t);
-  silC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
+  silC_barrierset(L, t, hres, key, s2v(L->top.p - 1));
   L->top.p -= n;
   sil_unlock(L);
 }
@@ -936,6 +987,44 @@ SIL_API void sil_rawset (sil_State *L, int idx) {
 }
 
 
+/*
+** Store the floats 'v[0]', ..., 'v[n - 1]' into 't[1]', ..., 't[n]' of
+** the table 't' at 'idx', while they fit in its array part. Return how
+** many were stored. (Numbers need no barrier.)
+*/
+SIL_API sil_Unsigned sil_rawsetnums (sil_State *L, int idx,
+                                     const sil_Number *v, sil_Unsigned n) {
+  Table *t;
+  unsigned i, lim;
+  sil_lock(L);
+  t = gettable(L, idx);
+  lim = (n < t->asize) ? cast_uint(n) : t->asize;
+  for (i = 0; i < lim; i++) {
+    *getArrTag(t, i) = SIL_VNUMFLT;
+    getArrVal(t, i)->n = v[i];
+  }
+  sil_unlock(L);
+  return lim;
+}
+
+
+/* same as 'sil_rawsetnums' for integers */
+SIL_API sil_Unsigned sil_rawsetints (sil_State *L, int idx,
+                                     const sil_Integer *v, sil_Unsigned n) {
+  Table *t;
+  unsigned i, lim;
+  sil_lock(L);
+  t = gettable(L, idx);
+  lim = (n < t->asize) ? cast_uint(n) : t->asize;
+  for (i = 0; i < lim; i++) {
+    *getArrTag(t, i) = SIL_VNUMINT;
+    getArrVal(t, i)->i = v[i];
+  }
+  sil_unlock(L);
+  return lim;
+}
+
+
 SIL_API void sil_rawsetp (sil_State *L, int idx, const void *p) {
   TValue k;
   setpvalue(&k, cast_voidp(p));
@@ -949,7 +1038,7 @@ SIL_API void sil_rawseti (sil_State *L, int idx, sil_Integer n) {
   api_checkpop(L, 1);
   t = gettable(L, idx);
   silH_setint(L, t, n, s2v(L->top.p - 1));
-  silC_barrierback(L, obj2gco(t), s2v(L->top.p - 1));
+  silC_barriertablei(L, t, n, s2v(L->top.p - 1));
   L->top.p--;
   sil_unlock(L);
 }
@@ -977,6 +1066,12 @@ SIL_API int sil_setmetatable (sil_State *L, int objindex) {
       break;
     }
     case SIL_TUSERDATA: {
+      /* the VM trusts the array metatable (see 'ttisarray') */
+      if (l_unlikely(mt != NULL && mt == G(L)->arraymt &&
+                     !arrisvalid(cast(ArrayHeader *,
+                                      getudatamem(uvalue(obj))),
+                                 uvalue(obj)->len)))
+        silG_runerror(L, "userdata does not have the layout of an array");
       uvalue(obj)->metatable = mt;
       if (mt) {
         silC_objbarrier(L, uvalue(obj), mt);
@@ -1206,6 +1301,23 @@ SIL_API int sil_gc (sil_State *L, int what, ...) {
       g->gcstp = oldstp;  /* restore previous state */
       break;
     }
+    case SIL_GCSTEPTIME: {
+      lu_byte oldstp = g->gcstp;
+      int usec = va_arg(argp, int);
+      g->gcstp = 0;  /* allow GC to run (other bits must be zero here) */
+      res = silC_steptime(L, (usec > 0) ? usec : 0);
+      g->gcstp = oldstp;  /* restore previous state */
+      break;
+    }
+    case SIL_GCSTATS: {
+      sil_GCStats *s = va_arg(argp, sil_GCStats *);
+      int reset = va_arg(argp, int);
+      if (s != NULL)
+        *s = g->gcstats;
+      if (reset)
+        memset(&g->gcstats, 0, sizeof(g->gcstats));
+      break;
+    }
     case SIL_GCISRUNNING: {
       res = gcrunning(g);
       break;
@@ -1229,6 +1341,16 @@ SIL_API int sil_gc (sil_State *L, int what, ...) {
         g->gcparams[param] = silO_codeparam(cast_uint(value));
       break;
     }
+    case SIL_GCMARKTHREADS: {
+      int n = va_arg(argp, int);
+      res = silC_setmarkthreads(L, n);
+      break;
+    }
+    case SIL_GCBGSWEEP: {
+      int on = va_arg(argp, int);
+      res = silC_setbgsweep(L, on);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -1328,6 +1450,31 @@ SIL_API void sil_setallocf (sil_State *L, sil_Alloc f, void *ud) {
 }
 
 
+/*
+** Register 'f' as the implementation of the library function 'b'
+** (one of the SIL_BI* codes). The VM runs calls to a registered
+** function inline when it can: 'select(n, ...)' reads the vararg frame
+** directly (see OP_VARSELECT) and a generic 'for' over 'next' or the
+** iterator of 'ipairs' walks the table without calling them.
+*/
+SIL_API void sil_setbuiltin (sil_State *L, int b, sil_CFunction f) {
+  sil_lock(L);
+  api_check(L, 0 <= b && b < SIL_NUMBUILTINS, "invalid builtin code");
+  G(L)->builtin[b] = f;
+  sil_unlock(L);
+}
+
+
+SIL_API void sil_setarraymeta (sil_State *L, int objindex) {
+  const TValue *o;
+  sil_lock(L);
+  o = index2value(L, objindex);
+  api_check(L, ttistable(o), "table expected");
+  G(L)->arraymt = hvalue(o);
+  sil_unlock(L);
+}
+
+
 void sil_setwarnf (sil_State *L, sil_WarnFunction f, void *ud) {
   sil_lock(L);
   G(L)->ud_warn = ud;
@@ -0,0 +1,74 @@
+/*
+** $Id: larray.h $
+** Typed numeric arrays
+** See Copyright Notice in sil.h
+*/
+
+#ifndef larray_h
+#define larray_h
+
+
+#include "sil.h"
+
+#include "llimits.h"
+
+
+/*
+** A typed array is a full userdata, with no user values, whose
+** metatable is the one given to 'sil_setarraymeta' (by the 'array'
+** library). Its memory holds an 'ArrayHeader' followed by 'size'
+** contiguous elements of the given kind. The VM reads and writes
+** these elements directly (see 'lvm.c').
+*/
+
+/* kinds of elements */
+#define ARR_F64		0	/* double */
+#define ARR_F32		1	/* float */
+#define ARR_I64		2	/* sil_Integer */
+#define ARR_I32		3	/* 32-bit signed integer */
+#define ARR_U8		4	/* 8-bit unsigned integer */
+
+#define ARR_NUMKINDS	5
+
+
+/* a signed integer with exactly 4 bytes */
+#if SILI_IS32INT
+typedef int l_int32;
+#else
+typedef long l_int32;
+#endif
+
+
+typedef union ArrayHeader {
+  struct {
+    size_t size;  /* number of elements */
+    lu_byte kind;  /* kind of the elements */
+  } h;
+  SILI_MAXALIGN;  /* ensures maximum alignment for the elements */
+} ArrayHeader;
+
+
+/* the elements of array 'a', as a vector of 't' */
+#define arrelems(a,t)	cast(t *, cast_charp(a) + sizeof(ArrayHeader))
+
+/* size of the elements of kind 'k' */
+#define arresize(k)  \
+	((k) == ARR_F64 ? sizeof(double) : (k) == ARR_F32 ? sizeof(float) : \
+	 (k) == ARR_I64 ? sizeof(sil_Integer) : \
+	 (k) == ARR_I32 ? sizeof(l_int32) : sizeof(lu_byte))
+
+/*
+** Does the block 'a', with 'len' bytes, have the layout of a typed
+** array? 'sil_setmetatable' checks it before giving the array
+** metatable to a userdata, as the VM and the library then trust that
+** metatable alone. (The test 'size <= len' keeps the product from
+** overflowing, as the length of a real block is far below
+** MAX_SIZE / 8.)
+*/
+#define arrisvalid(a,len)  \
+	((len) >= sizeof(ArrayHeader) && (a)->h.kind < ARR_NUMKINDS && \
+	 (a)->h.size <= (len) && \
+	 (a)->h.size * arresize((a)->h.kind) == (len) - sizeof(ArrayHeader))
+
+
+#endif
@@ -0,0 +1,354 @@
+/*
+** $Id: larraylib.c $
+** Typed numeric arrays
+** See Copyright Notice in sil.h
+*/
+
+#define larraylib_c
+#define SIL_LIB
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "sil.h"
+
+#include "lauxlib.h"
+#include "sillib.h"
+#include "larray.h"
+
+
+/*
+** A typed array holds a fixed number of numbers of one kind, unboxed
+** and contiguous (see 'larray.h'). Indices go from 1 to '#a'; reading
+** outside that range gives nil, writing there is an error. Floats
+** stored in integer arrays must have an exact integer representation;
+** integers stored in 32-bit and 8-bit arrays wrap around, as in a C
+** cast. The VM handles integer indexing and '#' of typed arrays
+** directly; the metamethods here serve the API and the other cases.
+*/
+
+
+#define ARRAYNAME	"array"
+
+
+static const char *const kindnames[] = {
+  "f64", "f32", "i64", "i32", "u8", NULL
+};
+
+static const lu_byte kindsizes[ARR_NUMKINDS] = {
+  sizeof(double), sizeof(float), sizeof(sil_Integer),
+  sizeof(l_int32), sizeof(lu_byte)
+};
+
+/* 'string.pack' formats of the elements, in native endianness */
+static const char *const kindformats[ARR_NUMKINDS] = {
+  "=d", "=f", "=j", "=i4", "=B"
+};
+
+
+#define checkarray(L,i)	cast(ArrayHeader *, silL_checkudata(L, i, ARRAYNAME))
+
+#define checkkind(L,arg)	silL_checkoption(L, arg, NULL, kindnames)
+
+
+static ArrayHeader *newarray (sil_State *L, int kind, sil_Integer n) {
+  ArrayHeader *a;
+  size_t esize = kindsizes[kind];
+  silL_argcheck(L, 0 <= n && l_castS2U(n) <= (MAX_SIZE - sizeof(ArrayHeader))
+                                            / esize, 2, "invalid size");
+  a = cast(ArrayHeader *, sil_newuserdatauv(L, sizeof(ArrayHeader) +
+                                               cast_sizet(n) * esize, 0));
+  a->h.size = cast_sizet(n);
+  a->h.kind = cast_byte(kind);
+  memset(arrelems(a, char), 0, cast_sizet(n) * esize);
+  silL_setmetatable(L, ARRAYNAME);
+  return a;
+}
+
+
+/* push element 'i' (0-based) of array 'a' */
+static void pushelem (sil_State *L, ArrayHeader *a, size_t i) {
+  switch (a->h.kind) {
+    case ARR_F64: sil_pushnumber(L, cast_num(arrelems(a, double)[i])); break;
+    case ARR_F32: sil_pushnumber(L, cast_num(arrelems(a, float)[i])); break;
+    case ARR_I64: sil_pushinteger(L, arrelems(a, sil_Integer)[i]); break;
+    case ARR_I32: sil_pushinteger(L, arrelems(a, l_int32)[i]); break;
+    default: sil_pushinteger(L, arrelems(a, lu_byte)[i]); break;
+  }
+}
+
+
+/* store the number at stack index 'v' in element 'i' (0-based) of 'a' */
+static void setelem (sil_State *L, ArrayHeader *a, size_t i, int v) {
+  switch (a->h.kind) {
+    case ARR_F64:
+      arrelems(a, double)[i] = cast(double, silL_checknumber(L, v));
+      break;
+    case ARR_F32:
+      arrelems(a, float)[i] = cast(float, silL_checknumber(L, v));
+      break;
+    case ARR_I64:
+      arrelems(a, sil_Integer)[i] = silL_checkinteger(L, v);
+      break;
+    case ARR_I32:
+      arrelems(a, l_int32)[i] =
+          cast(l_int32, cast(l_uint32, silL_checkinteger(L, v)));
+      break;
+    default:
+      arrelems(a, lu_byte)[i] = cast_byte(silL_checkinteger(L, v));
+      break;
+  }
+}
+
+
+/*
+** array.new(kind, n [, v]): new array with 'n' elements equal to 'v'
+** (default 0)
+*/
+static int arr_new (sil_State *L) {
+  int kind = checkkind(L, 1);
+  sil_Integer n = silL_checkinteger(L, 2);
+  ArrayHeader *a;
+  sil_settop(L, 3);  /* fill value (if any) at index 3 */
+  a = newarray(L, kind, n);
+  if (!sil_isnil(L, 3) && n > 0) {
+    size_t i;
+    size_t esize = kindsizes[kind];
+    setelem(L, a, 0, 3);
+    for (i = 1; i < a->h.size; i++)  /* copy the first element */
+      memcpy(arrelems(a, char) + i * esize, arrelems(a, char), esize);
+  }
+  return 1;
+}
+
+
+/*
+** array.fromtable(kind, t [, n]): new array with elements t[1..n]
+** (default '#t')
+*/
+static int arr_fromtable (sil_State *L) {
+  int kind = checkkind(L, 1);
+  sil_Integer n;
+  size_t i;
+  ArrayHeader *a;
+  silL_checktype(L, 2, SIL_TTABLE);
+  n = silL_optinteger(L, 3, silL_len(L, 2));
+  a = newarray(L, kind, n);
+  for (i = 0; i < a->h.size; i++) {
+    sil_rawgeti(L, 2, cast(sil_Integer, i) + 1);
+    setelem(L, a, i, -1);
+    sil_pop(L, 1);
+  }
+  return 1;
+}
+
+
+/*
+** array.frombytes(kind, s): new array whose elements are the bytes of
+** string 's' (as produced by 'a:bytes()' or 'string.pack')
+*/
+static int arr_frombytes (sil_State *L) {
+  int kind = checkkind(L, 1);
+  size_t len;
+  const char *s = silL_checklstring(L, 2, &len);
+  size_t esize = kindsizes[kind];
+  ArrayHeader *a;
+  silL_argcheck(L, len % esize == 0, 2,
+                "length is not a multiple of the element size");
+  a = newarray(L, kind, cast(sil_Integer, len / esize));
+  memcpy(arrelems(a, char), s, len);
+  return 1;
+}
+
+
+/*
+** Get the range [i, j] of array 'a' (at stack index 1) from optional
+** arguments 'ai' and 'ai + 1', as 0-based indices in '*pi' and '*pj'.
+** Return false if the range is empty.
+*/
+static int getrange (sil_State *L, ArrayHeader *a, int ai,
+                     size_t *pi, size_t *pj) {
+  sil_Integer n = cast(sil_Integer, a->h.size);
+  sil_Integer i = silL_optinteger(L, ai, 1);
+  sil_Integer j = silL_optinteger(L, ai + 1, n);
+  if (i > j)
+    return 0;
+  silL_argcheck(L, 1 <= i, ai, "out of bounds");
+  silL_argcheck(L, j <= n, ai + 1, "out of bounds");
+  *pi = cast_sizet(i - 1);
+  *pj = cast_sizet(j - 1);
+  return 1;
+}
+
+
+/* a:totable([i [, j]]): new sequence {a[i], ..., a[j]}, indexed from 1 */
+static int arr_totable (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  size_t i, j;
+  sil_Integer k = 1;
+  if (!getrange(L, a, 2, &i, &j)) {
+    sil_newtable(L);
+    return 1;
+  }
+  silL_argcheck(L, j - i < cast_sizet(INT_MAX), 3, "range too large");
+  sil_createtable(L, cast_int(j - i + 1), 0);
+  for (; i <= j; i++) {
+    pushelem(L, a, i);
+    sil_rawseti(L, -2, k++);
+  }
+  return 1;
+}
+
+
+/* a:bytes([i [, j]]): raw bytes of elements a[i..j] */
+static int arr_bytes (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  size_t esize = kindsizes[a->h.kind];
+  size_t i, j;
+  if (!getrange(L, a, 2, &i, &j))
+    sil_pushliteral(L, "");
+  else
+    sil_pushlstring(L, arrelems(a, char) + i * esize, (j - i + 1) * esize);
+  return 1;
+}
+
+
+/* a:kind(): name of the kind of the elements */
+static int arr_kind (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  sil_pushstring(L, kindnames[a->h.kind]);
+  return 1;
+}
+
+
+/*
+** array.format(kind) or a:format(): 'string.pack' format of one
+** element, so that 'string.unpack(a:format(), a:bytes(), 1)' gives a[1]
+*/
+static int arr_format (sil_State *L) {
+  int kind = (sil_type(L, 1) == SIL_TSTRING) ? checkkind(L, 1)
+                                             : checkarray(L, 1)->h.kind;
+  sil_pushstring(L, kindformats[kind]);
+  return 1;
+}
+
+
+/* a:fill(v [, i [, j]]): set elements a[i..j] to 'v' */
+static int arr_fill (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  size_t i, j;
+  silL_checknumber(L, 2);
+  if (getrange(L, a, 3, &i, &j)) {
+    for (; i <= j; i++)
+      setelem(L, a, i, 2);
+  }
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** Get the 0-based position of the integer key at stack index 2 of
+** array 'a' into '*pi'. Return false if the key is not an integer or
+** is out of bounds.
+*/
+static int getindex (sil_State *L, ArrayHeader *a, size_t *pi) {
+  int isnum;
+  sil_Integer k = sil_tointegerx(L, 2, &isnum);
+  if (isnum && 0 < k && l_castS2U(k) <= a->h.size) {
+    *pi = cast_sizet(k - 1);
+    return 1;
+  }
+  return 0;
+}
+
+
+static int arr_index (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  size_t i;
+  if (getindex(L, a, &i))
+    pushelem(L, a, i);
+  else if (sil_type(L, 2) == SIL_TSTRING)
+    sil_gettable(L, sil_upvalueindex(1));  /* get method */
+  else
+    sil_pushnil(L);
+  return 1;
+}
+
+
+static int arr_newindex (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  size_t i;
+  if (l_unlikely(!getindex(L, a, &i)))
+    return silL_argerror(L, 2, "index out of bounds");
+  setelem(L, a, i, 3);
+  return 0;
+}
+
+
+static int arr_len (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  sil_pushinteger(L, cast(sil_Integer, a->h.size));
+  return 1;
+}
+
+
+static int arr_tostring (sil_State *L) {
+  ArrayHeader *a = checkarray(L, 1);
+  sil_pushfstring(L, "array<%s>(%I): %p", kindnames[a->h.kind],
+                     cast(sil_Integer, a->h.size), cast(void *, a));
+  return 1;
+}
+
+
+static const silL_Reg arr_funcs[] = {
+  {"new", arr_new},
+  {"fromtable", arr_fromtable},
+  {"frombytes", arr_frombytes},
+  {"totable", arr_totable},
+  {"bytes", arr_bytes},
+  {"kind", arr_kind},
+  {"format", arr_format},
+  {"fill", arr_fill},
+  {NULL, NULL}
+};
+
+
+static const silL_Reg arr_meth[] = {
+  {"totable", arr_totable},
+  {"bytes", arr_bytes},
+  {"kind", arr_kind},
+  {"format", arr_format},
+  {"fill", arr_fill},
+  {NULL, NULL}
+};
+
+
+static const silL_Reg arr_metameth[] = {
+  {"__newindex", arr_newindex},
+  {"__len", arr_len},
+  {"__tostring", arr_tostring},
+  {NULL, NULL}
+};
+
+
+static void createmeta (sil_State *L) {
+  silL_newmetatable(L, ARRAYNAME);  /* metatable for typed arrays */
+  silL_setfuncs(L, arr_metameth, 0);  /* add metamethods to new metatable */
+  silL_newlibtable(L, arr_meth);  /* create method table */
+  silL_setfuncs(L, arr_meth, 0);  /* add methods to method table */
+  sil_pushcclosure(L, arr_index, 1);  /* methods are upvalue of __index */
+  sil_setfield(L, -2, "__index");
+  sil_setarraymeta(L, -1);  /* let the VM access typed arrays directly */
+  sil_pop(L, 1);  /* pop metatable */
+}
+
+
+SILMOD_API int silopen_array (sil_State *L) {
+  silL_newlib(L, arr_funcs);
+  createmeta(L);
+  return 1;
+}
+
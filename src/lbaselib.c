@@ -198,13 +198,58 @@ static int pushmode (sil_State *L, int oldmode) {
 */
 #define checkvalres(res) { if (res == -1) break; }
 
+/*
+** Push a table with the collector statistics: a subtable for each
+** timed phase (with its 'count', 'total' and 'max' times, in
+** microseconds, and 'hist', the histogram of its times) and the other
+** counters.
+*/
+static void pushgcstats (sil_State *L, const sil_GCStats *s) {
+  static const char *const phases[SIL_GCNPHASES] = {"step", "propagate",
+    "atomic", "sweep", "finalize", "young", "fullgen"};
+  int i, j;
+  sil_createtable(L, 0, SIL_GCNPHASES + 7);
+  for (i = 0; i < SIL_GCNPHASES; i++) {
+    const sil_GCPhaseStats *ph = &s->phase[i];
+    sil_createtable(L, 0, 4);
+    sil_pushinteger(L, (sil_Integer)ph->count);
+    sil_setfield(L, -2, "count");
+    sil_pushnumber(L, ph->total);
+    sil_setfield(L, -2, "total");
+    sil_pushnumber(L, ph->max);
+    sil_setfield(L, -2, "max");
+    sil_createtable(L, SIL_GCHISTSIZE, 0);
+    for (j = 0; j < SIL_GCHISTSIZE; j++) {
+      sil_pushinteger(L, (sil_Integer)ph->hist[j]);
+      sil_rawseti(L, -2, j + 1);
+    }
+    sil_setfield(L, -2, "hist");
+    sil_setfield(L, -2, phases[i]);
+  }
+  sil_pushinteger(L, (sil_Integer)s->cycles);
+  sil_setfield(L, -2, "cycles");
+  sil_pushinteger(L, (sil_Integer)s->bytesmarked);
+  sil_setfield(L, -2, "marked");
+  sil_pushinteger(L, (sil_Integer)s->bytesswept);
+  sil_setfield(L, -2, "swept");
+  sil_pushinteger(L, (sil_Integer)s->promoted);
+  sil_setfield(L, -2, "promoted");
+  sil_pushinteger(L, (sil_Integer)s->promotedbytes);
+  sil_setfield(L, -2, "promotedbytes");
+  sil_pushinteger(L, (sil_Integer)s->minor2major);
+  sil_setfield(L, -2, "minor2major");
+  sil_pushinteger(L, (sil_Integer)s->major2minor);
+  sil_setfield(L, -2, "major2minor");
+}
+
+
 static int silB_collectgarbage (sil_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "isrunning", "generational", "incremental",
-    "param", NULL};
+    "param", "markthreads", "bgsweep", "stats", NULL};
   static const char optsnum[] = {SIL_GCSTOP, SIL_GCRESTART, SIL_GCCOLLECT,
     SIL_GCCOUNT, SIL_GCSTEP, SIL_GCISRUNNING, SIL_GCGEN, SIL_GCINC,
-    SIL_GCPARAM};
+    SIL_GCPARAM, SIL_GCMARKTHREADS, SIL_GCBGSWEEP, SIL_GCSTATS};
   int o = optsnum[silL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case SIL_GCCOUNT: {
@@ -215,8 +260,22 @@ static int silB_collectgarbage (sil_State *L) {
       return 1;
     }
     case SIL_GCSTEP: {
-      sil_Integer n = silL_optinteger(L, 2, 0);
-      int res = sil_gc(L, o, cast_sizet(n));
+      sil_Integer n;
+      int res;
+      if (sil_istable(L, 2)) {  /* time budget? */
+        int isnum;
+        sil_getfield(L, 2, "usec");
+        n = sil_tointegerx(L, -1, &isnum);
+        silL_argcheck(L, isnum, 2, "field 'usec' must be an integer");
+        if (n > INT_MAX) n = INT_MAX;
+        res = sil_gc(L, SIL_GCSTEPTIME, (n < 0) ? 0 : (int)n);
+        checkvalres(res);
+        sil_pushboolean(L, res == 0);  /* finished the cycle? */
+        sil_pushinteger(L, res);  /* Kbytes of work still to be done */
+        return 2;
+      }
+      n = silL_optinteger(L, 2, 0);
+      res = sil_gc(L, o, cast_sizet(n));
       checkvalres(res);
       sil_pushboolean(L, res);
       return 1;
@@ -245,6 +304,29 @@ static int silB_collectgarbage (sil_State *L) {
       sil_pushinteger(L, sil_gc(L, o, p, (int)value));
       return 1;
     }
+    case SIL_GCMARKTHREADS: {
+      sil_Integer n = silL_optinteger(L, 2, -1);  /* -1: just query */
+      int res;
+      if (n > INT_MAX) n = INT_MAX;
+      res = sil_gc(L, o, (n < 0) ? -1 : (int)n);
+      checkvalres(res);
+      sil_pushinteger(L, res);
+      return 1;
+    }
+    case SIL_GCSTATS: {
+      sil_GCStats s;
+      int res = sil_gc(L, o, &s, sil_toboolean(L, 2));
+      checkvalres(res);
+      pushgcstats(L, &s);
+      return 1;
+    }
+    case SIL_GCBGSWEEP: {
+      int on = sil_isnoneornil(L, 2) ? -1 : sil_toboolean(L, 2);
+      int res = sil_gc(L, o, on);
+      checkvalres(res);
+      sil_pushboolean(L, res);
+      return 1;
+    }
     default: {
       int res = sil_gc(L, o);
       checkvalres(res);
@@ -547,6 +629,10 @@ SILMOD_API int silopen_base (sil_State *L) {
   /* open lib into global table */
   sil_pushglobaltable(L);
   silL_setfuncs(L, base_funcs, 0);
+  /* let the VM run these inline */
+  sil_setbuiltin(L, SIL_BISELECT, silB_select);
+  sil_setbuiltin(L, SIL_BINEXT, silB_next);
+  sil_setbuiltin(L, SIL_BIIPAIRS, ipairsaux);
   /* set global _G */
   sil_pushvalue(L, -1);
   sil_setfield(L, -2, SIL_GNAME);
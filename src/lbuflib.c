@@ -0,0 +1,664 @@
+/*
+** $Id: lbuflib.c $
+** String buffers
+** See Copyright Notice in sil.h
+*/
+
+#define lbuflib_c
+#define SIL_LIB
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <string.h>
+
+#include "sil.h"
+
+#include "lauxlib.h"
+#include "sillib.h"
+#include "llimits.h"
+
+
+/*
+** A string buffer is a full userdata owning a block of memory, got
+** from the state's allocator and growing like the block of a
+** 'silL_Buffer', that holds the bytes 'b[r..w)'. Appending writes at
+** 'w', reading consumes from 'r'; once everything has been read, both
+** go back to the start, so that a buffer reused for each new piece of
+** output ends up keeping a block of the right size and allocates
+** nothing more. 'b:tostring()' and 'b:get()' copy the contents; a
+** buffer can instead give its block to a new string with 'b:take()'
+** (through 'sil_pushexternalstring'), which costs no copy but leaves
+** the buffer without memory.
+*/
+
+
+#define BUFFERNAME	"buffer"
+
+
+typedef struct StrBuf {
+  char *b;  /* block (NULL if none) */
+  size_t size;  /* size of the block */
+  size_t r;  /* position of the first unread byte */
+  size_t w;  /* position where the next byte will be written */
+} StrBuf;
+
+
+#define checkbuf(L,i)	cast(StrBuf *, silL_checkudata(L, i, BUFFERNAME))
+
+#define buflen(sb)	((sb)->w - (sb)->r)
+
+
+/*
+** Resize the block of buffer 'sb' to 'newsize' bytes. (Like 'resizebox'
+** in 'lauxlib.c'.)
+*/
+static void resizebuf (sil_State *L, StrBuf *sb, size_t newsize) {
+  void *ud;
+  sil_Alloc allocf = sil_getallocf(L, &ud);
+  void *temp = allocf(ud, sb->b, sb->size, newsize);
+  if (l_unlikely(temp == NULL && newsize > 0)) {  /* allocation error? */
+    sil_pushliteral(L, "not enough memory");
+    sil_error(L);  /* raise a memory error */
+  }
+  sb->b = cast(char *, temp);
+  sb->size = newsize;
+}
+
+
+/*
+** Returns a pointer to a free area with at least 'sz' bytes after the
+** contents of buffer 'sb', keeping one more byte free for a terminating
+** zero. Already read bytes are dropped before the block is enlarged;
+** the block grows by a factor of 1.5, as in 'lauxlib.c'.
+*/
+static char *prepbuf (sil_State *L, StrBuf *sb, size_t sz) {
+  if (sb->size - sb->w > sz)  /* enough space? */
+    return sb->b + sb->w;
+  else {
+    size_t len = buflen(sb);
+    if (l_unlikely(sz >= MAX_SIZE - len))
+      silL_error(L, "resulting string too large");
+    /* else len + sz + 1 <= MAX_SIZE */
+    if (sb->r > 0) {  /* move contents to the start of the block */
+      memmove(sb->b, sb->b + sb->r, len);
+      sb->r = 0;
+      sb->w = len;
+    }
+    if (sb->size - len <= sz) {  /* still not enough space? */
+      size_t newsize = sb->size;
+      if (newsize <= MAX_SIZE/3 * 2)  /* no overflow? */
+        newsize += (newsize >> 1);  /* new size *= 1.5 */
+      if (newsize < len + sz + 1)  /* not big enough? */
+        newsize = len + sz + 1;
+      resizebuf(L, sb, newsize);
+    }
+    return sb->b + sb->w;
+  }
+}
+
+
+static void addlstring (sil_State *L, StrBuf *sb, const char *s, size_t l) {
+  if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+    memcpy(prepbuf(L, sb, l), s, l);
+    sb->w += l;
+  }
+}
+
+
+/* consume 'n' bytes (at most 'buflen(sb)') from buffer 'sb' */
+static void consume (StrBuf *sb, size_t n) {
+  sb->r += n;
+  if (sb->r == sb->w)  /* buffer is empty? */
+    sb->r = sb->w = 0;  /* reuse the block from its start */
+}
+
+
+/* Append the value at stack index 'arg' to buffer 'sb' */
+static void addvalue (sil_State *L, StrBuf *sb, int arg) {
+  switch (sil_type(L, arg)) {
+    case SIL_TSTRING: {
+      size_t l;
+      const char *s = sil_tolstring(L, arg, &l);
+      addlstring(L, sb, s, l);
+      break;
+    }
+    case SIL_TNUMBER: {  /* format it directly into the buffer */
+      char *buff = prepbuf(L, sb, SIL_N2SBUFFSZ);
+      sb->w += sil_numbertocstring(L, arg, buff) - 1;  /* drop the '\0' */
+      break;
+    }
+    default: {
+      size_t l;
+      const char *s;
+      if (l_unlikely(!silL_getmetafield(L, arg, "__tostring")))
+        silL_typeerror(L, arg, "string, number or object with __tostring");
+      sil_pop(L, 1);  /* remove metafield */
+      s = silL_tolstring(L, arg, &l);
+      addlstring(L, sb, s, l);
+      sil_pop(L, 1);  /* remove string */
+      break;
+    }
+  }
+}
+
+
+/* create a new empty buffer with room for 'size' bytes */
+static StrBuf *newbuf (sil_State *L, size_t size) {
+  StrBuf *sb = cast(StrBuf *, sil_newuserdatauv(L, sizeof(StrBuf), 0));
+  sb->b = NULL;
+  sb->size = sb->r = sb->w = 0;
+  silL_setmetatable(L, BUFFERNAME);
+  if (size > 0)
+    resizebuf(L, sb, size + 1);
+  return sb;
+}
+
+
+/* buffer.new([size]): new empty buffer, with room for 'size' bytes */
+static int buf_new (sil_State *L) {
+  sil_Integer size = silL_optinteger(L, 1, 0);
+  silL_argcheck(L, 0 <= size && l_castS2U(size) < MAX_SIZE, 1,
+                   "invalid size");
+  newbuf(L, cast_sizet(size));
+  return 1;
+}
+
+
+/* b:put(...): append the strings, numbers and objects in '...' */
+static int buf_put (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  int n = sil_gettop(L);
+  int i;
+  for (i = 2; i <= n; i++)
+    addvalue(L, sb, i);
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** b:putf(fmt, ...): append 'string.format(fmt, ...)' (The format
+** function is the upvalue.)
+*/
+static int buf_putf (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  size_t l;
+  const char *s;
+  silL_checkstring(L, 2);
+  sil_pushvalue(L, sil_upvalueindex(1));
+  sil_rotate(L, 2, 1);  /* put it below the format arguments */
+  sil_call(L, sil_gettop(L) - 2, 1);
+  s = sil_tolstring(L, -1, &l);
+  addlstring(L, sb, s, l);
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+/*
+** b:reserve(n): make room for at least 'n' more bytes and return a
+** pointer to that space (as a light userdata) and its actual size, so
+** that C code can write there directly; see 'b:commit'
+*/
+static int buf_reserve (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sil_Integer n = silL_checkinteger(L, 2);
+  char *p;
+  silL_argcheck(L, 0 <= n && l_castS2U(n) < MAX_SIZE, 2, "invalid size");
+  p = prepbuf(L, sb, cast_sizet(n));
+  sil_pushlightuserdata(L, p);
+  sil_pushinteger(L, cast(sil_Integer, sb->size - sb->w - 1));
+  return 2;
+}
+
+
+/* b:commit(n): append the first 'n' bytes of the reserved space */
+static int buf_commit (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sil_Integer n = silL_checkinteger(L, 2);
+  silL_argcheck(L, 0 <= n && (sb->b == NULL ? n == 0 :
+                   l_castS2U(n) < sb->size - sb->w), 2, "out of range");
+  sb->w += cast_sizet(n);
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+/* b:skip(n): consume (at most) 'n' bytes without reading them */
+static int buf_skip (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sil_Integer n = silL_checkinteger(L, 2);
+  silL_argcheck(L, 0 <= n, 2, "out of range");
+  consume(sb, (l_castS2U(n) < buflen(sb)) ? cast_sizet(n) : buflen(sb));
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+/* get the number of bytes asked by the optional argument 'arg' */
+static size_t getcount (sil_State *L, StrBuf *sb, int arg) {
+  if (sil_isnoneornil(L, arg))
+    return buflen(sb);
+  else {
+    sil_Integer n = silL_checkinteger(L, arg);
+    silL_argcheck(L, 0 <= n, arg, "out of range");
+    return (l_castS2U(n) < buflen(sb)) ? cast_sizet(n) : buflen(sb);
+  }
+}
+
+
+/*
+** b:get([n1, ...]): consume and return one string of (at most) 'ni'
+** bytes for each argument; absent or nil counts mean "all the rest"
+*/
+static int buf_get (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  int n = sil_gettop(L) - 1;
+  int i;
+  if (n <= 0) {
+    n = 1;
+    sil_settop(L, 2);
+  }
+  silL_checkstack(L, n, "too many results");
+  for (i = 2; i <= n + 1; i++) {
+    size_t l = getcount(L, sb, i);
+    sil_pushlstring(L, sb->b + sb->r, l);
+    consume(sb, l);
+  }
+  return n;
+}
+
+
+/* b:peek([n]): first (at most) 'n' bytes, without consuming them */
+static int buf_peek (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  size_t l = getcount(L, sb, 2);
+  sil_pushlstring(L, sb->b + sb->r, l);
+  return 1;
+}
+
+
+/*
+** b:ref(): pointer to the contents (as a light userdata) and their
+** length, valid until the next change to the buffer
+*/
+static int buf_ref (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sil_pushlightuserdata(L, sb->b + sb->r);
+  sil_pushinteger(L, cast(sil_Integer, buflen(sb)));
+  return 2;
+}
+
+
+/* b:tostring(): copy of the contents; buffer is unchanged */
+static int buf_tostring (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sil_pushlstring(L, sb->b + sb->r, buflen(sb));
+  return 1;
+}
+
+
+/*
+** b:take(): the contents as a string that uses the block of the buffer
+** itself (as 'silL_pushresult' does with its box). The buffer is left
+** empty and with no block.
+*/
+static int buf_take (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  size_t len = buflen(sb);
+  if (len == 0)
+    sil_pushliteral(L, "");
+  else {
+    void *ud;
+    sil_Alloc allocf = sil_getallocf(L, &ud);  /* function to free block */
+    char *s;
+    if (sb->r > 0)
+      memmove(sb->b, sb->b + sb->r, len);
+    resizebuf(L, sb, len + 1);  /* adjust block size to content size */
+    s = sb->b;
+    s[len] = '\0';  /* add ending zero */
+    /* clear buffer, as SIL will take control of the block */
+    sb->b = NULL;
+    sb->size = sb->r = sb->w = 0;
+    sil_pushexternalstring(L, s, len, allocf, ud);
+    sil_gc(L, SIL_GCSTEP, len);
+  }
+  return 1;
+}
+
+
+/* b:reset(): discard the contents, keeping the block for reuse */
+static int buf_reset (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sb->r = sb->w = 0;
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+/* b:free(): discard the contents and release the block */
+static int buf_free (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  resizebuf(L, sb, 0);
+  sb->r = sb->w = 0;
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+static int buf_len (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sil_pushinteger(L, cast(sil_Integer, buflen(sb)));
+  return 1;
+}
+
+
+/*
+** {======================================================
+** Serialization
+** =======================================================
+*/
+
+/*
+** 'b:encode(v)' appends a compact binary image of 'v', which may be
+** nil, a boolean, a number, a string or a table of such values (with
+** no cycles); 'b:decode()' consumes one such image and rebuilds the
+** value. Numbers are stored in native format, so images are only
+** portable between machines that agree on that. Each value starts
+** with a tag byte. Strings have their length in 7-bit groups, lowest
+** first, before the bytes. A table has the length 'n' of its sequence,
+** its elements 1..n, then its other entries as key-value pairs and a
+** nil tag to end them.
+*/
+
+#define TAG_NIL		0
+#define TAG_FALSE	1
+#define TAG_TRUE	2
+#define TAG_INT		3
+#define TAG_FLOAT	4
+#define TAG_STR		5
+#define TAG_TABLE	6
+
+/* limit for the nesting of tables */
+#define MAXDEPTH	200
+
+
+static void encodesize (sil_State *L, StrBuf *sb, size_t n) {
+  char *p = prepbuf(L, sb, (sizeof(size_t) * 8 + 6) / 7);
+  size_t i = 0;
+  while (n >= 0x80) {
+    p[i++] = cast_char((n & 0x7f) | 0x80);
+    n >>= 7;
+  }
+  p[i++] = cast_char(n);
+  sb->w += i;
+}
+
+
+static void encode (sil_State *L, StrBuf *sb, int idx, int depth) {
+  char *p;
+  switch (sil_type(L, idx)) {
+    case SIL_TNIL: {
+      *prepbuf(L, sb, 1) = TAG_NIL;
+      sb->w++;
+      break;
+    }
+    case SIL_TBOOLEAN: {
+      *prepbuf(L, sb, 1) = sil_toboolean(L, idx) ? TAG_TRUE : TAG_FALSE;
+      sb->w++;
+      break;
+    }
+    case SIL_TNUMBER: {
+      if (sil_isinteger(L, idx)) {
+        sil_Integer i = sil_tointeger(L, idx);
+        p = prepbuf(L, sb, 1 + sizeof(i));
+        *p = TAG_INT;
+        memcpy(p + 1, &i, sizeof(i));
+        sb->w += 1 + sizeof(i);
+      }
+      else {
+        sil_Number x = sil_tonumber(L, idx);
+        p = prepbuf(L, sb, 1 + sizeof(x));
+        *p = TAG_FLOAT;
+        memcpy(p + 1, &x, sizeof(x));
+        sb->w += 1 + sizeof(x);
+      }
+      break;
+    }
+    case SIL_TSTRING: {
+      size_t l;
+      const char *s = sil_tolstring(L, idx, &l);
+      *prepbuf(L, sb, 1) = TAG_STR;
+      sb->w++;
+      encodesize(L, sb, l);
+      addlstring(L, sb, s, l);
+      break;
+    }
+    case SIL_TTABLE: {
+      sil_Unsigned n = sil_rawlen(L, idx);
+      sil_Unsigned i;
+      if (l_unlikely(depth >= MAXDEPTH))
+        silL_error(L, "table nesting too deep to encode");
+      silL_checkstack(L, 3, "table nesting too deep to encode");
+      *prepbuf(L, sb, 1) = TAG_TABLE;
+      sb->w++;
+      encodesize(L, sb, n);
+      for (i = 1; i <= n; i++) {
+        sil_rawgeti(L, idx, l_castU2S(i));
+        encode(L, sb, sil_gettop(L), depth + 1);
+        sil_pop(L, 1);
+      }
+      sil_pushnil(L);  /* first key */
+      while (sil_next(L, idx)) {
+        int top = sil_gettop(L);
+        if (!(sil_isinteger(L, top - 1) &&  /* not in the sequence? */
+              l_castS2U(sil_tointeger(L, top - 1)) - 1u < n)) {
+          encode(L, sb, top - 1, depth + 1);
+          encode(L, sb, top, depth + 1);
+        }
+        sil_pop(L, 1);  /* remove value; keep key for next iteration */
+      }
+      *prepbuf(L, sb, 1) = TAG_NIL;  /* end of entries */
+      sb->w++;
+      break;
+    }
+    default:
+      silL_error(L, "cannot encode a %s value", silL_typename(L, idx));
+  }
+}
+
+
+static int malformed (sil_State *L) {
+  return silL_error(L, "malformed encoded data");
+}
+
+
+/* read 'n' bytes from buffer 'sb' */
+static const char *decodebytes (sil_State *L, StrBuf *sb, size_t n) {
+  const char *p = sb->b + sb->r;
+  if (l_unlikely(buflen(sb) < n))
+    malformed(L);
+  sb->r += n;
+  return p;
+}
+
+
+static size_t decodesize (sil_State *L, StrBuf *sb) {
+  size_t n = 0;
+  int shift = 0;
+  unsigned int c;
+  do {
+    if (l_unlikely(shift >= cast_int(sizeof(size_t) * 8)))
+      malformed(L);
+    c = cast_uchar(*decodebytes(L, sb, 1));
+    n |= cast_sizet(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return n;
+}
+
+
+/*
+** Decode one value from 'sb' (advancing only its read position) and
+** push it; return its tag.
+*/
+static int decode (sil_State *L, StrBuf *sb, int depth) {
+  int tag = cast_uchar(*decodebytes(L, sb, 1));
+  switch (tag) {
+    case TAG_NIL: sil_pushnil(L); break;
+    case TAG_FALSE: sil_pushboolean(L, 0); break;
+    case TAG_TRUE: sil_pushboolean(L, 1); break;
+    case TAG_INT: {
+      sil_Integer i;
+      memcpy(&i, decodebytes(L, sb, sizeof(i)), sizeof(i));
+      sil_pushinteger(L, i);
+      break;
+    }
+    case TAG_FLOAT: {
+      sil_Number x;
+      memcpy(&x, decodebytes(L, sb, sizeof(x)), sizeof(x));
+      sil_pushnumber(L, x);
+      break;
+    }
+    case TAG_STR: {
+      size_t l = decodesize(L, sb);
+      const char *s = decodebytes(L, sb, l);
+      sil_pushlstring(L, s, l);
+      break;
+    }
+    case TAG_TABLE: {
+      size_t n = decodesize(L, sb);
+      size_t i;
+      if (l_unlikely(depth >= MAXDEPTH))
+        silL_error(L, "table nesting too deep to decode");
+      silL_checkstack(L, 3, "table nesting too deep to decode");
+      if (l_unlikely(n > buflen(sb)))  /* each element needs a byte */
+        malformed(L);
+      sil_createtable(L, (n <= INT_MAX) ? cast_int(n) : 0, 0);
+      for (i = 1; i <= n; i++) {
+        decode(L, sb, depth + 1);
+        sil_rawseti(L, -2, cast(sil_Integer, i));
+      }
+      while (decode(L, sb, depth + 1) != TAG_NIL) {  /* read key */
+        decode(L, sb, depth + 1);  /* read value */
+        sil_rawset(L, -3);
+      }
+      sil_pop(L, 1);  /* remove nil that ended the entries */
+      break;
+    }
+    default:
+      malformed(L);
+  }
+  return tag;
+}
+
+
+/* b:encode(v): append the image of 'v' */
+static int buf_encode (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  sil_settop(L, 2);
+  encode(L, sb, 2, 0);
+  sil_settop(L, 1);
+  return 1;
+}
+
+
+/* b:decode(): consume one image and return its value */
+static int buf_decode (sil_State *L) {
+  StrBuf *sb = checkbuf(L, 1);
+  StrBuf aux = *sb;  /* decode on a copy, so that errors consume nothing */
+  decode(L, &aux, 0);
+  consume(sb, aux.r - sb->r);
+  return 1;
+}
+
+
+/* buffer.encode(v): image of 'v' as a string */
+static int buf_encodestr (sil_State *L) {
+  StrBuf *sb;
+  sil_settop(L, 1);
+  sb = newbuf(L, 0);
+  encode(L, sb, 1, 0);
+  sil_replace(L, 1);  /* put buffer at index 1... */
+  return buf_take(L);  /* ...and give its block to the result */
+}
+
+
+/* buffer.decode(s): value whose image is string 's' */
+static int buf_decodestr (sil_State *L) {
+  size_t l;
+  const char *s = silL_checklstring(L, 1, &l);
+  StrBuf sb;  /* read-only view of the string */
+  sb.b = cast(char *, s);
+  sb.size = sb.w = l;
+  sb.r = 0;
+  decode(L, &sb, 0);
+  if (l_unlikely(sb.r != sb.w))
+    silL_error(L, "extra bytes after encoded data");
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static const silL_Reg buf_funcs[] = {
+  {"new", buf_new},
+  {"encode", buf_encodestr},
+  {"decode", buf_decodestr},
+  {NULL, NULL}
+};
+
+
+static const silL_Reg buf_meth[] = {
+  {"put", buf_put},
+  {"reserve", buf_reserve},
+  {"commit", buf_commit},
+  {"skip", buf_skip},
+  {"get", buf_get},
+  {"peek", buf_peek},
+  {"ref", buf_ref},
+  {"tostring", buf_tostring},
+  {"take", buf_take},
+  {"reset", buf_reset},
+  {"free", buf_free},
+  {"encode", buf_encode},
+  {"decode", buf_decode},
+  {"putf", NULL},  /* placeholder */
+  {NULL, NULL}
+};
+
+
+static const silL_Reg buf_metameth[] = {
+  {"__index", NULL},  /* placeholder */
+  {"__gc", buf_free},
+  {"__close", buf_free},
+  {"__len", buf_len},
+  {"__tostring", buf_tostring},
+  {NULL, NULL}
+};
+
+
+static void createmeta (sil_State *L) {
+  silL_newmetatable(L, BUFFERNAME);  /* metatable for buffers */
+  silL_setfuncs(L, buf_metameth, 0);  /* add metamethods to new metatable */
+  silL_newlibtable(L, buf_meth);  /* create method table */
+  silL_setfuncs(L, buf_meth, 0);  /* add methods to method table */
+  /* 'putf' uses 'string.format' */
+  silL_requiref(L, SIL_STRLIBNAME, silopen_string, 0);
+  sil_getfield(L, -1, "format");
+  sil_pushcclosure(L, buf_putf, 1);
+  sil_setfield(L, -3, "putf");
+  sil_pop(L, 1);  /* pop string library */
+  sil_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  sil_pop(L, 1);  /* pop metatable */
+}
+
+
+SILMOD_API int silopen_buffer (sil_State *L) {
+  silL_newlib(L, buf_funcs);
+  createmeta(L);
+  return 1;
+}
+
@@ -1908,4 +1908,632 @@ void silK_finish (FuncState *fs) {
       default: break;
     }
   }
+  silP_fuse(p->code, fs->pc);
 }
+
+
+/*
+** {======================================================================
+** Bytecode optimizer
+** Optional passes over a finished prototype, requested with the 'O'
+** load mode. They work on the generic opcodes and keep the observable
+** behavior of the code, except that 'debug.setlocal' on a local that
+** was found to be constant no longer affects the code and that hooks
+** see fewer instructions.
+** =======================================================================
+*/
+
+/* information about a local variable */
+typedef struct LocalInfo {
+  TValue k;  /* value it holds during all its scope (if 'isk') */
+  int kidx;  /* index of 'k' in the constant table, or -1 */
+  int reg;  /* register holding the variable */
+  int isk;
+} LocalInfo;
+
+
+typedef struct OptState {
+  sil_State *L;
+  Proto *p;
+  int n;  /* number of instructions */
+  LocalInfo *locals;  /* one entry for each element of 'p->locvars' */
+  int *target;  /* 'target[pc]' is true if control can jump to 'pc' */
+  int *map;  /* new position of each instruction (or liveness flag) */
+  int *work;  /* work list, register stack, and line numbers */
+} OptState;
+
+
+/* does instruction 'i' skip the next one when some condition holds? */
+#define skipsnext(i)	(testTMode(GET_OPCODE(i)) || \
+                         GET_OPCODE(i) == OP_LFALSESKIP)
+
+
+/*
+** Destination of a branch instruction at 'pc', or -1 if it is not a
+** branch. The destination of OP_FORPREP is its OP_FORLOOP (the loop
+** is skipped by going to the instruction after it) and the one of
+** OP_TFORPREP is its OP_TFORCALL.
+*/
+static int branchdest (Instruction i, int pc) {
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: return pc + 1 + GETARG_sJ(i);
+    case OP_FORPREP: case OP_TFORPREP: return pc + 1 + GETARG_Bx(i);
+    case OP_FORLOOP: case OP_TFORLOOP: return pc + 1 - GETARG_Bx(i);
+    default: return -1;
+  }
+}
+
+
+static void setbranchdest (Instruction *i, int pc, int dest) {
+  switch (GET_OPCODE(*i)) {
+    case OP_JMP: SETARG_sJ(*i, dest - (pc + 1)); break;
+    case OP_FORPREP: case OP_TFORPREP: SETARG_Bx(*i, dest - (pc + 1)); break;
+    case OP_FORLOOP: case OP_TFORLOOP: SETARG_Bx(*i, (pc + 1) - dest); break;
+    default: sil_assert(0);
+  }
+}
+
+
+static void marktargets (OptState *os) {
+  Instruction *code = os->p->code;
+  int pc;
+  for (pc = 0; pc <= os->n; pc++)
+    os->target[pc] = 0;
+  for (pc = 0; pc < os->n; pc++) {
+    int dest = branchdest(code[pc], pc);
+    if (dest >= 0) {
+      os->target[dest] = 1;
+      if (GET_OPCODE(code[pc]) == OP_FORPREP)
+        os->target[dest + 1] = 1;  /* loop exit */
+    }
+    if (skipsnext(code[pc]) && pc + 2 <= os->n)
+      os->target[pc + 2] = 1;
+  }
+}
+
+
+/*
+** Compute the register of each local variable. Scopes are properly
+** nested, so the variables active when another one starts form a
+** stack, and the new variable goes on top of it.
+*/
+static void localregs (OptState *os) {
+  Proto *p = os->p;
+  int *stack = os->work;
+  int top = 0;
+  int i;
+  for (i = 0; i < p->sizelocvars; i++) {
+    int startpc = p->locvars[i].startpc;
+    while (top > 0 && p->locvars[stack[top - 1]].endpc <= startpc)
+      top--;  /* variable is not active anymore */
+    os->locals[i].reg = top;
+    os->locals[i].isk = 0;
+    stack[top++] = i;
+  }
+}
+
+
+/* may instruction 'i' change the contents of register 'r'? */
+static int writesreg (Instruction i, int r) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_LOADNIL: return (a <= r && r <= a + GETARG_B(i));
+    case OP_SELF: return (r == a || r == a + 1);
+    case OP_CONCAT: return (a <= r && r < a + GETARG_B(i));
+    case OP_TBC: return (r == a);  /* cannot be constant anyway */
+    case OP_CALL: case OP_TAILCALL: case OP_VARARG: case OP_VARARGPREP:
+    case OP_VARSELECT: case OP_FORPREP: case OP_FORLOOP: case OP_TFORPREP:
+    case OP_TFORCALL: case OP_TFORLOOP:
+      return (r >= a);  /* may use everything above 'a' */
+    default: return (testAMode(op) && r == a);
+  }
+}
+
+
+/*
+** Check whether register 'r' keeps its value along [startpc, endpc):
+** no instruction there writes it and no closure created there can
+** change it through an upvalue.
+*/
+static int isreadonly (OptState *os, int r, int startpc, int endpc) {
+  Proto *p = os->p;
+  int pc;
+  for (pc = startpc; pc < endpc; pc++) {
+    Instruction i = p->code[pc];
+    if (writesreg(i, r))
+      return 0;
+    if (GET_OPCODE(i) == OP_CLOSURE) {
+      Proto *f = p->p[GETARG_Bx(i)];
+      int u;
+      for (u = 0; u < f->sizeupvalues; u++) {
+        if (f->upvalues[u].instack && f->upvalues[u].idx == r)
+          return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Find the instruction that initializes local variable 'v', which
+** must be a simple load into its register among the instructions
+** just before the start of its scope (several variables can be
+** initialized together). Return -1 if there is no such instruction or
+** if control can enter the scope without executing it.
+*/
+static int findinit (OptState *os, int v) {
+  Proto *p = os->p;
+  int startpc = p->locvars[v].startpc;
+  int r = os->locals[v].reg;
+  int first = startpc - 1;  /* first instruction that can initialize 'v' */
+  int pc, j;
+  for (j = v - 1; j >= 0 && p->locvars[j].startpc == startpc; j--)
+    first--;
+  for (j = v + 1; j < p->sizelocvars && p->locvars[j].startpc == startpc; j++)
+    first--;
+  for (pc = startpc - 1; pc >= first && pc >= 0; pc--) {
+    Instruction i = p->code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_MOVE: break;
+      default: return -1;
+    }
+    if (GETARG_A(i) == r) {
+      for (j = pc + 1; j <= startpc; j++) {
+        if (os->target[j])
+          return -1;  /* some path skips the initialization */
+      }
+      return pc;
+    }
+  }
+  return -1;
+}
+
+
+/*
+** Set the constant value of local variable 'v' from its initializing
+** instruction at 'pc'. A copy of another constant local is constant,
+** too.
+*/
+static int initvalue (OptState *os, int v, int pc) {
+  Proto *p = os->p;
+  LocalInfo *li = &os->locals[v];
+  Instruction i = p->code[pc];
+  li->kidx = -1;
+  switch (GET_OPCODE(i)) {
+    case OP_LOADI: setivalue(&li->k, GETARG_sBx(i)); return 1;
+    case OP_LOADF: setfltvalue(&li->k, cast_num(GETARG_sBx(i))); return 1;
+    case OP_LOADK: {
+      TValue *k = &p->k[GETARG_Bx(i)];
+      if (!ttisnumber(k) && !ttisshrstring(k))
+        return 0;
+      setobj(os->L, &li->k, k);
+      li->kidx = GETARG_Bx(i);
+      return 1;
+    }
+    case OP_MOVE: {
+      int u;
+      for (u = v - 1; u >= 0; u--) {
+        LocVar *lv = &p->locvars[u];
+        if (lv->startpc <= pc && pc < lv->endpc &&
+            os->locals[u].reg == GETARG_B(i)) {
+          if (!os->locals[u].isk || lv->endpc < p->locvars[v].endpc)
+            return 0;
+          *li = os->locals[u];
+          li->reg = GETARG_A(i);
+          li->isk = 0;  /* not known yet */
+          return 1;
+        }
+      }
+      return 0;
+    }
+    default: return 0;
+  }
+}
+
+
+/*
+** Index of the constant of 'li' in the constant table, adding it if
+** needed; -1 if it does not fit in an 8-bit operand.
+*/
+static int constidx (OptState *os, LocalInfo *li) {
+  Proto *p = os->p;
+  int idx;
+  if (li->kidx >= 0)
+    return (li->kidx <= MAXARG_C) ? li->kidx : -1;
+  for (idx = 0; idx < p->sizek && idx <= MAXARG_C; idx++) {
+    if (ttypetag(&p->k[idx]) == ttypetag(&li->k) &&
+        silV_rawequalobj(&p->k[idx], &li->k))
+      return li->kidx = idx;
+  }
+  if (p->sizek > MAXARG_C || !ttisnumber(&li->k))
+    return -1;
+  p->k = silM_reallocvector(os->L, p->k, p->sizek, p->sizek + 1, TValue);
+  setobj(os->L, &p->k[p->sizek], &li->k);
+  return li->kidx = p->sizek++;
+}
+
+
+/*
+** Check whether the constant of 'li' can be an immediate operand of
+** a comparison; 'isfloat' tells whether the original value was a float.
+*/
+static int isimmediate (LocalInfo *li, int *im, int *isfloat) {
+  sil_Integer i;
+  if (ttisinteger(&li->k))
+    i = ivalue(&li->k);
+  else if (ttisfloat(&li->k) &&
+           silV_flttointeger(fltvalue(&li->k), &i, F2Ieq))
+    *isfloat = 1;
+  else
+    return 0;
+  if (!fitsC(i))
+    return 0;
+  *im = cast_int(i);
+  return 1;
+}
+
+
+/*
+** Rewrite an arithmetic instruction (and its OP_MMBIN) that has
+** register 'r' as an operand to use the constant of 'li' as an
+** immediate or K operand, as the code generator does for literals.
+*/
+static void karith (OptState *os, int pc, int r, LocalInfo *li) {
+  Instruction *code = os->p->code;
+  Instruction i = code[pc];
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  int other;  /* the operand that stays in a register */
+  int flip = 0;
+  int tm = GETARG_C(code[pc + 1]);
+  int idx;
+  if (GET_OPCODE(code[pc + 1]) != OP_MMBIN || GETARG_B(i) == GETARG_C(i))
+    return;
+  if (GETARG_C(i) == r)
+    other = GETARG_B(i);
+  else if (GETARG_B(i) == r) {  /* constant is the first operand */
+    other = GETARG_C(i);
+    flip = 1;
+  }
+  else return;
+  if (ttisinteger(&li->k) && fitsC(ivalue(&li->k))) {
+    int v = cast_int(ivalue(&li->k));
+    OpCode iop = OP_MOVE;  /* no immediate variant */
+    int im = v;
+    switch (op) {
+      case OP_ADD: iop = OP_ADDI; break;
+      case OP_SUB: if (!flip && fitsC(-v)) { iop = OP_ADDI; im = -v; } break;
+      case OP_SHR: if (!flip) iop = OP_SHRI; break;
+      case OP_SHL: {
+        if (flip) iop = OP_SHLI;  /* I << r */
+        else if (fitsC(-v)) { iop = OP_SHRI; im = -v; }  /* r >> -I */
+        break;
+      }
+      default: break;
+    }
+    if (iop != OP_MOVE) {
+      code[pc] = CREATE_ABCk(iop, a, other, int2sC(im), 0);
+      code[pc + 1] = CREATE_ABCk(OP_MMBINI, other, int2sC(v), tm, flip);
+      return;
+    }
+  }
+  if (op > OP_BXOR)
+    return;  /* shifts have no K variants */
+  if (flip && op != OP_ADD && op != OP_MUL && op < OP_BAND)
+    return;  /* not commutative */
+  if (!(op < OP_BAND ? ttisnumber(&li->k) : ttisinteger(&li->k)))
+    return;
+  if ((idx = constidx(os, li)) >= 0) {
+    code[pc] = CREATE_ABCk(op - OP_ADD + OP_ADDK, a, other, idx, 0);
+    code[pc + 1] = CREATE_ABCk(OP_MMBINK, other, idx, tm, flip);
+  }
+}
+
+
+/*
+** Rewrite instruction at 'pc' to use the constant of 'li' instead of
+** reading register 'r', when there is a variant with a constant
+** operand.
+*/
+static void usek (OptState *os, int pc, int r, LocalInfo *li) {
+  Instruction *code = os->p->code;
+  Instruction i = code[pc];
+  OpCode op = GET_OPCODE(i);
+  int a, b, c, k, im, idx;
+  int isfloat = 0;
+  if (getOpMode(op) != iABC)
+    return;  /* no register operands to replace */
+  a = GETARG_A(i);
+  b = GETARG_B(i);
+  c = GETARG_C(i);
+  k = GETARG_k(i);
+  switch (op) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: {
+      karith(os, pc, r, li);
+      break;
+    }
+    case OP_EQ: {
+      if ((a == r) == (b == r))
+        break;
+      if (a == r)  /* equality is symmetric */
+        a = b;
+      if (isimmediate(li, &im, &isfloat))
+        code[pc] = CREATE_ABCk(OP_EQI, a, int2sC(im), isfloat, k);
+      else if ((idx = constidx(os, li)) >= 0)
+        code[pc] = CREATE_ABCk(OP_EQK, a, idx, 0, k);
+      break;
+    }
+    case OP_LT: case OP_LE: {
+      if ((a == r) == (b == r) || !isimmediate(li, &im, &isfloat))
+        break;
+      if (b == r)  /* R[A] < K */
+        code[pc] = CREATE_ABCk(op - OP_LT + OP_LTI, a, int2sC(im),
+                                                    isfloat, k);
+      else  /* K < R[B]  ==>  R[B] > K */
+        code[pc] = CREATE_ABCk(op - OP_LT + OP_GTI, b, int2sC(im),
+                                                    isfloat, k);
+      break;
+    }
+    case OP_GETTABLE: {
+      if (c != r || b == r)
+        break;
+      if (ttisinteger(&li->k) && l_castS2U(ivalue(&li->k)) <= MAXARG_C)
+        code[pc] = CREATE_ABCk(OP_GETI, a, b, cast_int(ivalue(&li->k)), 0);
+      else if (ttisshrstring(&li->k) && (idx = constidx(os, li)) >= 0)
+        code[pc] = CREATE_ABCk(OP_GETFIELD, a, b, idx, 0);
+      break;
+    }
+    case OP_SETTABLE: {
+      if (a == r)
+        break;
+      if (!k && c == r && (idx = constidx(os, li)) >= 0) {
+        c = idx;  /* value is a constant */
+        k = 1;
+      }
+      if (b == r) {  /* key is a constant? */
+        if (ttisinteger(&li->k) && l_castS2U(ivalue(&li->k)) <= MAXARG_B)
+          i = CREATE_ABCk(OP_SETI, a, cast_int(ivalue(&li->k)), c, k);
+        else if (ttisshrstring(&li->k) && (idx = constidx(os, li)) >= 0)
+          i = CREATE_ABCk(OP_SETFIELD, a, idx, c, k);
+        else
+          i = CREATE_ABCk(OP_SETTABLE, a, b, c, k);
+      }
+      else
+        i = CREATE_ABCk(OP_SETTABLE, a, b, c, k);
+      code[pc] = i;
+      break;
+    }
+    case OP_SETI: case OP_SETFIELD: case OP_SETTABUP: {
+      if (!k && c == r && (idx = constidx(os, li)) >= 0)
+        code[pc] = CREATE_ABCk(op, a, b, idx, 1);
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/*
+** Constant propagation: a local variable initialized with a constant
+** (or with a copy of a constant local) whose register is never
+** written in its scope holds that constant; instructions reading it
+** are changed to their variants with immediate or K operands. The
+** variable itself stays in its register, for the debug interface.
+*/
+static void propagate (OptState *os) {
+  Proto *p = os->p;
+  int v;
+  localregs(os);
+  for (v = 0; v < p->sizelocvars; v++) {
+    LocVar *lv = &p->locvars[v];
+    int r = os->locals[v].reg;
+    int init = findinit(os, v);
+    int pc;
+    if (init < 0 || !initvalue(os, v, init) ||
+        !isreadonly(os, r, lv->startpc, lv->endpc))
+      continue;
+    os->locals[v].isk = 1;
+    for (pc = lv->startpc; pc < lv->endpc; pc++)
+      usek(os, pc, r, &os->locals[v]);
+  }
+}
+
+
+/*
+** Jump threading: an unconditional jump to a return becomes that
+** return. (Jumps to jumps were already collapsed by 'silK_finish'.)
+** Jumps after test instructions must stay as they are, because tests
+** execute them directly.
+*/
+static void threadreturns (OptState *os) {
+  Instruction *code = os->p->code;
+  int pc;
+  for (pc = 0; pc < os->n; pc++) {
+    if (GET_OPCODE(code[pc]) == OP_JMP &&
+        !(pc > 0 && skipsnext(code[pc - 1]))) {
+      Instruction ret = code[branchdest(code[pc], pc)];
+      switch (GET_OPCODE(ret)) {
+        case OP_RETURN:
+          if (GETARG_B(ret) == 0)
+            break;  /* needs 'top' set by the previous instruction */
+          /* FALLTHROUGH */
+        case OP_RETURN0: case OP_RETURN1:
+          code[pc] = ret;
+          break;
+        default: break;
+      }
+    }
+  }
+}
+
+
+#define reach(os,pc,live,top)  \
+	{ if ((pc) < (os)->n && !live[pc]) { live[pc] = 1; \
+                                             (os)->work[top++] = (pc); } }
+
+/*
+** Mark in 'os->map' the instructions reachable from the entry point,
+** except jumps to the next instruction.
+*/
+static void markreachable (OptState *os) {
+  Instruction *code = os->p->code;
+  int *live = os->map;
+  int top = 0;
+  int pc;
+  for (pc = 0; pc < os->n; pc++)
+    live[pc] = 0;
+  reach(os, 0, live, top);
+  while (top > 0) {
+    Instruction i;
+    pc = os->work[--top];
+    i = code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_RETURN: case OP_RETURN0: case OP_RETURN1: break;
+      case OP_JMP: case OP_TFORPREP: {
+        reach(os, branchdest(i, pc), live, top);
+        break;
+      }
+      case OP_FORPREP: case OP_FORLOOP: case OP_TFORLOOP: {
+        /* OP_FORPREP skips its OP_FORLOOP, which must stay in place */
+        reach(os, branchdest(i, pc), live, top);
+        reach(os, pc + 1, live, top);
+        break;
+      }
+      default: {
+        reach(os, pc + 1, live, top);
+        if (skipsnext(i))
+          reach(os, pc + 2, live, top);
+        break;
+      }
+    }
+  }
+  for (pc = 0; pc < os->n; pc++) {
+    if (live[pc] && GET_OPCODE(code[pc]) == OP_JMP &&
+        branchdest(code[pc], pc) == pc + 1 &&
+        !(pc > 0 && skipsnext(code[pc - 1])))
+      live[pc] = 0;  /* useless jump */
+  }
+}
+
+
+/*
+** Encode line information for 'n' instructions with lines 'lines',
+** as 'savelineinfo' does; return the number of absolute entries.
+** Only count them if 'store' is false.
+*/
+static int encodelines (Proto *p, const int *lines, int n, int store) {
+  int previousline = p->linedefined;
+  int iwthabs = 0;
+  int nabs = 0;
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    int linedif = lines[pc] - previousline;
+    if (abs(linedif) >= LIMLINEDIFF || iwthabs++ >= MAXIWTHABS) {
+      if (store) {
+        p->abslineinfo[nabs].pc = pc;
+        p->abslineinfo[nabs].line = lines[pc];
+      }
+      nabs++;
+      linedif = ABSLINEINFO;
+      iwthabs = 1;
+    }
+    if (store)
+      p->lineinfo[pc] = cast(ls_byte, linedif);
+    previousline = lines[pc];
+  }
+  return nabs;
+}
+
+
+/*
+** Dead-code elimination: remove unreachable instructions and jumps to
+** the next instruction, correcting branches, line information, and
+** the scopes of local variables.
+*/
+static void removedead (OptState *os) {
+  sil_State *L = os->L;
+  Proto *p = os->p;
+  Instruction *code = p->code;
+  int *map = os->map;
+  int n = os->n;
+  int newn = 0;
+  int pc;
+  markreachable(os);
+  for (pc = 0; pc < n; pc++) {
+    int live = map[pc];
+    map[pc] = newn;
+    newn += live;
+  }
+  map[n] = newn;
+  if (newn == n)
+    return;  /* nothing to remove */
+  for (pc = 0; pc < n; pc++) {
+    if (map[pc] < map[pc + 1]) {  /* live instruction? */
+      int dest;
+      if (p->lineinfo != NULL)  /* keep its line */
+        os->work[map[pc]] = silG_getfuncline(p, pc);
+      dest = branchdest(code[pc], pc);
+      if (dest >= 0)
+        setbranchdest(&code[pc], map[pc], map[dest]);
+      code[map[pc]] = code[pc];
+    }
+  }
+  silM_shrinkvector(L, p->code, p->sizecode, newn, Instruction);
+  if (p->icache != NULL)  /* caches are still empty */
+    p->icache = silM_reallocvector(L, p->icache, n, newn, unsigned int);
+  if (p->prof != NULL)  /* so is the profile */
+    p->prof = silM_reallocvector(L, p->prof, n + 1, newn + 1, ProfSite);
+  os->n = newn;
+  for (pc = 0; pc < p->sizelocvars; pc++) {
+    p->locvars[pc].startpc = map[p->locvars[pc].startpc];
+    p->locvars[pc].endpc = map[p->locvars[pc].endpc];
+  }
+  if (p->lineinfo != NULL) {
+    int nabs = encodelines(p, os->work, newn, 0);
+    sil_assert(p->sizelineinfo == n);
+    p->abslineinfo = silM_reallocvector(L, p->abslineinfo,
+                            p->sizeabslineinfo, nabs, AbsLineInfo);
+    p->sizeabslineinfo = nabs;
+    encodelines(p, os->work, newn, 1);
+    silM_shrinkvector(L, p->lineinfo, p->sizelineinfo, newn, ls_byte);
+  }
+}
+
+
+void silK_optimize (sil_State *L, Proto *p) {
+  OptState os;
+  Udata *u;
+  size_t nlocals = cast_sizet(p->sizelocvars);
+  size_t nints = 3 * (cast_sizet(p->sizecode) + 1) + nlocals;
+  int i;
+  if (p->flag & PF_FIXED)
+    return;  /* code cannot be changed */
+  sil_assert(p->jit == NULL);  /* not run yet */
+  for (i = 0; i < p->sizep; i++)
+    silK_optimize(L, p->p[i]);
+  /* scratch memory, anchored in the stack in case of errors */
+  u = silS_newudata(L, nlocals * sizeof(LocalInfo) + nints * sizeof(int), 0);
+  setuvalue(L, s2v(L->top.p), u);
+  silD_inctop(L);
+  os.L = L;
+  os.p = p;
+  os.n = p->sizecode;
+  os.locals = cast(LocalInfo *, getudatamem(u));
+  os.target = cast(int *, os.locals + nlocals);
+  os.map = os.target + os.n + 1;
+  os.work = os.map + os.n + 1;
+  for (i = 0; i < os.n; i++)  /* work on generic opcodes */
+    p->code[i] = silP_unquicken(p->code[i]);
+  marktargets(&os);
+  propagate(&os);
+  threadreturns(&os);
+  removedead(&os);
+  silP_fuse(p->code, p->sizecode);
+  L->top.p--;  /* remove scratch memory */
+}
+
+/* }====================================================================== */
@@ -97,6 +97,7 @@ SILI_FUNC void silK_settablesize (FuncState *fs, int pc,
                                   int ra, int asize, int hsize);
 SILI_FUNC void silK_setlist (FuncState *fs, int base, int nelems, int tostore);
 SILI_FUNC void silK_finish (FuncState *fs);
+SILI_FUNC void silK_optimize (sil_State *L, Proto *p);
 SILI_FUNC l_noret silK_semerror (LexState *ls, const char *fmt, ...);
 
 
@@ -144,15 +144,15 @@ static void treatstackoption (sil_State *L, sil_State *L1, const char *fname) {
 /*
 ** Calls 'sil_getinfo' and collects all results in a new table.
 ** L1 needs stack space for an optional input (function) plus
-** two optional outputs (function and line table) from function
-** 'sil_getinfo'.
+** three optional outputs (function, line table, and profile) from
+** function 'sil_getinfo'.
 */
 static int db_getinfo (sil_State *L) {
   sil_Debug ar;
   int arg;
   sil_State *L1 = getthread(L, &arg);
   const char *options = silL_optstring(L, arg+2, "flnSrtu");
-  checkstack(L, L1, 3);
+  checkstack(L, L1, 4);
   silL_argcheck(L, options[0] != '>', arg + 2, "invalid option '>'");
   if (sil_isfunction(L, arg + 1)) {  /* info about a function? */
     options = sil_pushfstring(L, ">%s", options);  /* add '>' to 'options' */
@@ -195,6 +195,8 @@ static int db_getinfo (sil_State *L) {
     settabsb(L, "istailcall", ar.istailcall);
     settabsi(L, "extraargs", ar.extraargs);
   }
+  if (strchr(options, 'P'))
+    treatstackoption(L, L1, "profile");
   if (strchr(options, 'L'))
     treatstackoption(L, L1, "activelines");
   if (strchr(options, 'f'))
@@ -449,6 +451,37 @@ static int db_traceback (sil_State *L) {
 }
 
 
+/*
+** Execution profile of a function, or of the function running at a
+** given level (by default, the caller). Fails if the function is not
+** a SIL function or the interpreter was built without profiling.
+*/
+static int db_profile (sil_State *L) {
+  sil_Debug ar;
+  if (sil_isfunction(L, 1))
+    sil_pushvalue(L, 1);
+  else {
+    int level = (int)silL_optinteger(L, 1, 1);
+    if (!sil_getstack(L, level, &ar))
+      return silL_argerror(L, 1, "level out of range");
+    sil_getinfo(L, "f", &ar);  /* push function at that level */
+  }
+  sil_getinfo(L, ">P", &ar);
+  return 1;
+}
+
+
+/*
+** Opcode statistics of the interpreter, if it was built to keep them;
+** a true argument also clears them.
+*/
+static int db_opstats (sil_State *L) {
+  if (!sil_opstats(L, sil_toboolean(L, 1)))
+    silL_pushfail(L);
+  return 1;
+}
+
+
 static const silL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -458,6 +491,8 @@ static const silL_Reg dblib[] = {
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
   {"getupvalue", db_getupvalue},
+  {"opstats", db_opstats},
+  {"profile", db_profile},
   {"upvaluejoin", db_upvaluejoin},
   {"upvalueid", db_upvalueid},
   {"setuservalue", db_setuservalue},
@@ -320,6 +320,232 @@ static void collectvalidlines (sil_State *L, Closure *f) {
 }
 
 
+/*
+** {======================================================
+** Execution profiles and opcode statistics
+** =======================================================
+*/
+
+#if SIL_USE_PROFILE || SIL_USE_OPSTATS
+
+#include "lopnames.h"
+
+/*
+** Auxiliary functions to build result tables. Tables and keys are
+** anchored in the stack while in use.
+*/
+
+static Table *pushtable (sil_State *L) {
+  Table *t = silH_new(L);
+  sethvalue2s(L, L->top.p, t);
+  silD_inctop(L);
+  return t;
+}
+
+
+static void pushint (sil_State *L, sil_Integer i) {
+  setivalue(s2v(L->top.p), i);
+  silD_inctop(L);
+}
+
+
+static void pushstr (sil_State *L, const char *s) {
+  setsvalue2s(L, L->top.p, silS_new(L, s));
+  silD_inctop(L);
+}
+
+
+/* t[k] = value on the top of the stack, which is popped */
+static void setfield (sil_State *L, Table *t, const char *k) {
+  pushstr(L, k);  /* key is anchored in the stack */
+  silH_set(L, t, s2v(L->top.p - 1), s2v(L->top.p - 2));
+  L->top.p -= 2;
+}
+
+
+#endif
+
+
+#if SIL_USE_PROFILE
+
+/* t[n] = value on the top of the stack, which is popped */
+static void setindex (sil_State *L, Table *t, sil_Integer n) {
+  silH_setint(L, t, n, s2v(L->top.p - 1));
+  L->top.p--;
+}
+
+/* names of operand types, in the order of their PT_* bits */
+static const char *const proftypes[] = {
+  "nil", "boolean", "integer", "float", "string", "table", "function",
+  "other"
+};
+
+
+/* push a list with the names of the types in 'set' */
+static void pushtypes (sil_State *L, lu_byte set) {
+  Table *t = pushtable(L);
+  sil_Integer n = 0;
+  int b;
+  for (b = 0; b <= PT_OTHER; b++) {
+    if (set & ptbit(b)) {
+      pushstr(L, proftypes[b]);
+      setindex(L, t, ++n);
+    }
+  }
+}
+
+
+/*
+** Push the profile of instruction 'pc': its position, its (generic)
+** opcode, its count and, for instructions that are not loops, the
+** types of its operands.
+*/
+static void pushsite (sil_State *L, const Proto *p, int pc, int isloop) {
+  const ProfSite *ps = &p->prof[pc];
+  Table *t = pushtable(L);
+  pushint(L, pc + 1);
+  setfield(L, t, "pc");
+  pushint(L, silG_getfuncline(p, pc));
+  setfield(L, t, "line");
+  pushstr(L, opnames[GET_OPCODE(silP_unquicken(p->code[pc]))]);
+  setfield(L, t, "op");
+  pushint(L, cast(sil_Integer, ps->count));
+  setfield(L, t, "count");
+  if (!isloop) {
+    Table *ops = pushtable(L);
+    pushtypes(L, ps->types[0]);
+    setindex(L, ops, 1);
+    if (ps->types[1] != 0) {  /* has a second operand? */
+      pushtypes(L, ps->types[1]);
+      setindex(L, ops, 2);
+    }
+    setfield(L, t, "operands");
+  }
+}
+
+
+static int isloopop (Instruction i) {
+  switch (GET_OPCODE(silP_unquicken(i))) {
+    case OP_JMP: case OP_FORLOOP: case OP_TFORLOOP: return 1;
+    default: return 0;
+  }
+}
+
+
+/*
+** Push the profile of prototype 'p' and, recursively, of its nested
+** functions. Only instructions that ran appear in it.
+*/
+static void pushprofile (sil_State *L, const Proto *p) {
+  Table *t = pushtable(L);
+  Table *loops, *sites, *funcs;
+  sil_Integer nloops = 0, nsites = 0;
+  int pc;
+  pushstr(L, (p->source != NULL) ? getstr(p->source) : "=?");
+  setfield(L, t, "source");
+  pushint(L, p->linedefined);
+  setfield(L, t, "linedefined");
+  pushint(L, p->lastlinedefined);
+  setfield(L, t, "lastlinedefined");
+  pushint(L, cast(sil_Integer, p->prof[p->sizecode].count));
+  setfield(L, t, "calls");
+  loops = pushtable(L);
+  sites = pushtable(L);
+  for (pc = 0; pc < p->sizecode; pc++) {
+    if (p->prof[pc].count > 0) {
+      int isloop = isloopop(p->code[pc]);
+      pushsite(L, p, pc, isloop);
+      if (isloop)
+        setindex(L, loops, ++nloops);
+      else
+        setindex(L, sites, ++nsites);
+    }
+  }
+  setfield(L, t, "sites");
+  setfield(L, t, "loops");
+  funcs = pushtable(L);
+  for (pc = 0; pc < p->sizep; pc++) {
+    pushprofile(L, p->p[pc]);
+    setindex(L, funcs, pc + 1);
+  }
+  setfield(L, t, "functions");
+}
+
+#endif
+
+
+/*
+** Push the execution profile of function 'f', or nil if it is not a
+** SIL function or the interpreter does not keep profiles.
+*/
+static void collectprofile (sil_State *L, Closure *f) {
+#if SIL_USE_PROFILE
+  if (SilClosure(f) && f->l.p->prof != NULL) {
+    pushprofile(L, f->l.p);
+    return;
+  }
+#else
+  UNUSED(f);
+#endif
+  setnilvalue(s2v(L->top.p));
+  api_incr_top(L);
+}
+
+
+void silG_resetopstats (OpStats *s) {
+  memset(s, 0, sizeof(OpStats));
+  s->lastop = -1;
+}
+
+
+/*
+** Push a table with the opcode statistics: each opcode that ran maps
+** to a table with its 'count', its 'cycles' (when measured), and
+** 'next', the number of times each opcode ran right after it. With
+** 'reset', clear the statistics afterwards. Return 0, pushing nothing,
+** if the interpreter does not keep statistics.
+*/
+SIL_API int sil_opstats (sil_State *L, int reset) {
+#if SIL_USE_OPSTATS
+  OpStats *s = G(L)->opstats;
+  Table *t;
+  int op, op2;
+  sil_lock(L);
+  t = pushtable(L);
+  for (op = 0; op < NUM_OPCODES; op++) {
+    if (s->count[op] > 0) {
+      Table *e = pushtable(L);
+      Table *next;
+      pushint(L, cast(sil_Integer, s->count[op]));
+      setfield(L, e, "count");
+#if SIL_USE_OPSTATS > 1
+      pushint(L, cast(sil_Integer, s->cycles[op]));
+      setfield(L, e, "cycles");
+#endif
+      next = pushtable(L);
+      for (op2 = 0; op2 < NUM_OPCODES; op2++) {
+        if (s->pairs[op][op2] > 0) {
+          pushint(L, cast(sil_Integer, s->pairs[op][op2]));
+          setfield(L, next, opnames[op2]);
+        }
+      }
+      setfield(L, e, "next");
+      setfield(L, t, opnames[op]);
+    }
+  }
+  if (reset)
+    silG_resetopstats(s);
+  sil_unlock(L);
+  return 1;
+#else
+  UNUSED(L); UNUSED(reset);
+  return 0;
+#endif
+}
+
+/* }====================================================== */
+
+
 static const char *getfuncname (sil_State *L, CallInfo *ci, const char **name) {
   /* calling function is a known function? */
   if (ci != NULL && !(ci->callstatus & CIST_TAIL))
@@ -383,6 +609,7 @@ static int auxgetinfo (sil_State *L, const char *what, sil_Debug *ar,
         break;
       }
       case 'L':
+      case 'P':
       case 'f':  /* handled by sil_getinfo */
         break;
       default: status = 0;  /* invalid option */
@@ -418,6 +645,8 @@ SIL_API int sil_getinfo (sil_State *L, const char *what, sil_Debug *ar) {
   }
   if (strchr(what, 'L'))
     collectvalidlines(L, cl);
+  if (strchr(what, 'P'))
+    collectprofile(L, cl);
   sil_unlock(L);
   return status;
 }
@@ -444,10 +673,10 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
   int pc;
   int setreg = -1;  /* keep last instruction that changed 'reg' */
   int jmptarget = 0;  /* any code before this address is conditional */
-  if (testMMMode(GET_OPCODE(p->code[lastpc])))
+  if (testMMMode(GET_OPCODE(silP_unquicken(p->code[lastpc]))))
     lastpc--;  /* previous instruction was not actually executed */
   for (pc = 0; pc < lastpc; pc++) {
-    Instruction i = p->code[pc];
+    Instruction i = silP_unquicken(p->code[pc]);
     OpCode op = GET_OPCODE(i);
     int a = GETARG_A(i);
     int change;  /* true if current instruction changed 'reg' */
@@ -511,7 +740,7 @@ static const char *basicgetobjname (const Proto *p, int *ppc, int reg,
   /* else try symbolic execution */
   *ppc = pc = findsetreg(p, pc, reg);
   if (pc != -1) {  /* could find instruction? */
-    Instruction i = p->code[pc];
+    Instruction i = silP_unquicken(p->code[pc]);
     OpCode op = GET_OPCODE(i);
     switch (op) {
       case OP_MOVE: {
@@ -572,7 +801,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
   if (kind != NULL)
     return kind;
   else if (lastpc != -1) {  /* could find instruction? */
-    Instruction i = p->code[lastpc];
+    Instruction i = silP_unquicken(p->code[lastpc]);
     OpCode op = GET_OPCODE(i);
     switch (op) {
       case OP_GETTABUP: {
@@ -615,7 +844,7 @@ static const char *getobjname (const Proto *p, int lastpc, int reg,
 static const char *funcnamefromcode (sil_State *L, const Proto *p,
                                      int pc, const char **name) {
   TMS tm = (TMS)0;  /* (initial value avoids warnings) */
-  Instruction i = p->code[pc];  /* calling instruction */
+  Instruction i = silP_unquicken(p->code[pc]);  /* calling instruction */
   switch (GET_OPCODE(i)) {
     case OP_CALL:
     case OP_TAILCALL:
@@ -8,6 +8,7 @@
 #define ldebug_h
 
 
+#include "lopcodes.h"
 #include "lstate.h"
 
 
@@ -36,7 +37,55 @@
 #endif
 
 
+/*
+** When true, the interpreter keeps an execution profile of each
+** function (calls, taken back edges, and operand types of arithmetic,
+** comparison, and table instructions), which 'debug.profile' returns.
+** It costs a little in every instruction, so it is off by default.
+*/
+#if !defined(SIL_USE_PROFILE)
+#define SIL_USE_PROFILE		0
+#endif
+
+
+/* operand types in execution profiles (bits in 'ProfSite.types') */
+#define PT_NIL		0
+#define PT_BOOLEAN	1
+#define PT_INTEGER	2
+#define PT_FLOAT	3
+#define PT_STRING	4
+#define PT_TABLE	5
+#define PT_FUNCTION	6
+#define PT_OTHER	7
+
+#define ptbit(t)	cast_byte(1u << (t))
+
+
+/*
+** When true, the interpreter counts executions of each opcode and of
+** each pair of consecutive opcodes; when it is 2, it also adds up the
+** time-stamp-counter cycles from the fetch of each opcode to the next
+** fetch (only on x86). 'debug.opstats' returns them.
+*/
+#if !defined(SIL_USE_OPSTATS)
+#define SIL_USE_OPSTATS		0
+#elif SIL_USE_OPSTATS > 1 && !(defined(__x86_64__) || defined(__i386__))
+#undef SIL_USE_OPSTATS
+#define SIL_USE_OPSTATS		1
+#endif
+
+
+typedef struct OpStats {
+  lu_mem count[NUM_OPCODES];
+  lu_mem pairs[NUM_OPCODES][NUM_OPCODES];  /* [previous][current] */
+  unsigned long long cycles[NUM_OPCODES];
+  unsigned long long lasttsc;  /* counter at the last fetch */
+  int lastop;  /* last opcode fetched (-1 if none) */
+} OpStats;
+
+
 SILI_FUNC int silG_getfuncline (const Proto *f, int pc);
+SILI_FUNC void silG_resetopstats (OpStats *s);
 SILI_FUNC const char *silG_findlocal (sil_State *L, CallInfo *ci, int n,
                                                     StkId *pos);
 SILI_FUNC l_noret silG_typeerror (sil_State *L, const TValue *o,
@@ -17,6 +17,7 @@
 #include "sil.h"
 
 #include "lapi.h"
+#include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -1104,6 +1105,8 @@ static void f_parser (sil_State *L, void *ud) {
     checkmode(L, mode, "text");
     cl = silY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
   }
+  if (strchr(mode, 'O') != NULL)  /* optimize the code? */
+    silK_optimize(L, cl->p);
   sil_assert(cl->nupvalues == cl->p->sizeupvalues);
   silF_initupvals(L, cl);
 }
@@ -18,6 +18,7 @@
 #include "lapi.h"
 #include "lgc.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "ltable.h"
 #include "lundump.h"
@@ -164,11 +165,26 @@ static void dumpString (DumpState *D, TString *ts) {
 }
 
 
+/*
+** Dump the code of a function. Instructions quickened by the interpreter
+** are saved in their generic forms, one by one; code without them is
+** dumped as a single block.
+*/
 static void dumpCode (DumpState *D, const Proto *f) {
+  int i;
   dumpInt(D, f->sizecode);
   dumpAlign(D, sizeof(f->code[0]));
   sil_assert(f->code != NULL);
-  dumpVector(D, f->code, cast_uint(f->sizecode));
+  for (i = 0; i < f->sizecode; i++) {
+    if (isspecialized(GET_OPCODE(f->code[i])))
+      break;
+  }
+  if (i > 0)
+    dumpVector(D, f->code, cast_uint(i));  /* generic prefix */
+  for (; i < f->sizecode; i++) {
+    Instruction inst = silP_unquicken(f->code[i]);
+    dumpVar(D, inst);
+  }
 }
 
 
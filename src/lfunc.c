@@ -18,6 +18,7 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "ljit.h"
 #include "lmem.h"
 #include "lobject.h"
 #include "lstate.h"
@@ -250,6 +251,11 @@ Proto *silF_newproto (sil_State *L) {
   f->sizep = 0;
   f->code = NULL;
   f->sizecode = 0;
+  f->icache = NULL;
+  f->jit = NULL;
+  f->hotcount = 0;
+  f->prof = NULL;
+  f->threaded = NULL;
   f->lineinfo = NULL;
   f->sizelineinfo = 0;
   f->abslineinfo = NULL;
@@ -268,12 +274,47 @@ Proto *silF_newproto (sil_State *L) {
 }
 
 
+/*
+** Create the inline caches for a prototype whose code is complete.
+** Each instruction gets one slot, so that the interpreter can find the
+** cache of an instruction by its position. A slot holds the index of
+** the node where the instruction last found its key; zero is a valid
+** initial value, because a hit is always validated against the key
+** stored in the node. (Field accesses use their slots as caches;
+** instructions that can be quickened use them for type feedback.)
+*/
+void silF_initcache (sil_State *L, Proto *f) {
+  int i;
+  sil_assert(f->icache == NULL);
+  if (f->sizecode == 0)
+    return;  /* nothing to cache */
+  f->icache = silM_newvector(L, f->sizecode, unsigned int);
+  for (i = 0; i < f->sizecode; i++)
+    f->icache[i] = 0;
+#if SIL_USE_PROFILE
+  f->prof = silM_newvector(L, f->sizecode + 1, ProfSite);
+  for (i = 0; i <= f->sizecode; i++) {
+    f->prof[i].count = 0;
+    f->prof[i].types[0] = f->prof[i].types[1] = 0;
+  }
+#endif
+}
+
+
 lu_mem silF_protosize (Proto *p) {
   lu_mem sz = cast(lu_mem, sizeof(Proto))
             + cast_uint(p->sizep) * sizeof(Proto*)
             + cast_uint(p->sizek) * sizeof(TValue)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
             + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
+  if (p->icache != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(unsigned int);
+  if (p->prof != NULL)
+    sz += cast_uint(p->sizecode + 1) * sizeof(ProfSite);
+  if (p->threaded != NULL)
+    sz += cast_uint(p->sizecode) * sizeof(void *);
+  if (p->jit != NULL)
+    sz += sizejitcode(p->jit->sizeentry);
   if (!(p->flag & PF_FIXED)) {
     sz += cast_uint(p->sizecode) * sizeof(Instruction);
     sz += cast_uint(p->sizelineinfo) * sizeof(lu_byte);
@@ -289,6 +330,13 @@ void silF_freeproto (sil_State *L, Proto *f) {
     silM_freearray(L, f->lineinfo, cast_sizet(f->sizelineinfo));
     silM_freearray(L, f->abslineinfo, cast_sizet(f->sizeabslineinfo));
   }
+  if (f->icache != NULL)
+    silM_freearray(L, f->icache, cast_sizet(f->sizecode));
+  if (f->prof != NULL)
+    silM_freearray(L, f->prof, cast_sizet(f->sizecode) + 1);
+  if (f->threaded != NULL)
+    silM_freearray(L, f->threaded, cast_sizet(f->sizecode));
+  silJ_free(L, f);
   silM_freearray(L, f->p, cast_sizet(f->sizep));
   silM_freearray(L, f->k, cast_sizet(f->sizek));
   silM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
@@ -56,6 +56,7 @@ SILI_FUNC void silF_newtbcupval (sil_State *L, StkId level);
 SILI_FUNC void silF_closeupval (sil_State *L, StkId level);
 SILI_FUNC StkId silF_close (sil_State *L, StkId level, TStatus status, int yy);
 SILI_FUNC void silF_unlinkupval (UpVal *uv);
+SILI_FUNC void silF_initcache (sil_State *L, Proto *f);
 SILI_FUNC lu_mem silF_protosize (Proto *p);
 SILI_FUNC void silF_freeproto (sil_State *L, Proto *f);
 SILI_FUNC const char *silF_getlocalname (const Proto *func, int local_number,
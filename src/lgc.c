@@ -110,6 +110,29 @@ static void entersweep (sil_State *L);
 #define gnodelast(h)	gnode(h, cast_sizet(sizenode(h)))
 
 
+/*
+** Get in '*first' and '*limit' the nodes of part 'p' of the hash part
+** of table 'h': part 0 is its node array, part 1 is the old node array
+** of a table being rehashed incrementally. Return false if 'h' has no
+** such part.
+*/
+static int nodepart (Table *h, int p, Node **first, Node **limit) {
+  unsigned size;
+  if (p == 0) {
+    *first = gnode(h, 0);
+    *limit = gnodelast(h);
+    return 1;
+  }
+  else if (p == 1 && ismigrating(h)) {
+    *first = silH_oldnode(h, &size);
+    *limit = *first + size;
+    return 1;
+  }
+  else
+    return 0;
+}
+
+
 static l_mem objsize (GCObject *o) {
   lu_mem res;
   switch (o->tt) {
@@ -261,6 +284,34 @@ void silC_barrier_ (sil_State *L, GCObject *o, GCObject *v) {
 }
 
 
+/*
+** Back barrier for old table 't' with cards, in generational mode:
+** mark the card 'card' of the entry being set (all cards if 'card' is
+** -1; none if it is NOCARD). The table goes to 'grayagain' as touched,
+** but stays black, so that each new store of a young value into it
+** also marks its card. (A black touched table is always in
+** 'grayagain'.) A table that is not regularly old must be traversed
+** in full anyway.
+*/
+static void markcard (sil_State *L, Table *t, int card) {
+  global_State *g = G(L);
+  Cards *cs = t->cards;
+  int age = getage(t);
+  sil_assert(isblack(t) && isold(t) && g->gckind == KGC_GENMINOR);
+  if (age != G_OLD && age != G_TOUCHED1 && age != G_TOUCHED2)
+    card = -1;
+  if (card >= 0)
+    cs->c[card] = CARDDIRTY;
+  else if (card == -1)
+    memset(cs->c, CARDDIRTY, cs->na + cs->nn);
+  if (age != G_TOUCHED1 && age != G_TOUCHED2) {  /* not in 'grayagain'? */
+    linkgclist(t, g->grayagain);
+    nw2black(t);  /* keep it black */
+  }
+  setage(t, G_TOUCHED1);  /* touched in current cycle */
+}
+
+
 /*
 ** barrier that moves collector backward, that is, mark the black object
 ** pointing to a white object as gray again.
@@ -268,10 +319,16 @@ void silC_barrier_ (sil_State *L, GCObject *o, GCObject *v) {
 void silC_barrierback_ (sil_State *L, GCObject *o) {
   global_State *g = G(L);
   sil_assert(isblack(o) && !isdead(g, o));
-  sil_assert((g->gckind != KGC_GENMINOR)
-          || (isold(o) && getage(o) != G_TOUCHED1));
-  if (getage(o) == G_TOUCHED2)  /* already in gray list? */
-    set2gray(o);  /* make it gray to become touched1 */
+  if (g->gckind == KGC_GENMINOR && o->tt == SIL_VTABLE &&
+      gco2t(o)->cards != NULL) {  /* table with cards? */
+    markcard(L, gco2t(o), -1);  /* entry not known; mark all its cards */
+    return;
+  }
+  /* (a black TOUCHED1 object is a table that lost its cards in a
+     resize; it is still in 'grayagain') */
+  sil_assert((g->gckind != KGC_GENMINOR) || isold(o));
+  if (getage(o) == G_TOUCHED2 || getage(o) == G_TOUCHED1)
+    set2gray(o);  /* already in gray list; make it gray (touched1) */
   else  /* link it in 'grayagain' and paint it gray */
     linkobjgclist(o, g->grayagain);
   if (isold(o))  /* generational mode? */
@@ -279,6 +336,31 @@ void silC_barrierback_ (sil_State *L, GCObject *o) {
 }
 
 
+void silC_barriertable_ (sil_State *L, Table *t, const TValue *key) {
+  if (t->cards != NULL && G(L)->gckind == KGC_GENMINOR)
+    markcard(L, t, silH_cardof(t, key));
+  else
+    silC_barrierback_(L, obj2gco(t));
+}
+
+
+void silC_barriertablei_ (sil_State *L, Table *t, sil_Integer key) {
+  if (t->cards != NULL && G(L)->gckind == KGC_GENMINOR)
+    markcard(L, t, silH_cardofint(t, key));
+  else
+    silC_barrierback_(L, obj2gco(t));
+}
+
+
+void silC_barrierset_ (sil_State *L, Table *t, int hres,
+                                     const TValue *key) {
+  if (t->cards != NULL && G(L)->gckind == KGC_GENMINOR)
+    markcard(L, t, silH_cardofres(t, hres, key));
+  else
+    silC_barrierback_(L, obj2gco(t));
+}
+
+
 void silC_fix (sil_State *L, GCObject *o) {
   global_State *g = G(L);
   sil_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
@@ -373,12 +455,13 @@ static void reallymarkobject (global_State *g, GCObject *o) {
 
 
 /*
-** mark metamethods for basic types
+** mark metatables for basic types and for typed arrays
 */
 static void markmt (global_State *g) {
   int i;
   for (i=0; i < SIL_NUMTYPES; i++)
     markobjectN(g, g->mt[i]);
+  markobjectN(g, g->arraymt);
 }
 
 
@@ -456,6 +539,29 @@ static void restartcollection (global_State *g) {
 */
 
 
+/*
+** Cards of a table age like the table: dirty regions of a touched
+** table must be traversed in two young collections (see 'ltable.h').
+*/
+static void agecards (Table *t) {
+  Cards *cs = t->cards;
+  if (cs != NULL) {
+    unsigned i;
+    for (i = 0; i < cs->na + cs->nn; i++) {
+      if (cs->c[i] != CARDCLEAN)
+        cs->c[i]--;
+    }
+  }
+}
+
+
+static void clearcards (Table *t) {
+  Cards *cs = t->cards;
+  if (cs != NULL)
+    memset(cs->c, CARDCLEAN, cs->na + cs->nn);
+}
+
+
 /*
 ** Check whether object 'o' should be kept in the 'grayagain' list for
 ** post-processing by 'correctgraylist'. (It could put all old objects
@@ -472,8 +578,37 @@ static void genlink (global_State *g, GCObject *o) {
   if (getage(o) == G_TOUCHED1) {  /* touched in this cycle? */
     linkobjgclist(o, g->grayagain);  /* link it back in 'grayagain' */
   }  /* everything else do not need to be linked back */
-  else if (getage(o) == G_TOUCHED2)
+  else if (getage(o) == G_TOUCHED2) {
     setage(o, G_OLD);  /* advance age */
+    if (o->tt == SIL_VTABLE)
+      clearcards(gco2t(o));  /* it has been seen twice */
+  }
+}
+
+
+/*
+** Traverse the shape and slots of a table with a shape. Its keys
+** are short strings, which are never weak, so they are always marked.
+** Values are marked too, unless 'weakv'. Returns true iff some value
+** was marked or, with 'weakv', some value may have to be cleared.
+*/
+static int traverseslots (global_State *g, Table *h, int weakv) {
+  Shape *s = h->shape;
+  int res = 0;
+  unsigned i;
+  for (i = 0; i < s->nkeys; i++) {
+    TValue *v = &h->slots[i];
+    markobject(g, s->keys[i]);
+    if (weakv) {
+      if (iscleared(g, gcvalueN(v)))
+        res = 1;
+    }
+    else if (valiswhite(v)) {
+      res = 1;
+      reallymarkobject(g, gcvalue(v));
+    }
+  }
+  return res;
 }
 
 
@@ -485,18 +620,23 @@ static void genlink (global_State *g, GCObject *o) {
 ** to check table age in generational mode.
 */
 static void traverseweakvalue (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
+  Node *n, *limit;
+  int p;
   /* if there is array part, assume it may have white values (it is not
      worth traversing it now just to check) */
   int hasclears = (h->asize > 0);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
-    if (isempty(gval(n)))  /* entry is empty? */
-      clearkey(n);  /* clear its key */
-    else {
-      sil_assert(!keyisnil(n));
-      markkey(g, n);
-      if (!hasclears && iscleared(g, gcvalueN(gval(n))))  /* a white value? */
-        hasclears = 1;  /* table will have to be cleared */
+  if (h->shape != NULL && traverseslots(g, h, 1))
+    hasclears = 1;
+  for (p = 0; nodepart(h, p, &n, &limit); p++) {
+    for (; n < limit; n++) {  /* traverse hash part */
+      if (isempty(gval(n)))  /* entry is empty? */
+        clearkey(n);  /* clear its key */
+      else {
+        sil_assert(!keyisnil(n));
+        markkey(g, n);
+        if (!hasclears && iscleared(g, gcvalueN(gval(n))))  /* white value? */
+          hasclears = 1;  /* table will have to be cleared */
+      }
     }
   }
   if (g->gcstate == GCSpropagate)
@@ -509,13 +649,12 @@ static void traverseweakvalue (global_State *g, Table *h) {
 
 
 /*
-** Traverse the array part of a table.
+** Traverse the slice [i, limit) of the array part of a table.
 */
-static int traversearray (global_State *g, Table *h) {
-  unsigned asize = h->asize;
+static int traversearray (global_State *g, Table *h, unsigned i,
+                                                     unsigned limit) {
   int marked = 0;  /* true if some object is marked in this traversal */
-  unsigned i;
-  for (i = 0; i < asize; i++) {
+  for (; i < limit; i++) {
     GCObject *o = gcvalarr(h, i);
     if (o != NULL && iswhite(o)) {
       marked = 1;
@@ -541,23 +680,29 @@ static int traversearray (global_State *g, Table *h) {
 static int traverseephemeron (global_State *g, Table *h, int inv) {
   int hasclears = 0;  /* true if table has white keys */
   int hasww = 0;  /* true if table has entry "white-key -> white-value" */
-  unsigned int i;
-  unsigned int nsize = sizenode(h);
-  int marked = traversearray(g, h);  /* traverse array part */
+  Node *first, *limit;
+  int p;
+  int marked = traversearray(g, h, 0, h->asize);  /* array part */
+  if (h->shape != NULL && traverseslots(g, h, 0))  /* string keys */
+    marked = 1;
   /* traverse hash part; if 'inv', traverse descending
      (see 'convergeephemerons') */
-  for (i = 0; i < nsize; i++) {
-    Node *n = inv ? gnode(h, nsize - 1 - i) : gnode(h, i);
-    if (isempty(gval(n)))  /* entry is empty? */
-      clearkey(n);  /* clear its key */
-    else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
-      hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
-        hasww = 1;  /* white-white entry */
-    }
-    else if (valiswhite(gval(n))) {  /* value not marked yet? */
-      marked = 1;
-      reallymarkobject(g, gcvalue(gval(n)));  /* mark it now */
+  for (p = 0; nodepart(h, p, &first, &limit); p++) {
+    size_t i;
+    size_t nsize = cast_sizet(limit - first);
+    for (i = 0; i < nsize; i++) {
+      Node *n = inv ? first + (nsize - 1 - i) : first + i;
+      if (isempty(gval(n)))  /* entry is empty? */
+        clearkey(n);  /* clear its key */
+      else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
+        hasclears = 1;  /* table must be cleared */
+        if (valiswhite(gval(n)))  /* value not marked yet? */
+          hasww = 1;  /* white-white entry */
+      }
+      else if (valiswhite(gval(n))) {  /* value not marked yet? */
+        marked = 1;
+        reallymarkobject(g, gcvalue(gval(n)));  /* mark it now */
+      }
     }
   }
   /* link table into proper list */
@@ -573,10 +718,8 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
 }
 
 
-static void traversestrongtable (global_State *g, Table *h) {
-  Node *n, *limit = gnodelast(h);
-  traversearray(g, h);
-  for (n = gnode(h, 0); n < limit; n++) {  /* traverse hash part */
+static void traversenodes (global_State *g, Node *n, Node *limit) {
+  for (; n < limit; n++) {
     if (isempty(gval(n)))  /* entry is empty? */
       clearkey(n);  /* clear its key */
     else {
@@ -585,7 +728,64 @@ static void traversestrongtable (global_State *g, Table *h) {
       markvalue(g, gval(n));
     }
   }
+}
+
+
+static void traversestrongtable (global_State *g, Table *h) {
+  Node *n, *limit;
+  int p;
+  traversearray(g, h, 0, h->asize);
+  if (h->shape != NULL)
+    traverseslots(g, h, 0);
+  for (p = 0; nodepart(h, p, &n, &limit); p++)
+    traversenodes(g, n, limit);  /* traverse hash part */
+  genlink(g, obj2gco(h));
+}
+
+
+/*
+** In a young collection, a touched table with cards needs only its
+** regions with marked cards traversed: all other entries point to old
+** objects. Returns the number of entries traversed.
+*/
+static l_mem traversecards (global_State *g, Table *h) {
+  Cards *cs = h->cards;
+  unsigned asize = h->asize;
+  unsigned nsize = allocsizenode(h);
+  l_mem work = 0;
+  unsigned i;
+  if (cs->na == 0) {  /* array part has no cards? */
+    traversearray(g, h, 0, asize);
+    work += asize;
+  }
+  for (i = 0; i < cs->na; i++) {
+    if (cs->c[i] != CARDCLEAN) {
+      unsigned first = i << SILI_CARDBITS;
+      unsigned limit = (asize - first > (1u << SILI_CARDBITS))
+                     ? first + (1u << SILI_CARDBITS) : asize;
+      traversearray(g, h, first, limit);
+      work += limit - first;
+    }
+  }
+  if (h->shape != NULL) {
+    traverseslots(g, h, 0);
+    work += 2 * h->shape->nkeys;
+  }
+  if (cs->nn == 0) {  /* hash part has no cards? */
+    traversenodes(g, gnode(h, 0), gnode(h, nsize));
+    work += 2 * nsize;
+  }
+  for (i = 0; i < cs->nn; i++) {
+    if (cs->c[cs->na + i] != CARDCLEAN) {
+      unsigned first = i << SILI_CARDBITS;
+      unsigned limit = (nsize - first > (1u << SILI_CARDBITS))
+                     ? first + (1u << SILI_CARDBITS) : nsize;
+      traversenodes(g, gnode(h, first), gnode(h, limit));
+      work += 2 * (limit - first);
+    }
+  }
   genlink(g, obj2gco(h));
+  return work;
 }
 
 
@@ -606,9 +806,13 @@ static int getmode (global_State *g, Table *h) {
 
 
 static l_mem traversetable (global_State *g, Table *h) {
+  unsigned oldsize;
   markobjectN(g, h->metatable);
   switch (getmode(g, h)) {
     case 0:  /* not weak */
+      if (g->gckind == KGC_GENMINOR && cardsok(h) &&
+          (getage(h) == G_TOUCHED1 || getage(h) == G_TOUCHED2))
+        return 1 + traversecards(g, h);
       traversestrongtable(g, h);
       break;
     case 1:  /* weak values */
@@ -617,14 +821,18 @@ static l_mem traversetable (global_State *g, Table *h) {
     case 2:  /* weak keys */
       traverseephemeron(g, h, 0);
       break;
-    case 3:  /* all weak; nothing to traverse */
+    case 3:  /* all weak; nothing to traverse (but the shape keys) */
+      if (h->shape != NULL)
+        traverseslots(g, h, 1);
       if (g->gcstate == GCSpropagate)
         linkgclist(h, g->grayagain);  /* must visit again its metatable */
       else
         linkgclist(h, g->allweak);  /* must clear collected entries */
       break;
   }
-  return 1 + 2*sizenode(h) + h->asize;
+  silH_oldnode(h, &oldsize);  /* size of an old part, if any */
+  return 1 + 2*(sizenode(h) + oldsize) + h->asize +
+             ((h->shape != NULL) ? 2u * h->shape->nkeys : 0);
 }
 
 
@@ -740,11 +948,581 @@ static l_mem propagatemark (global_State *g) {
 }
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if SIL_USE_PARALLELGC
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+
+/*
+** 'propagateall' can share its work with a pool of helper threads,
+** created at first use and kept sleeping between collections. That
+** happens only in incremental mode and in the major collections of
+** generational mode (not in minor collections, where 'genlink' and the
+** cards of old tables have work to do), and with heaps of at least
+** SILI_PARMARKMIN bytes, after a first stretch of sequential steps.
+** Each marker, the main thread included, traverses the objects in a
+** private stack. Colors change through
+** atomic operations, so that each object is grayed by exactly one
+** marker, which then owns it. When some marker is out of work, busy
+** markers move half of their stacks to their public queues, from where
+** idle markers steal. Traversals with effects beyond the object itself
+** are not done in parallel: threads, tables that may be weak (their
+** metatables do not have cached the absence of '__mode'), touched
+** objects from generational mode and objects that do not fit in a full
+** stack stay gray and are left to 'propagatemark', so that weak tables
+** and ephemerons are handled exactly as in the sequential collector.
+** Markers never allocate memory and run with all signals blocked.
+** A child process created by 'fork' does not inherit the helpers; it
+** drops the pool it got from its parent and creates its own.
+*/
+
+
+/* size of private stacks */
+#define MARKSTACK	16384
+
+/* size of public queues */
+#define MARKQUEUE	1024
+
+/* number of sequential steps before calling the helpers */
+#define PARSEQSTEPS	1000
+
+
+typedef struct Marker {
+  GCObject **stk;  /* private stack, with objects in 'stk[lo..n)' */
+  unsigned lo, n;
+  GCObject **q;  /* public queue, with objects in 'q[0..qn)' */
+  unsigned qn;  /* (accessed atomically) */
+  pthread_mutex_t qlock;  /* protects the queue */
+  GCObject *deferred;  /* gray objects left to 'propagatemark' */
+  l_mem marked;  /* number of bytes marked by this marker */
+  struct GCPar *par;
+  int id;  /* index in 'par->m' */
+  pthread_t thread;
+} Marker;
+
+
+typedef struct GCPar {
+  size_t size;  /* size of this block */
+  pthread_mutex_t lock;  /* protects the fields below */
+  pthread_cond_t wake;  /* signals a new round (or 'quit') */
+  pthread_cond_t done;  /* signals the end of a round */
+  unsigned round;  /* current round of marking */
+  int running;  /* number of helpers still in current round */
+  int quit;  /* true when helpers must exit */
+  int nhelpers;  /* number of helper threads */
+  int idle;  /* number of markers with no work (accessed atomically) */
+  pid_t pid;  /* process that created the helpers */
+  Marker m[1];  /* 'm[0]' is the main thread */
+} GCPar;
+
+
+#define aload(x)	__atomic_load_n(&(x), __ATOMIC_SEQ_CST)
+#define astore(x,v)	__atomic_store_n(&(x), (v), __ATOMIC_SEQ_CST)
+#define aincr(x)	__atomic_add_fetch(&(x), 1, __ATOMIC_SEQ_CST)
+#define adecr(x)	__atomic_sub_fetch(&(x), 1, __ATOMIC_SEQ_CST)
+
+/* colors are only read and changed with relaxed atomic operations */
+#define aiswhite(o)  \
+	(__atomic_load_n(&(o)->marked, __ATOMIC_RELAXED) & WHITEBITS)
+
+#define pmarkvalue(M,o)  \
+  { if (iscollectable(o) && aiswhite(gcvalue(o))) pmark(M, gcvalue(o)); }
+
+#define pmarkobjectN(M,t)  \
+  { if ((t) != NULL && aiswhite(t)) pmark(M, obj2gco(t)); }
+
+
+/*
+** Try to change the color of object 'o' from white to 'color' (gray or
+** black). Returns false if some marker got there first.
+*/
+static int grab (GCObject *o, int color) {
+  lu_byte old = __atomic_load_n(&o->marked, __ATOMIC_RELAXED);
+  lu_byte newc;
+  do {
+    if (!(old & WHITEBITS))  /* already marked? */
+      return 0;
+    newc = cast_byte((old & ~WHITEBITS) | color);
+  } while (!__atomic_compare_exchange_n(&o->marked, &old, newc, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+
+/* leave gray object 'o' to 'propagatemark' */
+static void defer (Marker *M, GCObject *o) {
+  *getgclist(o) = M->deferred;
+  M->deferred = o;
+}
+
+
+static void pushgray (Marker *M, GCObject *o) {
+  if (M->n == MARKSTACK) {  /* stack is full? */
+    if (M->lo == 0) {  /* no room at all? */
+      defer(M, o);
+      return;
+    }
+    M->n -= M->lo;  /* move objects to the bottom */
+    memmove(M->stk, M->stk + M->lo, M->n * sizeof(GCObject *));
+    M->lo = 0;
+  }
+  M->stk[M->n++] = o;
+}
+
+
+/* parallel version of 'reallymarkobject' */
+static void pmark (Marker *M, GCObject *o) {
+  switch (o->tt) {
+    case SIL_VSHRSTR:
+    case SIL_VLNGSTR: {
+      if (grab(o, bitmask(BLACKBIT)))
+        M->marked += objsize(o);
+      break;
+    }
+    case SIL_VUPVAL: {
+      UpVal *uv = gco2upv(o);
+      if (grab(o, upisopen(uv) ? 0 : bitmask(BLACKBIT))) {
+        M->marked += objsize(o);
+        pmarkvalue(M, uv->v.p);
+      }
+      break;
+    }
+    case SIL_VUSERDATA: {
+      Udata *u = gco2u(o);
+      if (u->nuvalue == 0) {  /* no user values? */
+        if (grab(o, bitmask(BLACKBIT))) {
+          M->marked += objsize(o);
+          pmarkobjectN(M, u->metatable);
+        }
+        break;
+      }
+      /* else... */
+    }  /* FALLTHROUGH */
+    default: {
+      if (grab(o, 0)) {  /* turned it gray? */
+        M->marked += objsize(o);
+        pushgray(M, o);
+      }
+      break;
+    }
+  }
+}
+
+
+/* parallel version of 'traversestrongtable' */
+static void ptraversetable (Marker *M, Table *h) {
+  Node *n, *limit;
+  int p;
+  unsigned i;
+  pmarkobjectN(M, h->metatable);
+  for (i = 0; i < h->asize; i++) {
+    GCObject *o = gcvalarr(h, i);
+    pmarkobjectN(M, o);
+  }
+  if (h->shape != NULL) {
+    Shape *s = h->shape;
+    for (i = 0; i < s->nkeys; i++) {
+      pmarkobjectN(M, s->keys[i]);
+      pmarkvalue(M, &h->slots[i]);
+    }
+  }
+  for (p = 0; nodepart(h, p, &n, &limit); p++) {
+    for (; n < limit; n++) {  /* traverse hash part */
+      if (isempty(gval(n)))  /* entry is empty? */
+        clearkey(n);  /* clear its key */
+      else {
+        if (keyiscollectable(n) && aiswhite(gckey(n)))
+          pmark(M, gckey(n));
+        pmarkvalue(M, gval(n));
+      }
+    }
+  }
+}
+
+
+/*
+** Traverse gray object 'o', owned by marker 'M', or defer it (see
+** above). (The checks on 'o' are safe, as only 'M' can change it.)
+*/
+static void ptraverse (Marker *M, GCObject *o) {
+  if (o->tt == SIL_VTHREAD || getage(o) == G_TOUCHED1 ||
+      getage(o) == G_TOUCHED2 ||
+      (o->tt == SIL_VTABLE && !checknoTM(gco2t(o)->metatable, TM_MODE))) {
+    defer(M, o);
+    return;
+  }
+  __atomic_or_fetch(&o->marked, bitmask(BLACKBIT), __ATOMIC_RELAXED);
+  switch (o->tt) {
+    case SIL_VTABLE: ptraversetable(M, gco2t(o)); break;
+    case SIL_VUSERDATA: {
+      Udata *u = gco2u(o);
+      int i;
+      pmarkobjectN(M, u->metatable);
+      for (i = 0; i < u->nuvalue; i++)
+        pmarkvalue(M, &u->uv[i].uv);
+      break;
+    }
+    case SIL_VLCL: {
+      LClosure *cl = gco2lcl(o);
+      int i;
+      pmarkobjectN(M, cl->p);
+      for (i = 0; i < cl->nupvalues; i++)
+        pmarkobjectN(M, cl->upvals[i]);
+      break;
+    }
+    case SIL_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)
+        pmarkvalue(M, &cl->upvalue[i]);
+      break;
+    }
+    case SIL_VPROTO: {
+      Proto *f = gco2p(o);
+      int i;
+      pmarkobjectN(M, f->source);
+      for (i = 0; i < f->sizek; i++)
+        pmarkvalue(M, &f->k[i]);
+      for (i = 0; i < f->sizeupvalues; i++)
+        pmarkobjectN(M, f->upvalues[i].name);
+      for (i = 0; i < f->sizep; i++)
+        pmarkobjectN(M, f->p[i]);
+      for (i = 0; i < f->sizelocvars; i++)
+        pmarkobjectN(M, f->locvars[i].varname);
+      break;
+    }
+    default: sil_assert(0);
+  }
+}
+
+
+/* get the next gray object of marker 'M', or NULL if it has none */
+static GCObject *popgray (Marker *M) {
+  if (M->n > M->lo)
+    return M->stk[--M->n];
+  M->lo = M->n = 0;
+  if (aload(M->qn) > 0) {  /* take back its own public queue */
+    pthread_mutex_lock(&M->qlock);
+    M->n = M->qn;
+    memcpy(M->stk, M->q, M->n * sizeof(GCObject *));
+    astore(M->qn, 0u);
+    pthread_mutex_unlock(&M->qlock);
+    if (M->n > 0)
+      return M->stk[--M->n];
+  }
+  return NULL;
+}
+
+
+/*
+** If some marker is idle, move the bottom half of the private stack
+** of 'M' to its (empty) public queue. (Only 'M' adds to its queue.)
+*/
+static void share (GCPar *par, Marker *M) {
+  unsigned k = (M->n - M->lo) / 2;
+  if (k > 0 && aload(par->idle) > 0 && aload(M->qn) == 0) {
+    if (k > MARKQUEUE)
+      k = MARKQUEUE;
+    pthread_mutex_lock(&M->qlock);
+    memcpy(M->q, M->stk + M->lo, k * sizeof(GCObject *));
+    astore(M->qn, k);
+    pthread_mutex_unlock(&M->qlock);
+    M->lo += k;
+  }
+}
+
+
+/*
+** Idle marker 'M' tries to steal half of the queue of another marker.
+** It counts itself as busy while stealing, so that the others cannot
+** finish while it holds stolen objects.
+*/
+static int steal (GCPar *par, Marker *M, int nm) {
+  int i;
+  for (i = 1; i < nm; i++) {
+    Marker *v = &par->m[(M->id + i) % nm];
+    if (aload(v->qn) > 0) {
+      unsigned k;
+      adecr(par->idle);
+      pthread_mutex_lock(&v->qlock);
+      k = (v->qn + 1) / 2;
+      memcpy(M->stk, v->q, k * sizeof(GCObject *));
+      memmove(v->q, v->q + k, (v->qn - k) * sizeof(GCObject *));
+      astore(v->qn, v->qn - k);
+      pthread_mutex_unlock(&v->qlock);
+      if (k > 0) {
+        M->lo = 0;
+        M->n = k;
+        return 1;
+      }
+      aincr(par->idle);
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Marking loop of each marker. A round ends when all markers are idle,
+** as only busy markers add objects to the queues.
+*/
+static void drain (GCPar *par, Marker *M) {
+  int nm = par->nhelpers + 1;
+  for (;;) {
+    GCObject *o;
+    while ((o = popgray(M)) != NULL) {
+      ptraverse(M, o);
+      share(par, M);
+    }
+    aincr(par->idle);
+    while (!steal(par, M, nm)) {
+      if (aload(par->idle) == nm)  /* everybody idle? */
+        return;  /* round is over */
+      sched_yield();
+    }
+  }
+}
+
+
+static void *markerthread (void *ud) {
+  Marker *M = cast(Marker *, ud);
+  GCPar *par = M->par;
+  unsigned round = 0;
+  pthread_mutex_lock(&par->lock);
+  for (;;) {
+    while (!par->quit && par->round == round)
+      pthread_cond_wait(&par->wake, &par->lock);
+    if (par->quit)
+      break;
+    round = par->round;
+    pthread_mutex_unlock(&par->lock);
+    drain(par, M);
+    pthread_mutex_lock(&par->lock);
+    if (--par->running == 0)
+      pthread_cond_signal(&par->done);
+  }
+  pthread_mutex_unlock(&par->lock);
+  return NULL;
+}
+
+
+/*
+** Stop the helpers of 'g' and free their pool. A pool inherited
+** through 'fork' has no helpers, and its locks may be in any state;
+** it is only freed.
+*/
+static void freemarkers (global_State *g) {
+  GCPar *par = g->gcpar;
+  if (par->pid == getpid()) {  /* helpers belong to this process? */
+    int i;
+    pthread_mutex_lock(&par->lock);
+    par->quit = 1;
+    pthread_cond_broadcast(&par->wake);
+    pthread_mutex_unlock(&par->lock);
+    for (i = 1; i <= par->nhelpers; i++)
+      pthread_join(par->m[i].thread, NULL);
+    for (i = 0; i <= par->nhelpers; i++)
+      pthread_mutex_destroy(&par->m[i].qlock);
+    pthread_cond_destroy(&par->done);
+    pthread_cond_destroy(&par->wake);
+    pthread_mutex_destroy(&par->lock);
+  }
+  (*g->frealloc)(g->ud, par, par->size, 0);
+  g->gcpar = NULL;
+}
+
+
+/* number of helper threads to be used by 'g' */
+static int nmarkthreads (global_State *g) {
+  if (g->gcmarkthreads < 0) {  /* automatic? */
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpu > SILI_MAXMARKTHREADS)
+      ncpu = SILI_MAXMARKTHREADS + 1;
+    g->gcmarkthreads = (ncpu <= 1) ? 0 : cast_int(ncpu - 1);
+  }
+  return g->gcmarkthreads;
+}
+
+
+/*
+** Create the markers of 'g'. Their memory comes directly from the
+** allocator, as the collector is running; any failure just leaves
+** marking sequential.
+*/
+static GCPar *newmarkers (global_State *g) {
+  int nh = nmarkthreads(g);
+  size_t nm = cast_sizet(nh) + 1;
+  size_t size = offsetof(GCPar, m) + nm * sizeof(Marker) +
+                nm * (MARKSTACK + MARKQUEUE) * sizeof(GCObject *);
+  GCPar *par = cast(GCPar *, (*g->frealloc)(g->ud, NULL, 0, size));
+  GCObject **area;
+  sigset_t all, old;
+  size_t i;
+  if (par == NULL)
+    return NULL;
+  memset(par, 0, offsetof(GCPar, m) + nm * sizeof(Marker));
+  par->size = size;
+  par->pid = getpid();
+  pthread_mutex_init(&par->lock, NULL);
+  pthread_cond_init(&par->wake, NULL);
+  pthread_cond_init(&par->done, NULL);
+  area = cast(GCObject **, cast_charp(par) + offsetof(GCPar, m) +
+                           nm * sizeof(Marker));
+  for (i = 0; i < nm; i++) {
+    Marker *M = &par->m[i];
+    M->stk = area + i * (MARKSTACK + MARKQUEUE);
+    M->q = M->stk + MARKSTACK;
+    M->par = par;
+    M->id = cast_int(i);
+    pthread_mutex_init(&M->qlock, NULL);
+  }
+  g->gcpar = par;
+  sigfillset(&all);  /* helpers must not handle signals */
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (i = 1; i < nm; i++) {
+    if (pthread_create(&par->m[i].thread, NULL, markerthread,
+                       &par->m[i]) != 0)
+      break;  /* keep the helpers that could be created */
+    par->nhelpers++;
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (par->nhelpers == 0) {  /* no helpers? */
+    freemarkers(g);
+    g->gcmarkthreads = 0;  /* do not try again */
+    return NULL;
+  }
+  return par;
+}
+
+
+/*
+** Get the markers of 'g', creating them if needed (also in a child
+** process that inherited the markers of its parent).
+*/
+static GCPar *getmarkers (global_State *g) {
+  if (g->gcpar != NULL && g->gcpar->pid != getpid())  /* after 'fork'? */
+    freemarkers(g);
+  return (g->gcpar != NULL) ? g->gcpar : newmarkers(g);
+}
+
+
+/*
+** Traverse objects from the 'gray' list in parallel, as many as fit
+** (half) the private stacks; the rest stay in 'gray'. Returns the list
+** of deferred objects.
+*/
+static GCObject *parpropagate (global_State *g, GCPar *par) {
+  int nm = par->nhelpers + 1;
+  GCObject *deferred = NULL;
+  int i;
+  for (i = 0; i < nm; i++) {
+    Marker *M = &par->m[i];
+    M->lo = M->n = 0;
+    M->qn = 0;
+    M->deferred = NULL;
+    M->marked = 0;
+  }
+  for (i = 0; g->gray != NULL; i = (i + 1) % nm) {  /* distribute work */
+    Marker *M = &par->m[i];
+    GCObject *o = g->gray;
+    if (M->n == MARKSTACK / 2)
+      break;  /* stacks are half full; leave the rest for the next round */
+    g->gray = *getgclist(o);
+    M->stk[M->n++] = o;
+  }
+  pthread_mutex_lock(&par->lock);
+  par->idle = 0;
+  par->running = par->nhelpers;
+  par->round++;
+  pthread_cond_broadcast(&par->wake);
+  pthread_mutex_unlock(&par->lock);
+  drain(par, &par->m[0]);
+  pthread_mutex_lock(&par->lock);
+  while (par->running > 0)
+    pthread_cond_wait(&par->done, &par->lock);
+  pthread_mutex_unlock(&par->lock);
+  for (i = 0; i < nm; i++) {  /* collect results */
+    Marker *M = &par->m[i];
+    g->GCmarked += M->marked;
+    while (M->deferred != NULL) {
+      GCObject *o = M->deferred;
+      M->deferred = *getgclist(o);
+      *getgclist(o) = deferred;
+      deferred = o;
+    }
+  }
+  return deferred;
+}
+
+
+/*
+** Set the number of helper threads to 'n' (if non negative) and return
+** the previous number.
+*/
+int silC_setmarkthreads (sil_State *L, int n) {
+  global_State *g = G(L);
+  int old = nmarkthreads(g);
+  if (n >= 0) {
+    if (g->gcpar != NULL)
+      freemarkers(g);
+    g->gcmarkthreads = (n < SILI_MAXMARKTHREADS) ? n : SILI_MAXMARKTHREADS;
+  }
+  return old;
+}
+
+
+/*
+** Empties the 'gray' list. After some sequential steps, large heaps
+** go to the helpers, except in minor collections.
+*/
+static void propagateall (global_State *g) {
+  int steps = 0;
+  while (g->gray) {
+    if (steps < PARSEQSTEPS || g->gckind == KGC_GENMINOR ||
+        gettotalbytes(g) < SILI_PARMARKMIN || nmarkthreads(g) == 0 ||
+        getmarkers(g) == NULL) {
+      propagatemark(g);
+      steps++;
+    }
+    else {
+      GCObject *d = parpropagate(g, g->gcpar);
+      while (d != NULL) {  /* traverse deferred objects */
+        GCObject *o = d;
+        d = *getgclist(o);
+        *getgclist(o) = g->gray;  /* put it at the head of 'gray'... */
+        g->gray = o;
+        propagatemark(g);  /* ...and traverse it */
+      }
+    }
+  }
+}
+
+#else
+
+int silC_setmarkthreads (sil_State *L, int n) {
+  UNUSED(L); UNUSED(n);
+  return 0;
+}
+
+
 static void propagateall (global_State *g) {
   while (g->gray)
     propagatemark(g);
 }
 
+#endif
+
+/* }====================================================== */
+
 
 /*
 ** Traverse all ephemeron tables propagating marks from keys to values.
@@ -775,6 +1553,287 @@ static void convergeephemerons (global_State *g) {
 
 /* }====================================================== */
 
+/*
+** {======================================================
+** Background sweeping
+** =======================================================
+*/
+
+#if SIL_USE_BGSWEEP
+
+#include <pthread.h>
+#include <signal.h>
+
+/*
+** With background sweeping, the memory of dead objects is given back
+** to the allocator by a separate thread. While a sweep function runs,
+** the allocator of the state is replaced by 'sweepalloc', which keeps
+** the blocks being freed in batches instead of freeing them; full
+** batches (and the last one of each sweep phase) go to the sweeper
+** thread. Everything else in 'freeobj' (the string table, open
+** upvalues, shapes, external strings, the count of bytes) is still
+** done by the collector, and lists are spliced and objects recolored
+** as before, so sweeping keeps its semantics in both modes. Because
+** the sweeper frees blocks while the program allocates others, the
+** allocator must be thread safe; so, background sweeping is off until
+** turned on by 'silC_setbgsweep'.
+*/
+
+
+/* number of blocks in a batch */
+#define FREEBATCH	4096
+
+/* maximum number of batches in use (when out of batches, blocks are
+   freed by the collector itself) */
+#define MAXBATCHES	16
+
+
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  sil_Alloc f;  /* function to free the blocks */
+  void *ud;
+  unsigned n;  /* number of blocks in 'b' */
+  struct {
+    void *block;
+    size_t size;
+  } b[FREEBATCH];
+} FreeBatch;
+
+
+typedef struct GCSweeper {
+  sil_Alloc f;  /* real allocator of the state (while sweeping) */
+  void *ud;
+  FreeBatch *cur;  /* batch being filled */
+  int nbatches;  /* number of batches allocated */
+  FreeBatch *queue;  /* full batches waiting for the sweeper */
+  FreeBatch **qtail;  /* end of 'queue' */
+  FreeBatch *spare;  /* empty batches */
+  int busy;  /* true while the sweeper is freeing a batch */
+  int quit;  /* true when the sweeper must finish */
+  pthread_mutex_t lock;  /* protects the fields above, from 'queue' on */
+  pthread_cond_t wake;  /* signals a new batch or 'quit' */
+  pthread_cond_t idle;  /* signals an empty queue */
+  pthread_t thread;
+} GCSweeper;
+
+
+static void *sweeperthread (void *ud) {
+  GCSweeper *sw = cast(GCSweeper *, ud);
+  pthread_mutex_lock(&sw->lock);
+  for (;;) {
+    FreeBatch *fb = sw->queue;
+    unsigned i;
+    if (fb == NULL) {
+      if (sw->quit)
+        break;
+      pthread_cond_broadcast(&sw->idle);
+      pthread_cond_wait(&sw->wake, &sw->lock);
+      continue;
+    }
+    if ((sw->queue = fb->next) == NULL)
+      sw->qtail = &sw->queue;
+    sw->busy = 1;
+    pthread_mutex_unlock(&sw->lock);
+    for (i = 0; i < fb->n; i++)
+      (*fb->f)(fb->ud, fb->b[i].block, fb->b[i].size, 0);
+    pthread_mutex_lock(&sw->lock);
+    sw->busy = 0;
+    fb->next = sw->spare;  /* recycle the batch */
+    sw->spare = fb;
+  }
+  pthread_mutex_unlock(&sw->lock);
+  return NULL;
+}
+
+
+/* send the current batch (if not empty) to the sweeper */
+static void sendbatch (GCSweeper *sw) {
+  FreeBatch *fb = sw->cur;
+  if (fb != NULL && fb->n > 0) {
+    fb->f = sw->f;
+    fb->ud = sw->ud;
+    fb->next = NULL;
+    pthread_mutex_lock(&sw->lock);
+    *sw->qtail = fb;
+    sw->qtail = &fb->next;
+    pthread_cond_signal(&sw->wake);
+    pthread_mutex_unlock(&sw->lock);
+    sw->cur = NULL;
+  }
+}
+
+
+/* get an empty batch, either recycled or new; NULL if none is available */
+static FreeBatch *newbatch (GCSweeper *sw) {
+  FreeBatch *fb;
+  pthread_mutex_lock(&sw->lock);
+  if ((fb = sw->spare) != NULL)
+    sw->spare = fb->next;
+  pthread_mutex_unlock(&sw->lock);
+  if (fb == NULL && sw->nbatches < MAXBATCHES) {
+    fb = cast(FreeBatch *, (*sw->f)(sw->ud, NULL, 0, sizeof(FreeBatch)));
+    if (fb != NULL)
+      sw->nbatches++;
+  }
+  if (fb != NULL)
+    fb->n = 0;
+  return fb;
+}
+
+
+/*
+** Allocation function used while sweeping: frees go to the current
+** batch; everything else goes to the real allocator.
+*/
+static void *sweepalloc (void *ud, void *block, size_t osize,
+                                                size_t nsize) {
+  GCSweeper *sw = cast(GCSweeper *, ud);
+  if (nsize == 0 && block != NULL) {
+    if (sw->cur == NULL || sw->cur->n == FREEBATCH) {
+      sendbatch(sw);
+      sw->cur = newbatch(sw);
+    }
+    if (sw->cur != NULL) {
+      FreeBatch *fb = sw->cur;
+      fb->b[fb->n].block = block;
+      fb->b[fb->n].size = osize;
+      fb->n++;
+      return NULL;
+    }
+  }
+  return (*sw->f)(sw->ud, block, osize, nsize);
+}
+
+
+/* install 'sweepalloc' for a sweep */
+static void beginsweep (global_State *g) {
+  GCSweeper *sw = g->gcsweeper;
+  if (sw != NULL) {
+    sw->f = g->frealloc;
+    sw->ud = g->ud;
+    g->frealloc = sweepalloc;
+    g->ud = sw;
+  }
+}
+
+
+/* restore the real allocator after a sweep */
+static void endsweep (global_State *g) {
+  GCSweeper *sw = g->gcsweeper;
+  if (sw != NULL) {
+    g->frealloc = sw->f;
+    g->ud = sw->ud;
+  }
+}
+
+
+/* end of a sweep phase: send the pending frees to the sweeper */
+static void flushsweep (global_State *g) {
+  if (g->gcsweeper != NULL)
+    sendbatch(g->gcsweeper);
+}
+
+
+/* wait until the sweeper has freed all pending blocks */
+static void waitsweep (global_State *g) {
+  GCSweeper *sw = g->gcsweeper;
+  if (sw != NULL) {
+    sendbatch(sw);
+    pthread_mutex_lock(&sw->lock);
+    while (sw->queue != NULL || sw->busy)
+      pthread_cond_wait(&sw->idle, &sw->lock);
+    pthread_mutex_unlock(&sw->lock);
+  }
+}
+
+
+static void freesweeper (global_State *g) {
+  GCSweeper *sw = g->gcsweeper;
+  sil_assert(g->frealloc != sweepalloc);
+  sendbatch(sw);
+  pthread_mutex_lock(&sw->lock);
+  sw->quit = 1;
+  pthread_cond_signal(&sw->wake);
+  pthread_mutex_unlock(&sw->lock);
+  pthread_join(sw->thread, NULL);  /* sweeper frees the whole queue */
+  if (sw->cur != NULL)  /* unused batch? */
+    (*g->frealloc)(g->ud, sw->cur, sizeof(FreeBatch), 0);
+  while (sw->spare != NULL) {
+    FreeBatch *fb = sw->spare;
+    sw->spare = fb->next;
+    (*g->frealloc)(g->ud, fb, sizeof(FreeBatch), 0);
+  }
+  pthread_cond_destroy(&sw->idle);
+  pthread_cond_destroy(&sw->wake);
+  pthread_mutex_destroy(&sw->lock);
+  (*g->frealloc)(g->ud, sw, sizeof(GCSweeper), 0);
+  g->gcsweeper = NULL;
+}
+
+
+/*
+** Create the sweeper of 'g', with memory taken directly from the
+** allocator. Return false if that fails.
+*/
+static int newsweeper (global_State *g) {
+  GCSweeper *sw = cast(GCSweeper *,
+                       (*g->frealloc)(g->ud, NULL, 0, sizeof(GCSweeper)));
+  sigset_t all, old;
+  int res;
+  if (sw == NULL)
+    return 0;
+  memset(sw, 0, sizeof(GCSweeper));
+  sw->qtail = &sw->queue;
+  pthread_mutex_init(&sw->lock, NULL);
+  pthread_cond_init(&sw->wake, NULL);
+  pthread_cond_init(&sw->idle, NULL);
+  sigfillset(&all);  /* sweeper must not handle signals */
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  res = pthread_create(&sw->thread, NULL, sweeperthread, sw);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (res != 0) {
+    pthread_cond_destroy(&sw->idle);
+    pthread_cond_destroy(&sw->wake);
+    pthread_mutex_destroy(&sw->lock);
+    (*g->frealloc)(g->ud, sw, sizeof(GCSweeper), 0);
+    return 0;
+  }
+  g->gcsweeper = sw;
+  return 1;
+}
+
+
+/*
+** Turn background sweeping on ('on' > 0) or off ('on' == 0) and return
+** its previous state. The allocator of the state must be thread safe
+** while it is on.
+*/
+int silC_setbgsweep (sil_State *L, int on) {
+  global_State *g = G(L);
+  int old = (g->gcsweeper != NULL);
+  if (on > 0 && !old)
+    newsweeper(g);
+  else if (on == 0 && old)
+    freesweeper(g);
+  return old;
+}
+
+#else
+
+int silC_setbgsweep (sil_State *L, int on) {
+  UNUSED(L); UNUSED(on);
+  return 0;
+}
+
+#define beginsweep(g)	((void)0)
+#define endsweep(g)	((void)0)
+#define flushsweep(g)	((void)0)
+#define waitsweep(g)	((void)0)
+
+#endif
+
+/* }====================================================== */
+
 
 /*
 ** {======================================================
@@ -789,13 +1848,15 @@ static void convergeephemerons (global_State *g) {
 static void clearbykeys (global_State *g, GCObject *l) {
   for (; l; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *limit = gnodelast(h);
-    Node *n;
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (iscleared(g, gckeyN(n)))  /* unmarked key? */
-        setempty(gval(n));  /* remove entry */
-      if (isempty(gval(n)))  /* is entry empty? */
-        clearkey(n);  /* clear its key */
+    Node *n, *limit;
+    int p;
+    for (p = 0; nodepart(h, p, &n, &limit); p++) {
+      for (; n < limit; n++) {
+        if (iscleared(g, gckeyN(n)))  /* unmarked key? */
+          setempty(gval(n));  /* remove entry */
+        if (isempty(gval(n)))  /* is entry empty? */
+          clearkey(n);  /* clear its key */
+      }
     }
   }
 }
@@ -808,7 +1869,8 @@ static void clearbykeys (global_State *g, GCObject *l) {
 static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
   for (; l != f; l = gco2t(l)->gclist) {
     Table *h = gco2t(l);
-    Node *n, *limit = gnodelast(h);
+    Node *n, *limit;
+    int p;
     unsigned int i;
     unsigned int asize = h->asize;
     for (i = 0; i < asize; i++) {
@@ -816,11 +1878,19 @@ static void clearbyvalues (global_State *g, GCObject *l, GCObject *f) {
       if (iscleared(g, o))  /* value was collected? */
         *getArrTag(h, i) = SIL_VEMPTY;  /* remove entry */
     }
-    for (n = gnode(h, 0); n < limit; n++) {
-      if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
-        setempty(gval(n));  /* remove entry */
-      if (isempty(gval(n)))  /* is entry empty? */
-        clearkey(n);  /* clear its key */
+    if (h->shape != NULL) {
+      for (i = 0; i < h->shape->nkeys; i++) {
+        if (iscleared(g, gcvalueN(&h->slots[i])))  /* unmarked value? */
+          setempty(&h->slots[i]);  /* remove entry */
+      }
+    }
+    for (p = 0; nodepart(h, p, &n, &limit); p++) {
+      for (; n < limit; n++) {
+        if (iscleared(g, gcvalueN(gval(n))))  /* unmarked value? */
+          setempty(gval(n));  /* remove entry */
+        if (isempty(gval(n)))  /* is entry empty? */
+          clearkey(n);  /* clear its key */
+      }
     }
   }
 }
@@ -893,9 +1963,12 @@ static GCObject **sweeplist (sil_State *L, GCObject **p, l_mem countin) {
   global_State *g = G(L);
   int ow = otherwhite(g);
   int white = silC_white(g);  /* current white */
+  l_mem before = gettotalbytes(g);
+  beginsweep(g);
   while (*p != NULL && countin-- > 0) {
     GCObject *curr = *p;
     int marked = curr->marked;
+    g->GCtosweep -= objsize(curr);
     if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
@@ -905,6 +1978,8 @@ static GCObject **sweeplist (sil_State *L, GCObject **p, l_mem countin) {
       p = &curr->next;  /* go to next element */
     }
   }
+  endsweep(g);
+  g->gcstats.bytesswept += cast(sil_Unsigned, before - gettotalbytes(g));
   return (*p == NULL) ? NULL : p;
 }
 
@@ -936,6 +2011,7 @@ static void checkSizes (sil_State *L, global_State *g) {
   if (!g->gcemergency) {
     if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
       silS_resize(L, g->strt.size / 2);
+    silH_sweepshapes(L, 0);  /* free shapes not used anymore */
   }
 }
 
@@ -1092,6 +2168,113 @@ void silC_checkfinalizer (sil_State *L, GCObject *o, Table *mt) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Statistics
+** =======================================================
+*/
+
+/*
+** Monotonic clock, in microseconds. Without POSIX, it falls back to
+** the processor time of the program.
+*/
+#if !defined(sili_clockusec)
+
+#include <time.h>
+
+#if defined(SIL_USE_POSIX)
+
+static sil_Number sili_clockusec (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast_num(ts.tv_sec) * 1e6 + cast_num(ts.tv_nsec) / 1e3;
+}
+
+#else
+
+#define sili_clockusec()	(cast_num(clock()) * 1e6 / CLOCKS_PER_SEC)
+
+#endif
+
+#endif
+
+
+/* add a period of 'd' microseconds to the statistics of phase 'ph' */
+static void addperiod (global_State *g, int ph, sil_Number d) {
+  sil_GCPhaseStats *s = &g->gcstats.phase[ph];
+  int i;
+  if (d < 1)
+    i = 0;
+  else if (d < cast_num(1u << (SIL_GCHISTSIZE - 2)))
+    i = silO_ceillog2(cast_uint(d) + 1);  /* 2^(i-1) <= d < 2^i */
+  else
+    i = SIL_GCHISTSIZE - 1;
+  s->count++;
+  s->total += d;
+  if (d > s->max)
+    s->max = d;
+  s->hist[i]++;
+}
+
+
+/* timed phase of a collector state */
+static int statephase (int state) {
+  switch (state) {
+    case GCSenteratomic: case GCSatomic:
+      return SIL_GCPHATOMIC;
+    case GCSswpallgc: case GCSswpfinobj: case GCSswptobefnz: case GCSswpend:
+      return SIL_GCPHSWEEP;
+    case GCScallfin:
+      return SIL_GCPHFINALIZE;
+    default:  /* GCSpause, GCSpropagate */
+      return SIL_GCPHPROPAGATE;
+  }
+}
+
+
+/*
+** Start timing the phases of incremental steps. Returns the current
+** time.
+*/
+static sil_Number starttiming (global_State *g) {
+  g->gcphstart = sili_clockusec();
+  g->gcphase = statephase(g->gcstate);
+  return g->gcphstart;
+}
+
+
+/*
+** Called before each single step: when the collector has entered a
+** new phase, close the period of the previous one.
+*/
+static void checkphase (global_State *g) {
+  if (g->gcphase >= 0) {  /* timing phases? */
+    int ph = statephase(g->gcstate);
+    if (ph != g->gcphase) {
+      sil_Number now = sili_clockusec();
+      addperiod(g, g->gcphase, now - g->gcphstart);
+      g->gcphase = ph;
+      g->gcphstart = now;
+    }
+  }
+}
+
+
+/*
+** Close the period of the current phase and stop timing. If 'whole'
+** is a phase, it gets the whole period since 'start'.
+*/
+static void stoptiming (global_State *g, int whole, sil_Number start) {
+  sil_Number now = sili_clockusec();
+  addperiod(g, g->gcphase, now - g->gcphstart);
+  if (whole >= 0)
+    addperiod(g, whole, now - start);
+  g->gcphase = -1;
+}
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Generational Collector
@@ -1136,6 +2319,8 @@ static void setpause (global_State *g) {
 static void sweep2old (sil_State *L, GCObject **p) {
   GCObject *curr;
   global_State *g = G(L);
+  l_mem before = gettotalbytes(g);
+  beginsweep(g);
   while ((curr = *p) != NULL) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       sil_assert(isdead(g, curr));
@@ -1144,6 +2329,8 @@ static void sweep2old (sil_State *L, GCObject **p) {
     }
     else {  /* all surviving objects become old */
       setage(curr, G_OLD);
+      if (curr->tt == SIL_VTABLE)
+        clearcards(gco2t(curr));  /* they point only to old objects */
       if (curr->tt == SIL_VTHREAD) {  /* threads must be watched */
         sil_State *th = gco2th(curr);
         linkgclist(th, g->grayagain);  /* insert into 'grayagain' list */
@@ -1155,6 +2342,8 @@ static void sweep2old (sil_State *L, GCObject **p) {
       p = &curr->next;  /* go to next element */
     }
   }
+  endsweep(g);
+  g->gcstats.bytesswept += cast(sil_Unsigned, before - gettotalbytes(g));
 }
 
 
@@ -1182,8 +2371,11 @@ static GCObject **sweepgen (sil_State *L, global_State *g, GCObject **p,
     G_TOUCHED2   /* from G_TOUCHED2 (do not change) */
   };
   l_mem addedold = 0;
+  l_mem before = gettotalbytes(g);
+  sil_Unsigned promoted = 0;
   int white = silC_white(g);
   GCObject *curr;
+  beginsweep(g);
   while ((curr = *p) != limit) {
     if (iswhite(curr)) {  /* is 'curr' dead? */
       sil_assert(!isold(curr) && isdead(g, curr));
@@ -1200,6 +2392,7 @@ static GCObject **sweepgen (sil_State *L, global_State *g, GCObject **p,
         sil_assert(age != G_OLD1);  /* advanced in 'markold' */
         setage(curr, nextage[age]);
         if (getage(curr) == G_OLD1) {
+          promoted++;
           addedold += objsize(curr);  /* bytes becoming old */
           if (*pfirstold1 == NULL)
             *pfirstold1 = curr;  /* first OLD1 object in the list */
@@ -1208,6 +2401,10 @@ static GCObject **sweepgen (sil_State *L, global_State *g, GCObject **p,
       p = &curr->next;  /* go to next element */
     }
   }
+  endsweep(g);
+  g->gcstats.bytesswept += cast(sil_Unsigned, before - gettotalbytes(g));
+  g->gcstats.promoted += promoted;
+  g->gcstats.promotedbytes += cast(sil_Unsigned, addedold);
   *paddedold += addedold;
   return p;
 }
@@ -1234,6 +2431,8 @@ static GCObject **correctgraylist (GCObject **p) {
       sil_assert(isgray(curr));
       nw2black(curr);  /* make it black, for next barrier */
       setage(curr, G_TOUCHED2);
+      if (curr->tt == SIL_VTABLE)
+        agecards(gco2t(curr));
       goto remain;  /* keep it in the list and go to next element */
     }
     else if (curr->tt == SIL_VTHREAD) {
@@ -1242,8 +2441,11 @@ static GCObject **correctgraylist (GCObject **p) {
     }
     else {  /* everything else is removed */
       sil_assert(isold(curr));  /* young objects should be white here */
-      if (getage(curr) == G_TOUCHED2)  /* advance from TOUCHED2... */
+      if (getage(curr) == G_TOUCHED2) {  /* advance from TOUCHED2... */
         setage(curr, G_OLD);  /* ... to OLD */
+        if (curr->tt == SIL_VTABLE)
+          clearcards(gco2t(curr));
+      }
       nw2black(curr);  /* make object black (to be removed) */
       goto remove;
     }
@@ -1290,6 +2492,7 @@ static void markold (global_State *g, GCObject *from, GCObject *to) {
 ** Finish a young-generation collection.
 */
 static void finishgencycle (sil_State *L, global_State *g) {
+  flushsweep(g);
   correctgraylists(g);
   checkSizes(L, g);
   g->gcstate = GCSpropagate;  /* skip restart */
@@ -1337,6 +2540,7 @@ static void youngcollection (sil_State *L, global_State *g) {
   l_mem marked = g->GCmarked;  /* preserve 'g->GCmarked' */
   GCObject **psurvival;  /* to point to first non-dead survival object */
   GCObject *dummy;  /* dummy out parameter to 'sweepgen' */
+  sil_Number start = sili_clockusec();
   sil_assert(g->gcstate == GCSpropagate);
   if (g->firstold1) {  /* are there regular OLD1 objects? */
     markold(g, g->firstold1, g->reallyold);  /* mark them */
@@ -1346,6 +2550,7 @@ static void youngcollection (sil_State *L, global_State *g) {
   markold(g, g->tobefnz, NULL);
 
   atomic(L);  /* will lose 'g->marked' */
+  g->gcstats.bytesmarked += cast(sil_Unsigned, g->GCmarked - marked);
 
   /* sweep nursery and get a pointer to its last live element */
   g->gcstate = GCSswpallgc;
@@ -1374,9 +2579,11 @@ static void youngcollection (sil_State *L, global_State *g) {
   if (checkminormajor(g)) {
     minor2inc(L, g, KGC_GENMAJOR);  /* go to major mode */
     g->GCmarked = 0;  /* avoid pause in first major cycle (see 'setpause') */
+    g->gcstats.minor2major++;
   }
   else
     finishgencycle(L, g);  /* still in minor mode; finish it */
+  addperiod(g, SIL_GCPHYOUNG, sili_clockusec() - start);
 }
 
 
@@ -1429,6 +2636,7 @@ static void entergen (sil_State *L, global_State *g) {
   silC_runtilstate(L, GCSpause, 1);  /* prepare to start a new cycle */
   silC_runtilstate(L, GCSpropagate, 1);  /* start new cycle */
   atomic(L);  /* propagates all and then do the atomic stuff */
+  g->gcstats.bytesmarked += cast(sil_Unsigned, g->GCmarked);
   atomic2gen(L, g);
   setminordebt(g);  /* set debt assuming next cycle will be minor */
 }
@@ -1475,6 +2683,7 @@ static int checkmajorminor (sil_State *L, global_State *g) {
     l_mem limit = applygcparam(g, MAJORMINOR, addedbytes);
     l_mem tobecollected = numbytes - g->GCmarked;
     if (tobecollected > limit) {
+      g->gcstats.major2minor++;
       atomic2gen(L, g);  /* return to generational mode */
       setminordebt(g);
       return 1;  /* exit incremental collection */
@@ -1505,6 +2714,7 @@ static void entersweep (sil_State *L) {
   global_State *g = G(L);
   g->gcstate = GCSswpallgc;
   sil_assert(g->sweepgc == NULL);
+  g->GCtosweep = gettotalbytes(g);
   g->sweepgc = sweeptolive(L, &g->allgc);
 }
 
@@ -1618,6 +2828,7 @@ static l_mem singlestep (sil_State *L, int fast) {
   global_State *g = G(L);
   l_mem stepresult;
   sil_assert(!g->gcstopem);  /* collector is not reentrant */
+  checkphase(g);
   g->gcstopem = 1;  /* no emergency collections while collecting */
   switch (g->gcstate) {
     case GCSpause: {
@@ -1637,6 +2848,7 @@ static l_mem singlestep (sil_State *L, int fast) {
     }
     case GCSenteratomic: {
       atomic(L);
+      g->gcstats.bytesmarked += cast(sil_Unsigned, g->GCmarked);
       if (checkmajorminor(L, g))
         stepresult = step2minor;
       else {
@@ -1661,6 +2873,7 @@ static l_mem singlestep (sil_State *L, int fast) {
       break;
     }
     case GCSswpend: {  /* finish sweeps */
+      flushsweep(g);
       checkSizes(L, g);
       g->gcstate = GCScallfin;
       stepresult = GCSWEEPMAX;
@@ -1674,6 +2887,7 @@ static l_mem singlestep (sil_State *L, int fast) {
       }
       else {  /* emergency mode or no more finalizers */
         g->gcstate = GCSpause;  /* finish collection */
+        g->gcstats.cycles++;
         stepresult = step2pause;
       }
       break;
@@ -1727,6 +2941,89 @@ static void incstep (sil_State *L, global_State *g) {
 }
 
 
+/*
+** {======================================================
+** Time-budgeted steps
+** =======================================================
+*/
+
+/*
+** Units of work between checks of the clock. (Traversing a large
+** object or the atomic step may take longer; then the clock is checked
+** right after it.)
+*/
+#define GCTIMECHECK	(8 * GCSWEEPMAX)
+
+
+/*
+** Estimate of the work, in bytes, still to be done in the current
+** cycle: bytes not yet marked (if still marking) plus bytes not yet
+** swept. Returns zero in the pause state.
+*/
+static l_mem worktodo (global_State *g) {
+  if (g->gcstate == GCSpause)
+    return 0;
+  else if (keepinvariant(g)) {  /* still marking? */
+    l_mem total = gettotalbytes(g);
+    l_mem tomark = total - g->GCmarked;
+    return ((tomark > 0) ? tomark : 0) + total;
+  }
+  else
+    return (g->GCtosweep > 0) ? g->GCtosweep : 0;
+}
+
+
+/*
+** Runs incremental steps for at most 'usec' microseconds, stopping
+** earlier at the end of the cycle. In minor mode, does one young
+** collection, which cannot be divided. Returns the estimated work
+** still to be done in the cycle, in Kbytes (rounded up), so that zero
+** means the cycle has finished.
+*/
+int silC_steptime (sil_State *L, int usec) {
+  global_State *g = G(L);
+  sil_Number start, deadline;
+  l_mem work = 0;  /* work done since last check of the clock */
+  l_mem left;
+  if (g->gckind == KGC_GENMINOR) {
+    youngcollection(L, g);
+    setminordebt(g);
+    return 0;
+  }
+  start = starttiming(g);
+  deadline = start + usec;
+  for (;;) {
+    l_mem stres = singlestep(L, 0);
+    if (stres == step2minor) {  /* returned to minor collections? */
+      stoptiming(g, SIL_GCPHSTEP, start);
+      return 0;
+    }
+    else if (stres == step2pause)  /* end of cycle? */
+      break;
+    else if (stres == atomicstep)
+      work = GCTIMECHECK;  /* check the clock right now */
+    else
+      work += stres;
+    if (work >= GCTIMECHECK) {
+      if (sili_clockusec() >= deadline)
+        break;
+      work = 0;
+    }
+  }
+  stoptiming(g, SIL_GCPHSTEP, start);
+  if (g->gcstate == GCSpause)
+    setpause(g);  /* pause until next cycle */
+  else
+    silE_setdebt(g, applygcparam(g, STEPSIZE, 100));
+  left = (worktodo(g) + 1023) >> 10;
+  if (left == 0 && g->gcstate != GCSpause)
+    left = 1;  /* only finalizers left */
+  return (left < INT_MAX) ? cast_int(left) : INT_MAX;
+}
+
+/* }====================================================== */
+
+
 #if !defined(sili_tracegc)
 #define sili_tracegc(L,f)		((void)0)
 #endif
@@ -1746,9 +3043,12 @@ void silC_step (sil_State *L) {
   else {
     sili_tracegc(L, 1);  /* for internal debugging */
     switch (g->gckind) {
-      case KGC_INC: case KGC_GENMAJOR:
+      case KGC_INC: case KGC_GENMAJOR: {
+        sil_Number start = starttiming(g);
         incstep(L, g);
+        stoptiming(g, SIL_GCPHSTEP, start);
         break;
+      }
       case KGC_GENMINOR:
         youngcollection(L, g);
         setminordebt(g);
@@ -1784,17 +3084,27 @@ static void fullinc (sil_State *L, global_State *g) {
 */
 void silC_fullgc (sil_State *L, int isemergency) {
   global_State *g = G(L);
+  int timing = (g->gcphase < 0);  /* not inside a timed step? */
+  sil_Number start = 0;
   sil_assert(!g->gcemergency);
   g->gcemergency = cast_byte(isemergency);  /* set flag */
-  switch (g->gckind) {
-    case KGC_GENMINOR: fullgen(L, g); break;
-    case KGC_INC: fullinc(L, g); break;
-    case KGC_GENMAJOR:
-      g->gckind = KGC_INC;
-      fullinc(L, g);
-      g->gckind = KGC_GENMAJOR;
-      break;
+  if (g->gckind == KGC_GENMINOR) {
+    start = sili_clockusec();
+    fullgen(L, g);
+    addperiod(g, SIL_GCPHFULLGEN, sili_clockusec() - start);
+  }
+  else {
+    lu_byte kind = g->gckind;
+    if (timing)
+      starttiming(g);
+    g->gckind = KGC_INC;
+    fullinc(L, g);
+    g->gckind = kind;
+    if (timing)
+      stoptiming(g, -1, start);
   }
+  if (isemergency)
+    waitsweep(g);  /* memory must be really free for a new try */
   g->gcemergency = 0;
 }
 
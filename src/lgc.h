@@ -204,6 +204,28 @@
 #define setgcparam(g,p,v)  (g->gcparams[SIL_GCP##p] = silO_codeparam(v))
 #define applygcparam(g,p,x)  silO_applyparam(g->gcparams[SIL_GCP##p], x)
 
+
+/* parallel marking (POSIX threads and gcc/clang atomics only) */
+
+#if !defined(SIL_USE_PARALLELGC)
+#define SIL_USE_PARALLELGC	0
+#endif
+
+/* maximum number of helper threads for marking */
+#define SILI_MAXMARKTHREADS	63
+
+/* minimum heap size (in bytes) for marking in parallel */
+#if !defined(SILI_PARMARKMIN)
+#define SILI_PARMARKMIN		(8 << 20)
+#endif
+
+
+/* background sweeping (POSIX threads only) */
+
+#if !defined(SIL_USE_BGSWEEP)
+#define SIL_USE_BGSWEEP		0
+#endif
+
 /* }====================================================== */
 
 
@@ -251,9 +273,28 @@
 #define silC_barrierback(L,p,v) (  \
 	iscollectable(v) ? silC_objbarrierback(L, p, gcvalue(v)) : cast_void(0))
 
+/*
+** Back barriers for a store of value 'v' into table 't' at key 'k' (or
+** at integer key 'i'), which can mark only the card of that entry.
+** ('k'/'i' are evaluated only when the barrier is needed.)
+*/
+#define silC_barriertable(L,t,k,v) (  \
+	(iscollectable(v) && isblack(t) && iswhite(gcvalue(v))) ? \
+	silC_barriertable_(L,t,k) : cast_void(0))
+
+#define silC_barriertablei(L,t,i,v) (  \
+	(iscollectable(v) && isblack(t) && iswhite(gcvalue(v))) ? \
+	silC_barriertablei_(L,t,i) : cast_void(0))
+
+/* ditto, after 'silH_finishset' with the result 'hres' of a 'pset' */
+#define silC_barrierset(L,t,hres,k,v) (  \
+	(iscollectable(v) && isblack(t) && iswhite(gcvalue(v))) ? \
+	silC_barrierset_(L,t,hres,k) : cast_void(0))
+
 SILI_FUNC void silC_fix (sil_State *L, GCObject *o);
 SILI_FUNC void silC_freeallobjects (sil_State *L);
 SILI_FUNC void silC_step (sil_State *L);
+SILI_FUNC int silC_steptime (sil_State *L, int usec);
 SILI_FUNC void silC_runtilstate (sil_State *L, int state, int fast);
 SILI_FUNC void silC_fullgc (sil_State *L, int isemergency);
 SILI_FUNC GCObject *silC_newobj (sil_State *L, lu_byte tt, size_t sz);
@@ -261,8 +302,15 @@ SILI_FUNC GCObject *silC_newobjdt (sil_State *L, lu_byte tt, size_t sz,
                                                  size_t offset);
 SILI_FUNC void silC_barrier_ (sil_State *L, GCObject *o, GCObject *v);
 SILI_FUNC void silC_barrierback_ (sil_State *L, GCObject *o);
+SILI_FUNC void silC_barriertable_ (sil_State *L, Table *t,
+                                                const TValue *key);
+SILI_FUNC void silC_barriertablei_ (sil_State *L, Table *t, sil_Integer key);
+SILI_FUNC void silC_barrierset_ (sil_State *L, Table *t, int hres,
+                                              const TValue *key);
 SILI_FUNC void silC_checkfinalizer (sil_State *L, GCObject *o, Table *mt);
 SILI_FUNC void silC_changemode (sil_State *L, int newmode);
+SILI_FUNC int silC_setmarkthreads (sil_State *L, int n);
+SILI_FUNC int silC_setbgsweep (sil_State *L, int on);
 
 
 #endif
@@ -36,6 +36,10 @@ static const silL_Reg stdlibs[] = {
   {SIL_STRLIBNAME, silopen_string},
   {SIL_TABLIBNAME, silopen_table},
   {SIL_UTF8LIBNAME, silopen_utf8},
+  {SIL_PROFLIBNAME, silopen_profiler},
+  {SIL_ARRLIBNAME, silopen_array},
+  {SIL_VECLIBNAME, silopen_vec},
+  {SIL_BUFLIBNAME, silopen_buffer},
   {NULL, NULL}
 };
 
@@ -57,7 +61,7 @@ SILLIB_API void silL_openselectedlibs (sil_State *L, int load, int preload) {
       sil_setfield(L, -2, lib->name);  /* add library to PRELOAD table */
     }
   }
-  sil_assert((mask >> 1) == SIL_UTF8LIBK);
+  sil_assert((mask >> 1) == SIL_BUFLIBK);
   sil_pop(L, 1);  /* remove PRELOAD table */
 }
 
@@ -0,0 +1,1034 @@
+/*
+** $Id: ljit.c $
+** Baseline native compiler for hot functions
+** See Copyright Notice in sil.h
+*/
+
+#define ljit_c
+#define SIL_CORE
+
+/* 'MAP_ANONYMOUS' is not part of POSIX */
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "sil.h"
+
+#include "ldebug.h"
+#include "lgc.h"
+#include "ljit.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lstate.h"
+#include "ltable.h"
+
+
+/*
+** The compiler translates each instruction of a prototype into a
+** fixed template of machine code. Templates only implement the fast
+** paths of their instructions, guarded by type checks; whenever a
+** guard fails, or the instruction has no template at all, the native
+** code leaves through an "exit stub" that returns the index of that
+** instruction, and the interpreter resumes there and runs it again
+** from scratch (guards are always checked before any side effect).
+** So, native code never calls the runtime, never allocates, and never
+** raises errors: metamethods, calls, errors and hooks are all left to
+** the interpreter and its slow paths ('silV_finishget',
+** 'silT_trybinTM', 'silD_precall', etc.).
+**
+** The interpreter enters native code only at the start of a loop
+** whose whole body has templates (see 'canjit'), and only when it is
+** not tracing; back edges in native code check 'ci->u.l.trap', so a
+** hook set by a signal stops the loop as it does in the interpreter.
+**
+** Register usage in native code: rbx holds 'base', r12 the closure
+** and r13 the CallInfo; rax, rcx, rdx, rsi, xmm0 and xmm1 are
+** scratch.
+*/
+
+
+#if SIL_USE_JIT
+
+#include <sys/mman.h>
+
+
+/* native code entry: returns index of the instruction to resume at */
+typedef int (*JitFunction) (StkId base, CallInfo *ci, LClosure *cl,
+                            const char *entry);
+
+
+/* x86-64 registers */
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13 };
+#define XMM0	0
+#define XMM1	1
+
+
+/* condition codes (low nibble of 'jcc'/'setcc' opcodes) */
+#define CC_B	0x2
+#define CC_AE	0x3
+#define CC_E	0x4
+#define CC_NE	0x5
+#define CC_BE	0x6
+#define CC_A	0x7
+#define CC_NS	0x9
+#define CC_L	0xC
+#define CC_GE	0xD
+#define CC_LE	0xE
+#define CC_G	0xF
+#define CC_ALWAYS	0x10  /* pseudo conditions */
+#define CC_NEVER	0x11
+
+#define negcc(cc)	((cc) ^ 1)  /* also swaps CC_ALWAYS and CC_NEVER */
+
+
+/* size of an exit stub ('mov eax, imm32; jmp rel32') */
+#define STUBSIZE	10
+
+
+/* offsets of the value and of the tag of register 'r' from 'base' */
+#define RV(r)	(cast_int(r) * cast_int(sizeof(StackValue)))
+#define RT(r)	(RV(r) + cast_int(offsetof(TValue, tt_)))
+
+#define TOFF(f)	cast_int(offsetof(Table, f))
+
+
+typedef struct JitState {
+  const Proto *p;
+  lu_byte *buff;  /* output buffer (NULL while sizing the code) */
+  size_t pos;  /* current position in the output */
+  unsigned int *label;  /* position of the code for each instruction */
+  size_t epilogue;  /* position of the common function epilogue */
+  size_t stubs;  /* position of the exit stubs */
+} JitState;
+
+
+/*
+** {======================================================
+** Machine-code emission
+** =======================================================
+*/
+
+static void emit1 (JitState *J, int b) {
+  if (J->buff != NULL)
+    J->buff[J->pos] = cast_byte(b);
+  J->pos++;
+}
+
+
+static void emit4 (JitState *J, l_uint32 v) {
+  int i;
+  for (i = 0; i < 4; i++, v >>= 8)
+    emit1(J, cast_int(v & 0xFF));
+}
+
+
+static void emit8 (JitState *J, sil_Unsigned v) {
+  int i;
+  for (i = 0; i < 8; i++, v >>= 8)
+    emit1(J, cast_int(v & 0xFF));
+}
+
+
+/* emit a 32-bit displacement from the end of the field to 'target' */
+static void emitrel (JitState *J, size_t target) {
+  emit4(J, cast(l_uint32, target - (J->pos + 4)));
+}
+
+
+/*
+** Emit prefix, REX and (one- or two-byte) opcode of an instruction.
+** Opcodes greater than 0xFF are two-byte '0F xx' opcodes.
+*/
+static void emitopcode (JitState *J, int pfx, int w, int op, int reg,
+                        int rm) {
+  int rex = 0x40 | (w << 3) | ((reg & 8) >> 1) | ((rm & 8) >> 3);
+  if (pfx != 0)
+    emit1(J, pfx);
+  if (rex != 0x40)
+    emit1(J, rex);
+  if (op > 0xFF)
+    emit1(J, op >> 8);
+  emit1(J, op & 0xFF);
+}
+
+
+/* 'op reg, [base + disp]' */
+static void emitmem (JitState *J, int pfx, int w, int op, int reg,
+                     int base, int disp) {
+  emitopcode(J, pfx, w, op, reg, base);
+  emit1(J, 0x80 | ((reg & 7) << 3) | (base & 7));  /* mod=10: disp32 */
+  if ((base & 7) == RSP)  /* rsp and r12 need a SIB byte */
+    emit1(J, 0x24);
+  emit4(J, cast(l_uint32, disp));
+}
+
+
+/* 'op reg, [base + index * 2^scale + disp]' (only low registers) */
+static void emitsib (JitState *J, int w, int op, int reg, int base,
+                     int index, int scale, int disp) {
+  emitopcode(J, 0, w, op, reg, 0);
+  emit1(J, 0x84 | (reg << 3));  /* mod=10, rm=100 (SIB follows) */
+  emit1(J, (scale << 6) | (index << 3) | base);
+  emit4(J, cast(l_uint32, disp));
+}
+
+
+/* 'op reg, rm' with both operands in registers */
+static void emitreg (JitState *J, int pfx, int w, int op, int reg, int rm) {
+  emitopcode(J, pfx, w, op, reg, rm);
+  emit1(J, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+
+/* 'mov reg, imm64' */
+static void movimm (JitState *J, int reg, sil_Unsigned v) {
+  emit1(J, 0x48);
+  emit1(J, 0xB8 + reg);
+  emit8(J, v);
+}
+
+
+static void jmp (JitState *J, size_t target) {
+  emit1(J, 0xE9);
+  emitrel(J, target);
+}
+
+
+static void jcc (JitState *J, int cc, size_t target) {
+  sil_assert(cc < CC_ALWAYS);
+  emit1(J, 0x0F);
+  emit1(J, 0x80 | cc);
+  emitrel(J, target);
+}
+
+
+/*
+** Emit a jump to a position not yet known and return the position of
+** its displacement, to be fixed later by 'patch'.
+*/
+static size_t jccfwd (JitState *J, int cc) {
+  size_t pos;
+  if (cc == CC_ALWAYS)
+    emit1(J, 0xE9);
+  else {
+    emit1(J, 0x0F);
+    emit1(J, 0x80 | cc);
+  }
+  pos = J->pos;
+  emit4(J, 0);
+  return pos;
+}
+
+
+/* make the jump with displacement at 'pos' go to current position */
+static void patch (JitState *J, size_t pos) {
+  if (J->buff != NULL) {
+    l_uint32 rel = cast(l_uint32, J->pos - (pos + 4));
+    int i;
+    for (i = 0; i < 4; i++, rel >>= 8)
+      J->buff[pos + cast_sizet(i)] = cast_byte(rel & 0xFF);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Templates
+** =======================================================
+*/
+
+#define label(J,pc)	cast_sizet((J)->label[pc])
+#define stub(J,pc)	((J)->stubs + cast_sizet(pc) * STUBSIZE)
+
+
+/* jump to exit stub for instruction 'pc' unless tag of R[r] is 'tag' */
+static void guardtag (JitState *J, int r, int tag, int pc) {
+  emitmem(J, 0, 0, 0x80, 7, RBX, RT(r));  /* cmp byte [tag], imm8 */
+  emit1(J, tag);
+  jcc(J, CC_NE, stub(J, pc));
+}
+
+
+/* compare tag of R[r] with 'tag' and jump forward if different */
+static size_t testtag (JitState *J, int r, int tag) {
+  emitmem(J, 0, 0, 0x80, 7, RBX, RT(r));
+  emit1(J, tag);
+  return jccfwd(J, CC_NE);
+}
+
+
+static void settag (JitState *J, int r, int tag) {
+  emitmem(J, 0, 0, 0xC6, 0, RBX, RT(r));  /* mov byte [tag], imm8 */
+  emit1(J, tag);
+}
+
+
+/*
+** Jump from instruction 'pc' to instruction 'target'. Back edges
+** first check 'trap', so that signals can stop native loops.
+*/
+static void jumpto (JitState *J, int pc, int target) {
+  if (target <= pc) {
+    emitmem(J, 0, 0, 0x83, 7, R13, cast_int(offsetof(CallInfo, u.l.trap)));
+    emit1(J, 0);  /* cmp dword [ci->u.l.trap], 0 */
+    jcc(J, CC_NE, stub(J, target));
+  }
+  jmp(J, label(J, target));
+}
+
+
+/*
+** Finish a test instruction at 'pc', whose outcome is in the flags as
+** condition 'cc': when that outcome equals its 'k' bit, do the jump
+** in the next instruction, otherwise skip that jump.
+*/
+static void condjump (JitState *J, int pc, int cc) {
+  Instruction i = J->p->code[pc];
+  int target = pc + 2 + GETARG_sJ(J->p->code[pc + 1]);
+  if (!GETARG_k(i))
+    cc = negcc(cc);
+  if (cc == CC_ALWAYS)
+    jumpto(J, pc, target);
+  else if (cc != CC_NEVER) {
+    if (target > pc)
+      jcc(J, cc, label(J, target));
+    else {
+      size_t skip = jccfwd(J, negcc(cc));
+      jumpto(J, pc, target);
+      patch(J, skip);
+    }
+  }
+  jmp(J, label(J, pc + 2));
+}
+
+
+/* load number in R[r] as a float into 'xmm' (exit if not a number) */
+static void loadnum (JitState *J, int xmm, int r, int pc) {
+  size_t notflt = testtag(J, r, SIL_VNUMFLT);
+  size_t done;
+  emitmem(J, 0xF2, 0, 0x0F10, xmm, RBX, RV(r));  /* movsd */
+  done = jccfwd(J, CC_ALWAYS);
+  patch(J, notflt);
+  guardtag(J, r, SIL_VNUMINT, pc);
+  emitmem(J, 0xF2, 1, 0x0F2A, xmm, RBX, RV(r));  /* cvtsi2sd */
+  patch(J, done);
+}
+
+
+/* load float constant 'n' into 'xmm' */
+static void loadfltk (JitState *J, int xmm, sil_Number n) {
+  sil_Unsigned bits;
+  memcpy(&bits, &n, sizeof(bits));
+  movimm(J, RAX, bits);
+  emitreg(J, 0x66, 1, 0x0F6E, xmm, RAX);  /* movq xmm, rax */
+}
+
+
+/* cl := R[r] is neither false nor nil */
+static void truthy (JitState *J, int r) {
+  emitmem(J, 0, 0, 0x8A, RAX, RBX, RT(r));  /* mov al, tag */
+  emit1(J, 0x3C); emit1(J, SIL_VFALSE);  /* cmp al, false */
+  emitreg(J, 0, 0, 0x0F95, 0, RCX);  /* setne cl */
+  emit1(J, 0xA8); emit1(J, 0x0F);  /* test al, 0x0F (not a nil variant) */
+  emitreg(J, 0, 0, 0x0F95, 0, RDX);  /* setne dl */
+  emitreg(J, 0, 0, 0x20, RDX, RCX);  /* and cl, dl */
+}
+
+
+/* flags := R[a] == xmm0 as floats, where xmm1 holds R[a] */
+static void floateq (JitState *J) {
+  emitreg(J, 0x66, 0, 0x0F2E, XMM1, XMM0);  /* ucomisd */
+  emitreg(J, 0, 0, 0x0F94, 0, RAX);  /* sete al */
+  emitreg(J, 0, 0, 0x0F9B, 0, RCX);  /* setnp cl */
+  emitreg(J, 0, 0, 0x20, RCX, RAX);  /* and al, cl */
+}
+
+
+static void move (JitState *J, int a, int b) {
+  emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(b));
+  emitmem(J, 0, 0, 0x8A, RCX, RBX, RT(b));
+  emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+  emitmem(J, 0, 0, 0x88, RCX, RBX, RT(a));
+}
+
+
+static void loadk (JitState *J, int a, const TValue *k) {
+  sil_Unsigned bits;
+  memcpy(&bits, &k->value_, sizeof(bits));
+  movimm(J, RAX, bits);
+  emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+  settag(J, a, rawtt(k));
+}
+
+
+static void getupval (JitState *J, int a, int b) {
+  emitmem(J, 0, 1, 0x8B, RAX, R12,
+          cast_int(offsetof(LClosure, upvals)) + b * cast_int(sizeof(UpVal*)));
+  emitmem(J, 0, 1, 0x8B, RAX, RAX, cast_int(offsetof(UpVal, v)));
+  emitmem(J, 0, 1, 0x8B, RCX, RAX, cast_int(offsetof(TValue, value_)));
+  emitmem(J, 0, 0, 0x8A, RDX, RAX, cast_int(offsetof(TValue, tt_)));
+  emitmem(J, 0, 1, 0x89, RCX, RBX, RV(a));
+  emitmem(J, 0, 0, 0x88, RDX, RBX, RT(a));
+}
+
+
+/*
+** Table accesses only handle the array part. On return from 'arrayidx'
+** rax has the table, rdx its array and rcx the 0-based index of the
+** key, already checked against the size of the array. The key is
+** either R[key] or, when 'r' is false, the constant 'key'.
+*/
+static void arrayidx (JitState *J, int t, int key, int r, int pc) {
+  guardtag(J, t, ctb(SIL_VTABLE), pc);
+  emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(t));
+  if (r) {
+    guardtag(J, key, SIL_VNUMINT, pc);
+    emitmem(J, 0, 1, 0x8B, RCX, RBX, RV(key));
+    emitreg(J, 0, 1, 0xFF, 1, RCX);  /* dec rcx */
+  }
+  else
+    movimm(J, RCX, cast(sil_Unsigned, key - 1));
+  emitmem(J, 0, 0, 0x8B, RDX, RAX, TOFF(asize));  /* zero-extended */
+  emitreg(J, 0, 1, 0x3B, RCX, RDX);  /* cmp rcx, rdx */
+  jcc(J, CC_AE, stub(J, pc));  /* unsigned: also catches keys < 1 */
+  emitmem(J, 0, 1, 0x8B, RDX, RAX, TOFF(array));
+}
+
+
+/* offset of the tags in the array part (see 'getArrTag') */
+#define ARRTAG	cast_int(sizeof(unsigned))
+
+
+static void gettable (JitState *J, int a, int t, int key, int r, int pc) {
+  arrayidx(J, t, key, r, pc);
+  emitsib(J, 0, 0x8A, RAX, RDX, RCX, 0, ARRTAG);  /* mov al, tag */
+  emit1(J, 0xA8); emit1(J, 0x0F);  /* test al, 0x0F (empty?) */
+  jcc(J, CC_E, stub(J, pc));  /* absent key: let interpreter do it */
+  emitreg(J, 0, 1, 0xF7, 3, RCX);  /* neg rcx (see 'getArrVal') */
+  emitsib(J, 1, 0x8B, RCX, RDX, RCX, 3, -cast_int(sizeof(Value)));
+  emitmem(J, 0, 1, 0x89, RCX, RBX, RV(a));
+  emitmem(J, 0, 0, 0x88, RAX, RBX, RT(a));
+}
+
+
+/*
+** Store RK(c) into the array part of R[t]. Tables with metatables
+** are left to the interpreter (they may have '__newindex'), and so
+** are stores that would need a barrier.
+*/
+static void settable (JitState *J, int t, int key, int r, int c,
+                      const TValue *kc, int pc) {
+  arrayidx(J, t, key, r, pc);
+  emitmem(J, 0, 1, 0x83, 7, RAX, TOFF(metatable));
+  emit1(J, 0);  /* cmp qword [metatable], 0 */
+  jcc(J, CC_NE, stub(J, pc));
+  if (kc == NULL || iscollectable(kc)) {
+    size_t nobarrier = 0;
+    if (kc == NULL) {
+      emitmem(J, 0, 0, 0xF6, 0, RBX, RT(c));
+      emit1(J, BIT_ISCOLLECTABLE);  /* test byte [tag], collectable */
+      nobarrier = jccfwd(J, CC_E);
+    }
+    emitmem(J, 0, 0, 0xF6, 0, RAX,
+            cast_int(offsetof(Table, marked)));
+    emit1(J, bitmask(BLACKBIT));  /* test byte [marked], black */
+    jcc(J, CC_NE, stub(J, pc));
+    if (kc == NULL)
+      patch(J, nobarrier);
+  }
+  if (kc == NULL) {
+    emitmem(J, 0, 0, 0x8A, RAX, RBX, RT(c));
+    emitmem(J, 0, 1, 0x8B, RSI, RBX, RV(c));
+  }
+  else {
+    sil_Unsigned bits;
+    memcpy(&bits, &kc->value_, sizeof(bits));
+    emit1(J, 0xB0); emit1(J, rawtt(kc));  /* mov al, imm8 */
+    movimm(J, RSI, bits);
+  }
+  emitsib(J, 0, 0x88, RAX, RDX, RCX, 0, ARRTAG);
+  emitreg(J, 0, 1, 0xF7, 3, RCX);  /* neg rcx */
+  emitsib(J, 1, 0x89, RSI, RDX, RCX, 3, -cast_int(sizeof(Value)));
+}
+
+
+/* pseudo integer operations that need special code */
+#define IOP_MOD		(-1)
+#define IOP_IDIV	(-2)
+
+/* integer and float operations ('op rax, r/m' and 'op xmm0, xmm1') */
+#define IOP_ADD		0x03
+#define IOP_SUB		0x2B
+#define IOP_MUL		0x0FAF
+#define IOP_AND		0x23
+#define IOP_OR		0x0B
+#define IOP_XOR		0x33
+#define FOP_ADD		0x0F58
+#define FOP_SUB		0x0F5C
+#define FOP_MUL		0x0F59
+#define FOP_DIV		0x0F5E
+
+
+/*
+** R[a] := R[b] op R[c] (or R[b] op kc, when 'kc' is not NULL). 'iop'
+** is the operation for integers (0 if none), 'fop' for floats (0 if
+** none). Integer division and modulo only handle positive divisors,
+** whose C results are easily fixed into floor results; a constant
+** divisor is always positive here (see 'canjit').
+*/
+static void arith (JitState *J, int pc, int a, int b, int c,
+                   const TValue *kc, int iop, int fop) {
+  size_t notint[2] = {0, 0};
+  size_t done = 0;
+  int n = 0;
+  if (iop != 0 && (kc == NULL || ttisinteger(kc))) {
+    if (fop != 0)
+      notint[n++] = testtag(J, b, SIL_VNUMINT);
+    else
+      guardtag(J, b, SIL_VNUMINT, pc);
+    if (kc == NULL) {
+      if (fop != 0)
+        notint[n++] = testtag(J, c, SIL_VNUMINT);
+      else
+        guardtag(J, c, SIL_VNUMINT, pc);
+    }
+    if (iop == IOP_MOD || iop == IOP_IDIV) {
+      size_t nofix;
+      if (kc == NULL) {
+        emitmem(J, 0, 1, 0x83, 7, RBX, RV(c));
+        emit1(J, 0);  /* cmp qword [c], 0 */
+        jcc(J, CC_LE, stub(J, pc));
+      }
+      emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(b));
+      emit1(J, 0x48); emit1(J, 0x99);  /* cqo */
+      if (kc != NULL) {
+        movimm(J, RCX, l_castS2U(ivalue(kc)));
+        emitreg(J, 0, 1, 0xF7, 7, RCX);  /* idiv rcx */
+      }
+      else
+        emitmem(J, 0, 1, 0xF7, 7, RBX, RV(c));  /* idiv qword [c] */
+      emitreg(J, 0, 1, 0x85, RDX, RDX);  /* test rdx, rdx */
+      nofix = jccfwd(J, CC_NS);
+      if (iop == IOP_MOD) {  /* negative remainder: add divisor */
+        if (kc != NULL)
+          emitreg(J, 0, 1, 0x03, RDX, RCX);
+        else
+          emitmem(J, 0, 1, 0x03, RDX, RBX, RV(c));
+      }
+      else  /* negative remainder: round quotient down */
+        emitreg(J, 0, 1, 0xFF, 1, RAX);  /* dec rax */
+      patch(J, nofix);
+      if (iop == IOP_MOD)
+        emitreg(J, 0, 1, 0x8B, RAX, RDX);
+    }
+    else {
+      emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(b));
+      if (kc != NULL) {
+        movimm(J, RCX, l_castS2U(ivalue(kc)));
+        emitreg(J, 0, 1, iop, RAX, RCX);
+      }
+      else
+        emitmem(J, 0, 1, iop, RAX, RBX, RV(c));
+    }
+    emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+    settag(J, a, SIL_VNUMINT);
+    if (fop == 0)
+      return;
+    done = jccfwd(J, CC_ALWAYS);
+    while (n > 0)
+      patch(J, notint[--n]);
+  }
+  loadnum(J, XMM0, b, pc);
+  if (kc != NULL)
+    loadfltk(J, XMM1, ttisinteger(kc) ? cast_num(ivalue(kc)) : fltvalue(kc));
+  else
+    loadnum(J, XMM1, c, pc);
+  emitreg(J, 0xF2, 0, fop, XMM0, XMM1);
+  emitmem(J, 0xF2, 0, 0x0F11, XMM0, RBX, RV(a));  /* movsd */
+  settag(J, a, SIL_VNUMFLT);
+  if (done != 0)
+    patch(J, done);
+}
+
+
+/*
+** R[a] < R[b] or R[a] <= R[b]. Mixed integer/float comparisons are
+** left to the interpreter, as converting large integers to floats
+** could give wrong results.
+*/
+static void order (JitState *J, int pc, int a, int b, int icc, int fcc) {
+  size_t notint = testtag(J, a, SIL_VNUMINT);
+  guardtag(J, b, SIL_VNUMINT, pc);
+  emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(a));
+  emitmem(J, 0, 1, 0x3B, RAX, RBX, RV(b));  /* cmp rax, [b] */
+  condjump(J, pc, icc);
+  patch(J, notint);
+  guardtag(J, a, SIL_VNUMFLT, pc);
+  guardtag(J, b, SIL_VNUMFLT, pc);
+  emitmem(J, 0xF2, 0, 0x0F10, XMM1, RBX, RV(a));
+  emitmem(J, 0xF2, 0, 0x0F10, XMM0, RBX, RV(b));
+  emitreg(J, 0x66, 0, 0x0F2E, XMM0, XMM1);  /* ucomisd: b ? a */
+  condjump(J, pc, fcc);
+}
+
+
+/*
+** R[a] op sB for 'op' one of ==, <, <=, >, >=. Comparisons of floats
+** are written as 'x > y' or 'x >= y' ('ja'/'jae'), which are false
+** when either operand is a NaN.
+*/
+static void orderi (JitState *J, int pc, int a, int im, OpCode op) {
+  size_t notint = testtag(J, a, SIL_VNUMINT);
+  int icc, fcc;
+  switch (op) {
+    case OP_EQI: icc = fcc = CC_E; break;
+    case OP_LTI: icc = CC_L; fcc = CC_A; break;
+    case OP_LEI: icc = CC_LE; fcc = CC_AE; break;
+    case OP_GTI: icc = CC_G; fcc = CC_A; break;
+    default: icc = CC_GE; fcc = CC_AE; break;
+  }
+  emitmem(J, 0, 1, 0x81, 7, RBX, RV(a));
+  emit4(J, cast(l_uint32, im));  /* cmp qword [a], imm32 */
+  condjump(J, pc, icc);
+  patch(J, notint);
+  guardtag(J, a, SIL_VNUMFLT, pc);
+  loadfltk(J, XMM0, cast_num(im));
+  emitmem(J, 0xF2, 0, 0x0F10, XMM1, RBX, RV(a));
+  if (op == OP_EQI) {
+    floateq(J);
+    emitreg(J, 0, 0, 0x84, RAX, RAX);  /* test al, al */
+    condjump(J, pc, CC_NE);
+  }
+  else {
+    if (op == OP_LTI || op == OP_LEI)  /* im > a, im >= a */
+      emitreg(J, 0x66, 0, 0x0F2E, XMM0, XMM1);
+    else  /* a > im, a >= im */
+      emitreg(J, 0x66, 0, 0x0F2E, XMM1, XMM0);
+    condjump(J, pc, fcc);
+  }
+}
+
+
+static void eq (JitState *J, int pc, int a, int b) {
+  size_t notint = testtag(J, a, SIL_VNUMINT);
+  guardtag(J, b, SIL_VNUMINT, pc);
+  emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(a));
+  emitmem(J, 0, 1, 0x3B, RAX, RBX, RV(b));
+  condjump(J, pc, CC_E);
+  patch(J, notint);
+  guardtag(J, a, SIL_VNUMFLT, pc);
+  guardtag(J, b, SIL_VNUMFLT, pc);
+  emitmem(J, 0xF2, 0, 0x0F10, XMM1, RBX, RV(a));
+  emitmem(J, 0xF2, 0, 0x0F10, XMM0, RBX, RV(b));
+  floateq(J);
+  emitreg(J, 0, 0, 0x84, RAX, RAX);
+  condjump(J, pc, CC_NE);
+}
+
+
+/*
+** R[a] == K[b] for integers, short strings, booleans and nil (see
+** 'canjit'). Values with different tags are never equal, except for
+** an integer constant and a float, which go to the interpreter.
+*/
+static void eqk (JitState *J, int pc, int a, const TValue *k) {
+  if (ttisinteger(k) || ttisshrstring(k)) {
+    size_t notag = testtag(J, a, rawtt(k));
+    sil_Unsigned bits;
+    memcpy(&bits, &k->value_, sizeof(bits));
+    movimm(J, RCX, bits);
+    emitmem(J, 0, 1, 0x39, RCX, RBX, RV(a));  /* cmp [a], rcx */
+    condjump(J, pc, CC_E);
+    patch(J, notag);
+    if (ttisinteger(k)) {  /* a float may still be equal */
+      emitmem(J, 0, 0, 0x80, 7, RBX, RT(a));
+      emit1(J, SIL_VNUMFLT);
+      jcc(J, CC_E, stub(J, pc));
+    }
+    condjump(J, pc, CC_NEVER);
+  }
+  else {  /* nil or a boolean: compare tags */
+    emitmem(J, 0, 0, 0x80, 7, RBX, RT(a));
+    emit1(J, rawtt(k));
+    condjump(J, pc, CC_E);
+  }
+}
+
+
+/*
+** Integer loops only; float loops go to the interpreter. As in
+** 'forprep', R[a] is the iteration count, R[a+1] the step and R[a+2]
+** the control variable.
+*/
+static void forloop (JitState *J, int pc, int a, int target) {
+  size_t done;
+  guardtag(J, a + 1, SIL_VNUMINT, pc);
+  emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(a));
+  emitreg(J, 0, 1, 0x85, RAX, RAX);  /* test rax, rax */
+  done = jccfwd(J, CC_E);
+  emitreg(J, 0, 1, 0xFF, 1, RAX);  /* dec rax */
+  emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+  emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(a + 2));
+  emitmem(J, 0, 1, 0x03, RAX, RBX, RV(a + 1));
+  emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a + 2));
+  jumpto(J, pc, target);
+  patch(J, done);
+}
+
+
+/*
+** Ascending integer loops only: other loops (and errors) are left to
+** the interpreter.
+*/
+static void forprep (JitState *J, int pc, int a, int skip) {
+  size_t nodiv;
+  guardtag(J, a, SIL_VNUMINT, pc);
+  guardtag(J, a + 1, SIL_VNUMINT, pc);
+  guardtag(J, a + 2, SIL_VNUMINT, pc);
+  emitmem(J, 0, 1, 0x8B, RCX, RBX, RV(a + 2));  /* step */
+  emitreg(J, 0, 1, 0x85, RCX, RCX);
+  jcc(J, CC_LE, stub(J, pc));
+  emitmem(J, 0, 1, 0x8B, RSI, RBX, RV(a));  /* init */
+  emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(a + 1));  /* limit */
+  emitreg(J, 0, 1, 0x3B, RSI, RAX);  /* cmp init, limit */
+  jcc(J, CC_G, label(J, skip));  /* skip the loop */
+  emitreg(J, 0, 1, 0x2B, RAX, RSI);  /* count = limit - init */
+  emitreg(J, 0, 1, 0x83, 7, RCX);
+  emit1(J, 1);  /* cmp rcx, 1 */
+  nodiv = jccfwd(J, CC_E);
+  emitreg(J, 0, 0, 0x33, RDX, RDX);  /* xor edx, edx */
+  emitreg(J, 0, 1, 0xF7, 6, RCX);  /* div rcx */
+  patch(J, nodiv);
+  emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+  emitmem(J, 0, 1, 0x89, RCX, RBX, RV(a + 1));
+  emitmem(J, 0, 1, 0x89, RSI, RBX, RV(a + 2));
+}
+
+
+static void instruction (JitState *J, int pc) {
+  const Proto *p = J->p;
+  Instruction i = silP_unquicken(p->code[pc]);
+  int a = GETARG_A(i);
+  OpCode op = GET_OPCODE(i);
+  TValue v;
+  switch (op) {
+    case OP_MOVE: move(J, a, GETARG_B(i)); break;
+    case OP_LOADI: case OP_LOADF: {
+      if (op == OP_LOADI) {
+        setivalue(&v, GETARG_sBx(i));
+      }
+      else {
+        setfltvalue(&v, cast_num(GETARG_sBx(i)));
+      }
+      loadk(J, a, &v);
+      break;
+    }
+    case OP_LOADK: loadk(J, a, &p->k[GETARG_Bx(i)]); break;
+    case OP_LOADFALSE: settag(J, a, SIL_VFALSE); break;
+    case OP_LFALSESKIP: {
+      settag(J, a, SIL_VFALSE);
+      jmp(J, label(J, pc + 2));
+      break;
+    }
+    case OP_LOADTRUE: settag(J, a, SIL_VTRUE); break;
+    case OP_LOADNIL: {
+      int b = GETARG_B(i);
+      do { settag(J, a++, SIL_VNIL); } while (b--);
+      break;
+    }
+    case OP_GETUPVAL: getupval(J, a, GETARG_B(i)); break;
+    case OP_GETTABLE: gettable(J, a, GETARG_B(i), GETARG_C(i), 1, pc); break;
+    case OP_GETI: gettable(J, a, GETARG_B(i), GETARG_C(i), 0, pc); break;
+    case OP_SETTABLE: case OP_SETI: {
+      int c = GETARG_C(i);
+      settable(J, a, GETARG_B(i), op == OP_SETTABLE, c,
+               GETARG_k(i) ? &p->k[c] : NULL, pc);
+      break;
+    }
+    case OP_ADDI: {
+      setivalue(&v, GETARG_sC(i));
+      arith(J, pc, a, GETARG_B(i), 0, &v, IOP_ADD, FOP_ADD);
+      break;
+    }
+#define karith(iop,fop)  \
+	arith(J, pc, a, GETARG_B(i), 0, &p->k[GETARG_C(i)], iop, fop)
+    case OP_ADDK: karith(IOP_ADD, FOP_ADD); break;
+    case OP_SUBK: karith(IOP_SUB, FOP_SUB); break;
+    case OP_MULK: karith(IOP_MUL, FOP_MUL); break;
+    case OP_MODK: karith(IOP_MOD, 0); break;
+    case OP_DIVK: karith(0, FOP_DIV); break;
+    case OP_IDIVK: karith(IOP_IDIV, 0); break;
+    case OP_BANDK: karith(IOP_AND, 0); break;
+    case OP_BORK: karith(IOP_OR, 0); break;
+    case OP_BXORK: karith(IOP_XOR, 0); break;
+#undef karith
+#define rarith(iop,fop)  \
+	arith(J, pc, a, GETARG_B(i), GETARG_C(i), NULL, iop, fop)
+    case OP_ADD: rarith(IOP_ADD, FOP_ADD); break;
+    case OP_SUB: rarith(IOP_SUB, FOP_SUB); break;
+    case OP_MUL: rarith(IOP_MUL, FOP_MUL); break;
+    case OP_MOD: rarith(IOP_MOD, 0); break;
+    case OP_DIV: rarith(0, FOP_DIV); break;
+    case OP_IDIV: rarith(IOP_IDIV, 0); break;
+    case OP_BAND: rarith(IOP_AND, 0); break;
+    case OP_BOR: rarith(IOP_OR, 0); break;
+    case OP_BXOR: rarith(IOP_XOR, 0); break;
+#undef rarith
+    case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
+      /* reached only when the arithmetic fails, which exits before */
+      break;
+    }
+    case OP_UNM: {
+      int b = GETARG_B(i);
+      size_t notint = testtag(J, b, SIL_VNUMINT);
+      size_t done;
+      emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(b));
+      emitreg(J, 0, 1, 0xF7, 3, RAX);  /* neg rax */
+      emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+      settag(J, a, SIL_VNUMINT);
+      done = jccfwd(J, CC_ALWAYS);
+      patch(J, notint);
+      guardtag(J, b, SIL_VNUMFLT, pc);
+      emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(b));
+      emitreg(J, 0, 1, 0x0FBA, 7, RAX);
+      emit1(J, 63);  /* btc rax, 63 (flip sign) */
+      emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+      settag(J, a, SIL_VNUMFLT);
+      patch(J, done);
+      break;
+    }
+    case OP_BNOT: {
+      int b = GETARG_B(i);
+      guardtag(J, b, SIL_VNUMINT, pc);
+      emitmem(J, 0, 1, 0x8B, RAX, RBX, RV(b));
+      emitreg(J, 0, 1, 0xF7, 2, RAX);  /* not rax */
+      emitmem(J, 0, 1, 0x89, RAX, RBX, RV(a));
+      settag(J, a, SIL_VNUMINT);
+      break;
+    }
+    case OP_NOT: {
+      truthy(J, GETARG_B(i));
+      emitreg(J, 0, 0, 0xF6, 3, RCX);  /* neg cl */
+      emitreg(J, 0, 0, 0x80, 4, RCX);
+      emit1(J, SIL_VTRUE ^ SIL_VFALSE);  /* and cl, imm8 */
+      emit1(J, 0xB0); emit1(J, SIL_VTRUE);  /* mov al, true */
+      emitreg(J, 0, 0, 0x30, RCX, RAX);  /* xor al, cl */
+      emitmem(J, 0, 0, 0x88, RAX, RBX, RT(a));
+      break;
+    }
+    case OP_JMP: jumpto(J, pc, pc + 1 + GETARG_sJ(i)); break;
+    case OP_EQ: eq(J, pc, a, GETARG_B(i)); break;
+    case OP_LT: order(J, pc, a, GETARG_B(i), CC_L, CC_A); break;
+    case OP_LE: order(J, pc, a, GETARG_B(i), CC_LE, CC_AE); break;
+    case OP_EQK: eqk(J, pc, a, &p->k[GETARG_B(i)]); break;
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
+      orderi(J, pc, a, GETARG_sB(i), op);
+      break;
+    }
+    case OP_TEST: {
+      truthy(J, a);
+      emitreg(J, 0, 0, 0x84, RCX, RCX);  /* test cl, cl */
+      condjump(J, pc, CC_NE);
+      break;
+    }
+    case OP_FORLOOP: forloop(J, pc, a, pc + 1 - GETARG_Bx(i)); break;
+    case OP_FORPREP: forprep(J, pc, a, pc + GETARG_Bx(i) + 2); break;
+    default: jmp(J, stub(J, pc)); break;  /* no template */
+  }
+}
+
+
+/*
+** Whether instruction 'i' has a template (see 'instruction'). Some
+** instructions only have templates for some kinds of constants.
+*/
+static int canjit (const Proto *p, Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_LOADNIL: case OP_GETUPVAL: case OP_GETTABLE:
+    case OP_SETTABLE: case OP_ADDI: case OP_ADDK: case OP_SUBK:
+    case OP_MULK: case OP_DIVK: case OP_BANDK: case OP_BORK:
+    case OP_BXORK: case OP_ADD: case OP_SUB: case OP_MUL:
+    case OP_MOD: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+    case OP_BXOR: case OP_MMBIN: case OP_MMBINI: case OP_MMBINK:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_JMP: case OP_EQ:
+    case OP_LT: case OP_LE: case OP_EQI: case OP_LTI: case OP_LEI:
+    case OP_GTI: case OP_GEI: case OP_TEST: case OP_FORLOOP:
+    case OP_FORPREP:
+      return 1;
+    case OP_GETI:
+      return GETARG_C(i) > 0;
+    case OP_SETI:
+      return GETARG_B(i) > 0;
+    case OP_MODK: case OP_IDIVK: {
+      const TValue *k = &p->k[GETARG_C(i)];
+      return ttisinteger(k) && ivalue(k) > 0;
+    }
+    case OP_EQK: {
+      const TValue *k = &p->k[GETARG_B(i)];
+      return ttisinteger(k) || ttisshrstring(k) || ttisnil(k) ||
+             ttisboolean(k);
+    }
+    default:
+      return 0;
+  }
+}
+
+
+/*
+** If instruction at 'pc' is the back edge of a loop whose whole body
+** has templates, return the first instruction of that body; otherwise
+** return -1.
+*/
+static int loopentry (const Proto *p, int pc) {
+  Instruction i = silP_unquicken(p->code[pc]);
+  int start, n;
+  if (GET_OPCODE(i) == OP_FORLOOP)
+    start = pc + 1 - GETARG_Bx(i);
+  else if (GET_OPCODE(i) == OP_JMP && GETARG_sJ(i) < 0)
+    start = pc + 1 + GETARG_sJ(i);
+  else
+    return -1;
+  for (n = start; n <= pc; n++) {
+    if (!canjit(p, silP_unquicken(p->code[n])))
+      return -1;
+  }
+  return start;
+}
+
+
+static void prologue (JitState *J) {
+  emit1(J, 0x53);  /* push rbx */
+  emit1(J, 0x41); emit1(J, 0x54);  /* push r12 */
+  emit1(J, 0x41); emit1(J, 0x55);  /* push r13 */
+  emitreg(J, 0, 1, 0x89, RDI, RBX);  /* mov rbx, rdi (base) */
+  emitreg(J, 0, 1, 0x89, RSI, R13);  /* mov r13, rsi (ci) */
+  emitreg(J, 0, 1, 0x89, RDX, R12);  /* mov r12, rdx (closure) */
+  emit1(J, 0xFF); emit1(J, 0xE1);  /* jmp rcx (entry) */
+  J->epilogue = J->pos;
+  emit1(J, 0x41); emit1(J, 0x5D);  /* pop r13 */
+  emit1(J, 0x41); emit1(J, 0x5C);  /* pop r12 */
+  emit1(J, 0x5B);  /* pop rbx */
+  emit1(J, 0xC3);  /* ret */
+}
+
+
+static void gencode (JitState *J) {
+  int pc;
+  J->pos = 0;
+  prologue(J);
+  J->stubs = J->pos;
+  for (pc = 0; pc < J->p->sizecode; pc++) {
+    emit1(J, 0xB8);  /* mov eax, pc */
+    emit4(J, cast_uint(pc));
+    jmp(J, J->epilogue);
+  }
+  for (pc = 0; pc < J->p->sizecode; pc++) {
+    J->label[pc] = cast_uint(J->pos);
+    /* code after a loop also runs natively, so templates must agree
+       with 'canjit' everywhere */
+    if (canjit(J->p, silP_unquicken(J->p->code[pc])))
+      instruction(J, pc);
+    else
+      jmp(J, stub(J, pc));  /* no template */
+  }
+}
+
+
+/* marks loop entries in 'entry' while compiling */
+#define ENTRYBIT	(1u << 31)
+
+
+void silJ_compile (sil_State *L, Proto *p) {
+  JitState J;
+  JitCode *j;
+  void *mem;
+  int pc;
+  int nentries = 0;
+  p->hotcount = INT_MIN;  /* do not try again for a long time */
+  for (pc = 0; pc < p->sizecode; pc++) {
+    if (loopentry(p, pc) >= 0)
+      nentries++;
+  }
+  if (nentries == 0)
+    return;  /* no loop would run natively */
+  j = cast(JitCode *, silM_malloc_(L, sizejitcode(p->sizecode), 0));
+  j->sizeentry = p->sizecode;
+  memset(j->entry, 0, cast_sizet(p->sizecode) * sizeof(unsigned int));
+  J.p = p;
+  J.label = j->entry;
+  J.buff = NULL;
+  gencode(&J);  /* first pass only computes positions... */
+  mem = mmap(NULL, J.pos, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    silM_free_(L, j, sizejitcode(j->sizeentry));
+    return;
+  }
+  j->mcode = cast_charp(mem);
+  j->sizemcode = J.pos;
+  J.buff = cast(lu_byte *, mem);
+  gencode(&J);  /* ...second pass emits the code */
+  sil_assert(J.pos == j->sizemcode);
+  if (mprotect(mem, j->sizemcode, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, j->sizemcode);
+    silM_free_(L, j, sizejitcode(j->sizeentry));
+    return;
+  }
+  /* keep only the positions of loop entries */
+  for (pc = 0; pc < p->sizecode; pc++) {
+    int start = loopentry(p, pc);
+    if (start >= 0)
+      j->entry[start] |= ENTRYBIT;
+  }
+  for (pc = 0; pc < p->sizecode; pc++)
+    j->entry[pc] = (j->entry[pc] & ENTRYBIT) ? j->entry[pc] & ~ENTRYBIT : 0;
+  p->jit = j;
+}
+
+
+int silJ_run (JitCode *j, CallInfo *ci, StkId base, int pcidx) {
+  JitFunction f = cast(JitFunction, cast_func(j->mcode));
+  sil_assert(silJ_enterable(j, pcidx));
+  return f(base, ci, ci_func(ci), j->mcode + j->entry[pcidx]);
+}
+
+#else
+
+void silJ_compile (sil_State *L, Proto *p) {
+  UNUSED(L);
+  p->hotcount = INT_MIN;
+}
+
+
+int silJ_run (JitCode *j, CallInfo *ci, StkId base, int pcidx) {
+  UNUSED(j); UNUSED(ci); UNUSED(base);
+  return pcidx;
+}
+
+#endif
+
+
+void silJ_free (sil_State *L, Proto *p) {
+  JitCode *j = p->jit;
+  if (j != NULL) {
+#if SIL_USE_JIT
+    munmap(j->mcode, j->sizemcode);
+#endif
+    silM_free_(L, j, sizejitcode(j->sizeentry));
+    p->jit = NULL;
+  }
+}
+
+/* }====================================================== */
@@ -0,0 +1,62 @@
+/*
+** $Id: ljit.h $
+** Baseline native compiler for hot functions
+** See Copyright Notice in sil.h
+*/
+
+#ifndef ljit_h
+#define ljit_h
+
+
+#include "lobject.h"
+#include "lstate.h"
+
+
+/*
+** The compiler emits x86-64 code into pages obtained with 'mmap', so
+** it is only available on that architecture under POSIX; elsewhere
+** 'SIL_USE_JIT' is silently turned off.
+*/
+#if !defined(SIL_USE_JIT)
+#define SIL_USE_JIT	0
+#elif SIL_USE_JIT && !(defined(__x86_64__) && defined(SIL_USE_POSIX))
+#undef SIL_USE_JIT
+#define SIL_USE_JIT	0
+#endif
+
+
+/*
+** Hotness (calls plus loop iterations) a function must accumulate
+** before it is compiled.
+*/
+#if !defined(SILI_JITHOT)
+#define SILI_JITHOT	1000
+#endif
+
+
+/*
+** Native code for a prototype. 'entry' has one slot per instruction;
+** slots for the first instruction of a loop whose whole body can run
+** natively keep the offset of that instruction in 'mcode', all other
+** slots are zero.
+*/
+typedef struct JitCode {
+  char *mcode;  /* executable memory */
+  size_t sizemcode;
+  int sizeentry;
+  unsigned int entry[1];
+} JitCode;
+
+
+/* size of a 'JitCode' with 'n' entries */
+#define sizejitcode(n)  \
+	(offsetof(JitCode, entry) + cast_sizet(n) * sizeof(unsigned int))
+
+#define silJ_enterable(j,pcidx)	((j)->entry[pcidx] != 0)
+
+
+SILI_FUNC void silJ_compile (sil_State *L, Proto *p);
+SILI_FUNC int silJ_run (JitCode *j, CallInfo *ci, StkId base, int pcidx);
+SILI_FUNC void silJ_free (sil_State *L, Proto *p);
+
+#endif
@@ -13,7 +13,12 @@
 
 #define vmcase(l)     L_##l:
 
+#if SIL_USE_THREADED
+/* jump through the threaded code of the instruction just fetched */
+#define vmbreak		vmfetch(); goto *th[pc - code - 1];
+#else
 #define vmbreak		vmfetch(); vmdispatch(GET_OPCODE(i));
+#endif
 
 
 static const void *const disptab[NUM_OPCODES] = {
@@ -107,6 +112,22 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_CLOSURE,
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
-&&L_OP_EXTRAARG
+&&L_OP_EXTRAARG,
+&&L_OP_VARSELECT,
+&&L_OP_GETFIELDCALL,
+&&L_OP_SELFCALL,
+&&L_OP_GETTABUPFIELD,
+&&L_OP_LOADIFORPREP,
+&&L_OP_MOVERETURN1,
+&&L_OP_ADDII,
+&&L_OP_ADDFF,
+&&L_OP_SUBII,
+&&L_OP_SUBFF,
+&&L_OP_MULII,
+&&L_OP_MULFF,
+&&L_OP_LTII,
+&&L_OP_LTFF,
+&&L_OP_LEII,
+&&L_OP_LEFF
 
 };
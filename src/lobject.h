@@ -579,6 +579,17 @@ typedef struct AbsLineInfo {
 } AbsLineInfo;
 
 
+/*
+** Execution profile of an instruction (see 'SIL_USE_PROFILE'):
+** how many times it ran (or, for a loop instruction, jumped back) and
+** the sets of types seen in its first two operands, as bits 'PT_*'.
+*/
+typedef struct ProfSite {
+  lu_mem count;
+  lu_byte types[2];
+} ProfSite;
+
+
 /*
 ** Flags in Prototypes
 */
@@ -605,6 +616,11 @@ typedef struct Proto {
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
   Instruction *code;  /* opcodes */
+  unsigned int *icache;  /* inline caches and type feedback */
+  struct JitCode *jit;  /* native code (see 'ljit.h') */
+  int hotcount;  /* calls and loop iterations, to trigger the JIT */
+  ProfSite *prof;  /* execution profile; entry 'sizecode' counts calls */
+  const void **threaded;  /* handler of each instruction (see lvm.c) */
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
@@ -763,6 +779,37 @@ typedef union Node {
 
 
 
+/*
+** Shapes (or hidden classes). A table whose hash part has only short
+** strings as keys may keep those keys in a shape, shared by all tables
+** that got the same keys in the same order, and only its values in
+** 'slots' (the value for 'keys[i]' is in 'slots[i]'). Shapes form a
+** tree: each one links the shapes that add one key to it ('kids');
+** the root, with no keys, lives in the global state.
+*/
+typedef struct Shape {
+  struct Shape *parent;  /* shape without the last key */
+  struct Shape *kids;  /* list of shapes with one more key */
+  struct Shape *next;  /* next shape in the list of its parent */
+  unsigned int refs;  /* number of tables and kids using this shape */
+  unsigned short nkids;  /* length of list 'kids' */
+  unsigned short nkeys;  /* number of keys */
+  TString *keys[1];  /* keys, in the order they were added */
+} Shape;
+
+
+/*
+** Cards of a large table (see 'ltable.h'): one byte for each region
+** of its array part, followed by one byte for each region of its hash
+** part, telling whether the collector must look at that region again.
+*/
+typedef struct Cards {
+  unsigned int na;  /* number of cards for the array part */
+  unsigned int nn;  /* number of cards for the hash part */
+  lu_byte c[1];  /* the cards */
+} Cards;
+
+
 typedef struct Table {
   CommonHeader;
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
@@ -772,6 +819,9 @@ typedef struct Table {
   Node *node;
   struct Table *metatable;
   GCObject *gclist;
+  Shape *shape;  /* shape of the hash part, or NULL */
+  TValue *slots;  /* values of the hash part when it has a shape */
+  Cards *cards;  /* dirty regions for the collector, or NULL */
 } Table;
 
 
@@ -104,6 +104,22 @@ SILI_DDEF const lu_byte silP_opmodes[NUM_OPCODES] = {
  ,opmode(0, 1, 0, 0, 1, iABC)		/* OP_VARARG */
  ,opmode(0, 0, 1, 0, 1, iABC)		/* OP_VARARGPREP */
  ,opmode(0, 0, 0, 0, 0, iAx)		/* OP_EXTRAARG */
+ ,opmode(0, 0, 0, 0, 0, iABC)		/* OP_VARSELECT */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETFIELDCALL */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SELFCALL */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_GETTABUPFIELD */
+ ,opmode(0, 0, 0, 0, 1, iAsBx)		/* OP_LOADIFORPREP */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MOVERETURN1 */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_ADDFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_SUBFF */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULII */
+ ,opmode(0, 0, 0, 0, 1, iABC)		/* OP_MULFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LTFF */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEII */
+ ,opmode(0, 0, 0, 1, 0, iABC)		/* OP_LEFF */
 };
 
 
@@ -136,3 +152,42 @@ int silP_isIT (Instruction i) {
   }
 }
 
+
+/*
+** Return the generic form of a (possibly quickened) instruction or
+** superinstruction. Both keep all the arguments of their generic
+** forms.
+*/
+Instruction silP_unquicken (Instruction i) {
+  static const lu_byte generic[NUM_OPCODES - OP_FIRSTSUPER] = {
+    OP_GETFIELD, OP_SELF, OP_GETTABUP, OP_LOADI, OP_MOVE,
+    OP_ADD, OP_ADD, OP_SUB, OP_SUB, OP_MUL, OP_MUL,
+    OP_LT, OP_LT, OP_LE, OP_LE
+  };
+  OpCode op = GET_OPCODE(i);
+  if (isspecialized(op))
+    SET_OPCODE(i, generic[op - OP_FIRSTSUPER]);
+  return i;
+}
+
+
+/*
+** Turn into a superinstruction the first instruction of each pair of
+** consecutive instructions that has one. ('code' must be generic.)
+*/
+void silP_fuse (Instruction *code, int n) {
+  int pc;
+  for (pc = 0; pc + 1 < n; pc++) {
+    OpCode second, super;
+    switch (GET_OPCODE(code[pc])) {
+      case OP_GETFIELD: second = OP_CALL; super = OP_GETFIELDCALL; break;
+      case OP_SELF: second = OP_CALL; super = OP_SELFCALL; break;
+      case OP_GETTABUP: second = OP_GETFIELD; super = OP_GETTABUPFIELD; break;
+      case OP_LOADI: second = OP_FORPREP; super = OP_LOADIFORPREP; break;
+      case OP_MOVE: second = OP_RETURN1; super = OP_MOVERETURN1; break;
+      default: continue;
+    }
+    if (GET_OPCODE(code[pc + 1]) == second)
+      SET_OPCODE(code[pc], super);
+  }
+}
@@ -340,11 +340,43 @@ OP_VARARG,/*	A C	R[A], R[A+1], ..., R[A+C-2] = vararg		*/
 
 OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
-OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
+OP_EXTRAARG,/*	Ax	extra (larger) argument for previous opcode	*/
+
+OP_VARSELECT,/*	A	R[A], ... := select(R[A+1], ...); pc += 2	(*)	*/
+
+/* superinstructions (see note) */
+OP_GETFIELDCALL,/* A B C	GETFIELD A B C; then CALL (next instruction)	*/
+OP_SELFCALL,/*	A B C	SELF A B C; then CALL (next instruction)	*/
+OP_GETTABUPFIELD,/* A B C	GETTABUP A B C; then GETFIELD (next instr.)	*/
+OP_LOADIFORPREP,/* A sBx	LOADI A sBx; then FORPREP (next instruction)	*/
+OP_MOVERETURN1,/* A B	MOVE A B; then RETURN1 (next instruction)	*/
+
+/* quickened opcodes (see note) */
+OP_ADDII,/*	A B C	R[A] := R[B] + R[C]  (integers)			*/
+OP_ADDFF,/*	A B C	R[A] := R[B] + R[C]  (floats)			*/
+OP_SUBII,/*	A B C	R[A] := R[B] - R[C]  (integers)			*/
+OP_SUBFF,/*	A B C	R[A] := R[B] - R[C]  (floats)			*/
+OP_MULII,/*	A B C	R[A] := R[B] * R[C]  (integers)			*/
+OP_MULFF,/*	A B C	R[A] := R[B] * R[C]  (floats)			*/
+OP_LTII,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++  (integers)	*/
+OP_LTFF,/*	A B k	if ((R[A] <  R[B]) ~= k) then pc++  (floats)	*/
+OP_LEII,/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++  (integers)	*/
+OP_LEFF/*	A B k	if ((R[A] <= R[B]) ~= k) then pc++  (floats)	*/
 } OpCode;
 
 
-#define NUM_OPCODES	((int)(OP_EXTRAARG) + 1)
+#define NUM_OPCODES	((int)(OP_LEFF) + 1)
+
+/* first superinstruction */
+#define OP_FIRSTSUPER	OP_GETFIELDCALL
+
+/* first opcode that is never generated by the compiler */
+#define OP_FIRSTQUICK	OP_ADDII
+
+#define isquickened(op)	((op) >= OP_FIRSTQUICK)
+
+/* superinstructions and quickened opcodes have a generic form */
+#define isspecialized(op)	((op) >= OP_FIRSTSUPER)
 
 
 
@@ -371,6 +403,12 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 
   (*) In OP_RETURN, if (B == 0) then return up to 'top'.
 
+  (*) OP_VARSELECT precedes the OP_VARARG and OP_CALL of a call
+  'f(n, ...)' to a function named 'select'. If f is the original
+  'select' (see 'sil_setbuiltin'), it puts the results the OP_CALL
+  wants (its C) straight from the vararg frame and skips both
+  instructions; otherwise, or for errors, it does nothing.
+
   (*) In OP_LOADKX and OP_NEWTABLE, the next instruction is always
   OP_EXTRAARG.
 
@@ -399,6 +437,23 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   original operand was a float. (It must be corrected in case of
   metamethods.)
 
+  (*) Quickened opcodes are never generated by the compiler. When the
+  interpreter is built with 'SIL_USE_QUICKEN', it rewrites in place a
+  generic instruction that keeps seeing the same operand types into
+  its type-specialized variant. A specialized instruction whose type
+  guard fails rewrites itself back into its generic form (see
+  'silP_unquicken') and runs the generic code, so metamethods, errors,
+  and yields always see generic instructions. Dumped code also uses
+  only generic instructions.
+
+  (*) A superinstruction replaces the first instruction of a frequent
+  pair, keeping its arguments; the second instruction stays in place,
+  so jumps to it, its line information, and the size of the code do
+  not change. Its handler runs the first instruction and then goes
+  straight to the handler of the second one, skipping a dispatch. The
+  compiler and the loader create them with 'silP_fuse'; like quickened
+  opcodes, they are undone by 'silP_unquicken' and never dumped.
+
 ===========================================================================*/
 
 
@@ -424,6 +479,8 @@ SILI_DDEC(const lu_byte silP_opmodes[NUM_OPCODES];)
 
 SILI_FUNC int silP_isOT (Instruction i);
 SILI_FUNC int silP_isIT (Instruction i);
+SILI_FUNC Instruction silP_unquicken (Instruction i);
+SILI_FUNC void silP_fuse (Instruction *code, int n);
 
 
 #endif
@@ -96,6 +96,22 @@ static const char *const opnames[] = {
   "VARARG",
   "VARARGPREP",
   "EXTRAARG",
+  "VARSELECT",
+  "GETFIELDCALL",
+  "SELFCALL",
+  "GETTABUPFIELD",
+  "LOADIFORPREP",
+  "MOVERETURN1",
+  "ADDII",
+  "ADDFF",
+  "SUBII",
+  "SUBFF",
+  "MULII",
+  "MULFF",
+  "LTII",
+  "LTFF",
+  "LEII",
+  "LEFF",
   NULL
 };
 
@@ -753,6 +753,7 @@ static void close_func(LexState *ls) {
   sil_assert(fs->bl == NULL);
   silK_finish(fs);
   silM_shrinkvector(L, f->code, f->sizecode, fs->pc, Instruction);
+  silF_initcache(L, f);
   silM_shrinkvector(L, f->lineinfo, f->sizelineinfo, fs->pc, ls_byte);
   silM_shrinkvector(L, f->abslineinfo, f->sizeabslineinfo, fs->nabslineinfo,
                     AbsLineInfo);
@@ -1086,7 +1087,46 @@ static int explist(LexState *ls, expdesc *v) {
   return n;
 }
 
-static void funcargs(LexState *ls, expdesc *f) {
+/*
+** Check whether expression 'v' is a variable named 'select', whose
+** calls 'select(n, ...)' may read the vararg frame directly. (Its
+** value is checked when the call runs.)
+*/
+static int isselect(FuncState *fs, expdesc *v) {
+  TString *name;
+  if (!(fs->f->flag & PF_ISVARARG))
+    return 0;
+  switch (v->k) {
+  case VLOCAL:
+    name = getlocalvardesc(fs, v->u.var.vidx)->vd.name;
+    break;
+  case VUPVAL:
+    name = fs->f->upvalues[v->u.info].name;
+    break;
+  case VINDEXED: case VINDEXUP: case VINDEXSTR:
+    if (v->u.ind.keystr < 0)
+      return 0;
+    name = tsvalue(&fs->f->k[v->u.ind.keystr]);
+    break;
+  default:
+    return 0;
+  }
+  return (name != NULL && strcmp(getstr(name), "select") == 0);
+}
+
+/*
+** Put an OP_VARSELECT before the OP_VARARG just coded for the '...' in
+** a call 'select(n, ...)' with its function in register 'base'.
+*/
+static void varselect(FuncState *fs, expdesc *va, int base) {
+  Instruction *pi = &fs->f->code[va->u.info];
+  Instruction vararg = *pi;
+  sil_assert(va->u.info == fs->pc - 1 && GET_OPCODE(vararg) == OP_VARARG);
+  *pi = CREATE_ABCk(OP_VARSELECT, base, 0, 0, 0);
+  va->u.info = silK_code(fs, vararg);
+}
+
+static void funcargs(LexState *ls, expdesc *f, int sel) {
   FuncState *fs = ls->fs;
   expdesc args;
   int base, nparams;
@@ -1097,7 +1137,9 @@ static void funcargs(LexState *ls, expdesc *f) {
     if (ls->t.token == ')') /* arg list is empty? */
       args.k = VVOID;
     else {
-      explist(ls, &args);
+      int n = explist(ls, &args);
+      if (sel && n == 2 && args.k == VVARARG) /* 'select(n, ...)'? */
+        varselect(fs, &args, f->u.info);
       if (hasmultret(args.k))
         silK_setmultret(fs, &args);
     }
@@ -1183,14 +1225,15 @@ static void suffixedexp(LexState *ls, expdesc *v) {
       silX_next(ls);
       codename(ls, &key);
       silK_self(fs, v, &key);
-      funcargs(ls, v);
+      funcargs(ls, v, 0);
       break;
     }
     case '(':
     case TK_STRING:
     case '{' /*}*/: { /* funcargs */
+      int sel = isselect(fs, v);
       silK_exp2nextreg(fs, v);
-      funcargs(ls, v);
+      funcargs(ls, v, sel);
       break;
     }
     default:
@@ -0,0 +1,293 @@
+/*
+** $Id: lproflib.c $
+** Sampling profiler
+** See Copyright Notice in sil.h
+*/
+
+#define lproflib_c
+#define SIL_LIB
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "sil.h"
+
+#include "lauxlib.h"
+#include "sillib.h"
+#include "llimits.h"
+
+
+/*
+** The profiler samples the stack of the main thread at a fixed rate
+** of CPU time. A timer (ITIMER_PROF) sends SIGPROF at each tick. As a
+** signal handler can do almost nothing safely, the handler only sets
+** a hook ('sil_sethook' is safe to call there) that runs at the next
+** instruction, as 'laction' in sil.c does. The hook walks the stack,
+** records the sample, and puts back any hook that was set before.
+** Samples live in a table in the registry, which maps each folded
+** stack (frames from the outermost to the innermost, separated by
+** ';') to its count; 'profiler.folded' writes them in the format read
+** by flamegraph.pl and speedscope. Only one state can be profiled at
+** a time, and coroutines other than the main thread are sampled only
+** when they return to it.
+*/
+
+
+/* default sampling rate, in samples per second of CPU time */
+#if !defined(SIL_PROFHZ)
+#define SIL_PROFHZ	1000
+#endif
+
+/* maximum number of frames kept in a sample */
+#if !defined(SIL_PROFMAXDEPTH)
+#define SIL_PROFMAXDEPTH	100
+#endif
+
+
+/* key, in the registry, for the table of samples */
+static const char *const PROFSAMPLES = "_PROFSAMPLES";
+
+/* key, in the registry, for the object that stops the profiler */
+static const char *const PROFSENTINEL = "_PROFILER";
+
+
+#if defined(SIL_USE_POSIX)	/* { */
+
+#include <signal.h>
+#include <sys/time.h>
+
+
+static sil_State *volatile profL = NULL;  /* state being profiled */
+
+/* hook set before a sample was requested */
+static sil_Hook oldhook;
+static int oldmask;
+static int oldcount;
+
+static struct sigaction oldaction;  /* previous handler for SIGPROF */
+
+
+/*
+** Push the name of a stack frame: its function name (if known) and
+** where it is running. (';' separates frames in a folded stack, so it
+** cannot appear inside a name.)
+*/
+static void pushframe (sil_State *L, sil_Debug *ar) {
+  const char *s;
+  sil_getinfo(L, "Sln", ar);
+  if (*ar->what == 'C')
+    s = sil_pushfstring(L, "%s [C]", (ar->name != NULL) ? ar->name : "?");
+  else if (*ar->what == 'm')
+    s = sil_pushfstring(L, "main chunk (%s:%d)",
+                           ar->short_src, ar->currentline);
+  else if (ar->name != NULL)
+    s = sil_pushfstring(L, "%s (%s:%d)",
+                           ar->name, ar->short_src, ar->currentline);
+  else
+    s = sil_pushfstring(L, "function <%s:%d> (%s:%d)", ar->short_src,
+                           ar->linedefined, ar->short_src, ar->currentline);
+  if (strchr(s, ';') != NULL) {
+    silL_gsub(L, s, ";", ",");
+    sil_remove(L, -2);  /* remove original name */
+  }
+}
+
+
+/*
+** Hook set by the signal handler: count one more sample of the
+** current stack.
+*/
+static void profhook (sil_State *L, sil_Debug *ar) {
+  sil_Debug far;
+  int depth, level;
+  sil_Integer count;
+  UNUSED(ar);
+  sil_sethook(L, oldhook, oldmask, oldcount);  /* put back previous hook */
+  for (depth = 0; depth < SIL_PROFMAXDEPTH; depth++) {
+    if (!sil_getstack(L, depth, &far))
+      break;
+  }
+  silL_checkstack(L, 2 * depth + 4, "too many frames to sample");
+  if (depth == SIL_PROFMAXDEPTH && sil_getstack(L, depth, &far))
+    sil_pushliteral(L, "...;");  /* stack was truncated */
+  else
+    sil_pushliteral(L, "");
+  for (level = depth - 1; level >= 0; level--) {
+    sil_getstack(L, level, &far);
+    pushframe(L, &far);
+    if (level > 0)
+      sil_pushliteral(L, ";");
+  }
+  sil_concat(L, 2 * depth);  /* folded stack */
+  if (sil_getfield(L, SIL_REGISTRYINDEX, PROFSAMPLES) != SIL_TTABLE) {
+    sil_pop(L, 2);  /* samples were removed; ignore this one */
+    return;
+  }
+  sil_pushvalue(L, -2);
+  sil_rawget(L, -2);
+  count = sil_tointeger(L, -1) + 1;
+  sil_pop(L, 1);
+  sil_pushvalue(L, -2);
+  sil_pushinteger(L, count);
+  sil_rawset(L, -3);
+  sil_pop(L, 2);  /* table and folded stack */
+}
+
+
+/*
+** Signal handler for SIGPROF: ask for a sample at the next
+** instruction, unless one is already pending.
+*/
+static void profsignal (int i) {
+  sil_State *L = profL;
+  UNUSED(i);
+  if (L != NULL && sil_gethook(L) != profhook) {
+    oldhook = sil_gethook(L);
+    oldmask = sil_gethookmask(L);
+    oldcount = sil_gethookcount(L);
+    sil_sethook(L, profhook, SIL_MASKCALL | SIL_MASKRET | SIL_MASKCOUNT, 1);
+  }
+}
+
+
+static int settimer (sil_Integer hz) {
+  struct itimerval tv;
+  tv.it_interval.tv_sec = 0;
+  tv.it_interval.tv_usec = (hz > 0) ? cast(long, 1000000 / hz) : 0;
+  tv.it_value = tv.it_interval;
+  return setitimer(ITIMER_PROF, &tv, NULL);
+}
+
+
+static void stopprofiler (void) {
+  sil_State *L = profL;
+  settimer(0);
+  sigaction(SIGPROF, &oldaction, NULL);
+  profL = NULL;
+  if (sil_gethook(L) == profhook)  /* sample still pending? */
+    sil_sethook(L, oldhook, oldmask, oldcount);
+}
+
+
+static int prof_start (sil_State *L) {
+  sil_Integer hz = silL_optinteger(L, 1, SIL_PROFHZ);
+  struct sigaction sa;
+  sil_State *mainL;
+  silL_argcheck(L, 0 < hz && hz <= 1000000, 1, "rate out of range");
+  if (profL != NULL)
+    return silL_error(L, "profiler is already running");
+  sil_newtable(L);  /* start with no samples */
+  sil_setfield(L, SIL_REGISTRYINDEX, PROFSAMPLES);
+  sil_rawgeti(L, SIL_REGISTRYINDEX, SIL_RIDX_MAINTHREAD);
+  mainL = sil_tothread(L, -1);
+  sil_pop(L, 1);
+  sa.sa_handler = profsignal;
+  sa.sa_flags = SA_RESTART;  /* do not interrupt I/O */
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, &oldaction);
+  profL = mainL;
+  if (settimer(hz) != 0) {
+    stopprofiler();
+    return silL_error(L, "cannot start profiler timer");
+  }
+  sil_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int prof_stop (sil_State *L) {
+  sil_Integer total = 0;
+  if (profL != NULL)
+    stopprofiler();
+  if (sil_getfield(L, SIL_REGISTRYINDEX, PROFSAMPLES) == SIL_TTABLE) {
+    sil_pushnil(L);
+    while (sil_next(L, -2)) {
+      total += sil_tointeger(L, -1);
+      sil_pop(L, 1);
+    }
+  }
+  sil_pushinteger(L, total);  /* number of samples */
+  return 1;
+}
+
+
+/* stop the profiler when its state is closed */
+static int prof_gc (sil_State *L) {
+  sil_State *mainL;
+  sil_rawgeti(L, SIL_REGISTRYINDEX, SIL_RIDX_MAINTHREAD);
+  mainL = sil_tothread(L, -1);
+  if (profL != NULL && profL == mainL)
+    stopprofiler();
+  return 0;
+}
+
+#else				/* }{ */
+
+static int prof_start (sil_State *L) {
+  return silL_error(L, "profiler not supported on this platform");
+}
+
+
+static int prof_stop (sil_State *L) {
+  sil_pushinteger(L, 0);
+  return 1;
+}
+
+
+static int prof_gc (sil_State *L) {
+  UNUSED(L);
+  return 0;
+}
+
+#endif				/* } */
+
+
+/*
+** Return the samples collected by the last run as folded stacks, one
+** per line, followed by a space and the number of times it was seen.
+*/
+static int prof_folded (sil_State *L) {
+  silL_Buffer b;
+  sil_Integer n = 0, i;
+  if (sil_getfield(L, SIL_REGISTRYINDEX, PROFSAMPLES) != SIL_TTABLE) {
+    sil_pushliteral(L, "");
+    return 1;
+  }
+  sil_newtable(L);  /* lines of the result */
+  sil_pushnil(L);
+  while (sil_next(L, -3)) {
+    sil_pushfstring(L, "%s %I\n", sil_tostring(L, -2), sil_tointeger(L, -1));
+    sil_rawseti(L, -4, ++n);
+    sil_pop(L, 1);  /* remove count */
+  }
+  silL_buffinit(L, &b);
+  for (i = 1; i <= n; i++) {
+    sil_rawgeti(L, -2, i);
+    silL_addvalue(&b);
+  }
+  silL_pushresult(&b);
+  return 1;
+}
+
+
+static const silL_Reg prof_funcs[] = {
+  {"start", prof_start},
+  {"stop", prof_stop},
+  {"folded", prof_folded},
+  {NULL, NULL}
+};
+
+
+SILMOD_API int silopen_profiler (sil_State *L) {
+  silL_newlib(L, prof_funcs);
+  sil_newuserdatauv(L, 0, 0);  /* sentinel to stop profiler at close */
+  sil_createtable(L, 0, 1);
+  sil_pushcfunction(L, prof_gc);
+  sil_setfield(L, -2, "__gc");
+  sil_setmetatable(L, -2);
+  sil_setfield(L, SIL_REGISTRYINDEX, PROFSENTINEL);
+  return 1;
+}
+
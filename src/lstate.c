@@ -212,6 +212,10 @@ static void f_silopen (sil_State *L, void *ud) {
   silS_init(L);
   silT_init(L);
   silX_init(L);
+#if SIL_USE_OPSTATS
+  g->opstats = silM_new(L, OpStats);
+  silG_resetopstats(g->opstats);
+#endif
   g->gcstp = 0;  /* allow gc */
   setnilvalue(&g->nilvalue);  /* now state is complete */
   sili_userstateopen(L);
@@ -264,6 +268,11 @@ static void close_state (sil_State *L) {
     sili_userstateclose(L);
   }
   silM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
+  silH_sweepshapes(L, 1);
+  if (g->opstats != NULL)
+    silM_free(L, g->opstats);
+  silC_setmarkthreads(L, 0);  /* stop helper threads, if any */
+  silC_setbgsweep(L, 0);  /* stop the sweeper thread, if any */
   freestack(L);
   sil_assert(gettotalbytes(g) == sizeof(global_State));
   (*g->frealloc)(g->ud, g, sizeof(global_State), 0);  /* free main block */
@@ -368,8 +377,15 @@ SIL_API sil_State *sil_newstate (sil_Alloc f, void *ud, unsigned seed) {
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->opstats = NULL;
+  g->gcpar = NULL;
+  g->gcmarkthreads = -1;
+  g->gcsweeper = NULL;
+  memset(&g->gcstats, 0, sizeof(g->gcstats));
+  g->gcphase = -1;
   g->GCtotalbytes = sizeof(global_State);
   g->GCmarked = 0;
+  g->GCtosweep = 0;
   g->GCdebt = 0;
   setivalue(&g->nilvalue, 0);  /* to signal that state is not yet built */
   setgcparam(g, PAUSE, SILI_GCPAUSE);
@@ -379,6 +395,11 @@ SIL_API sil_State *sil_newstate (sil_Alloc f, void *ud, unsigned seed) {
   setgcparam(g, MINORMAJOR, SILI_MINORMAJOR);
   setgcparam(g, MAJORMINOR, SILI_MAJORMINOR);
   for (i=0; i < SIL_NUMTYPES; i++) g->mt[i] = NULL;
+  for (i=0; i < SIL_NUMBUILTINS; i++) g->builtin[i] = NULL;
+  g->arraymt = NULL;
+  g->rootshape.parent = g->rootshape.kids = g->rootshape.next = NULL;
+  g->rootshape.refs = 0;
+  g->rootshape.nkids = g->rootshape.nkeys = 0;
   if (silD_rawrunprotected(L, f_silopen, NULL) != SIL_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
@@ -335,6 +335,7 @@ typedef struct global_State {
   l_mem GCdebt;  /* bytes counted but not yet allocated */
   l_mem GCmarked;  /* number of objects marked in a GC cycle */
   l_mem GCmajorminor;  /* auxiliary counter to control major-minor shifts */
+  l_mem GCtosweep;  /* number of bytes still to be swept in a GC cycle */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
@@ -372,6 +373,16 @@ typedef struct global_State {
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
   sil_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
+  sil_CFunction builtin[SIL_NUMBUILTINS];  /* see 'sil_setbuiltin' */
+  struct Table *arraymt;  /* metatable of typed arrays (see 'larray.h') */
+  Shape rootshape;  /* shape with no keys (root of all shapes) */
+  struct OpStats *opstats;  /* opcode statistics (see 'SIL_USE_OPSTATS') */
+  struct GCPar *gcpar;  /* parallel marking (see 'SIL_USE_PARALLELGC') */
+  int gcmarkthreads;  /* number of helpers for marking (-1: automatic) */
+  struct GCSweeper *gcsweeper;  /* background sweeping (NULL: off) */
+  sil_GCStats gcstats;  /* collector statistics (see 'SIL_GCSTATS') */
+  sil_Number gcphstart;  /* when phase 'gcphase' started */
+  int gcphase;  /* phase being timed (-1 if none) */
   LX mainth;  /* main thread of this state */
 } global_State;
 
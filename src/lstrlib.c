@@ -159,6 +159,52 @@ static int str_rep (sil_State *L) {
 }
 
 
+/*
+** string.join(t, [sep]): the strings (or numbers) t[1], ..., t[#t]
+** separated by 'sep'. Unlike 'table.concat', it uses raw accesses, so
+** that it can add up the final length before building the result in
+** a buffer of that exact size.
+*/
+static int str_join (sil_State *L) {
+  size_t lsep, total = 0;
+  const char *sep = silL_optlstring(L, 2, "", &lsep);
+  sil_Integer n, i;
+  silL_Buffer b;
+  char *buff;
+  silL_checktype(L, 1, SIL_TTABLE);
+  n = l_castU2S(sil_rawlen(L, 1));
+  for (i = 1; i <= n; i++) {  /* compute total length */
+    size_t l;
+    sil_rawgeti(L, 1, i);
+    if (l_unlikely(!sil_isstring(L, -1)))
+      return silL_error(L, "invalid value (%s) at index %I in table for "
+                           "'join'", silL_typename(L, -1), (SILI_UACINT)i);
+    sil_tolstring(L, -1, &l);
+    sil_pop(L, 1);
+    if (i < n)
+      l += lsep;  /* (both are in memory, so this cannot overflow) */
+    if (l_unlikely(l > MAX_SIZE - total))
+      return silL_error(L, "resulting string too large");
+    total += l;
+  }
+  buff = silL_buffinitsize(L, &b, total);
+  for (i = 1; i <= n; i++) {  /* copy pieces */
+    size_t l;
+    const char *piece;
+    sil_rawgeti(L, 1, i);
+    piece = sil_tolstring(L, -1, &l);
+    memcpy(buff, piece, l * sizeof(char)); buff += l;
+    sil_pop(L, 1);
+    if (i < n && lsep > 0) {
+      memcpy(buff, sep, lsep * sizeof(char));
+      buff += lsep;
+    }
+  }
+  silL_pushresultsize(&b, total);
+  return 1;
+}
+
+
 static int str_byte (sil_State *L) {
   size_t l;
   const char *s = silL_checklstring(L, 1, &l);
@@ -353,6 +399,7 @@ typedef struct MatchState {
   sil_State *L;
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   int level;  /* total number of captures (finished or unfinished) */
+  const struct PatProg *prog;  /* compiled pattern (NULL if none) */
   struct {
     const char *init;
     ptrdiff_t len;  /* length or special value (CAP_*) */
@@ -458,30 +505,30 @@ static int matchbracketclass (int c, const char *p, const char *ec) {
 }
 
 
+/* does char 'c' match the single-char class 'p' (ending at 'ep')? */
+static int classmatch (int c, const char *p, const char *ep) {
+  switch (*p) {
+    case '.': return 1;  /* matches any char */
+    case L_ESC: return match_class(c, cast_uchar(*(p+1)));
+    case '[': return matchbracketclass(c, p, ep-1);
+    default:  return (cast_uchar(*p) == c);
+  }
+}
+
+
 static int singlematch (MatchState *ms, const char *s, const char *p,
                         const char *ep) {
   if (s >= ms->src_end)
     return 0;
-  else {
-    int c = cast_uchar(*s);
-    switch (*p) {
-      case '.': return 1;  /* matches any char */
-      case L_ESC: return match_class(c, cast_uchar(*(p+1)));
-      case '[': return matchbracketclass(c, p, ep-1);
-      default:  return (cast_uchar(*p) == c);
-    }
-  }
+  else
+    return classmatch(cast_uchar(*s), p, ep);
 }
 
 
-static const char *matchbalance (MatchState *ms, const char *s,
-                                   const char *p) {
-  if (l_unlikely(p >= ms->p_end - 1))
-    silL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
-  if (*s != *p) return NULL;
+/* match a balanced string '%bxy' (with 'x' == 'b' and 'y' == 'e') */
+static const char *balance (MatchState *ms, const char *s, char b, char e) {
+  if (*s != b) return NULL;
   else {
-    int b = *p;
-    int e = *(p+1);
     int cont = 1;
     while (++s < ms->src_end) {
       if (*s == e) {
@@ -494,6 +541,14 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+  if (l_unlikely(p >= ms->p_end - 1))
+    silL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+  return balance(ms, s, *p, *(p+1));
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -661,12 +716,99 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** {======================================================
+** Substring search
+** =======================================================
+*/
+
+#if defined(__GNUC__) && defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define VECSIZE		32
+typedef __m256i Vec;
+#define vecload(p)	_mm256_loadu_si256(cast(const __m256i *, (p)))
+#define vecset(c)	_mm256_set1_epi8(c)
+#define veceqmask(a,b,c,d)  cast_uint(_mm256_movemask_epi8( \
+	_mm256_and_si256(_mm256_cmpeq_epi8(a, b), _mm256_cmpeq_epi8(c, d))))
+
+#elif defined(__GNUC__) && defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define VECSIZE		16
+typedef __m128i Vec;
+#define vecload(p)	_mm_loadu_si128(cast(const __m128i *, (p)))
+#define vecset(c)	_mm_set1_epi8(c)
+#define veceqmask(a,b,c,d)  cast_uint(_mm_movemask_epi8( \
+	_mm_and_si128(_mm_cmpeq_epi8(a, b), _mm_cmpeq_epi8(c, d))))
+
+#endif
+
+
+#if defined(VECSIZE)
+
+/*
+** Find 's2' in 's1' comparing its first and last chars against
+** 2*VECSIZE consecutive positions of 's1' at once; only positions where
+** both match are checked with 'memcmp' (W. Mula's "SIMD-friendly
+** algorithms for substring searching"). Unlike the 'memchr' loop in
+** 'lmemfind', this does not slow down on subjects full of the first
+** char of 's2'. Assume 2 <= l2 <= l1. Return the match or NULL; if
+** the scan stops before the end of 's1', set '*next' to the first
+** position not yet checked.
+*/
+static const char *vecfind (const char *s1, size_t l1,
+                            const char *s2, size_t l2, const char **next) {
+  const Vec first = vecset(s2[0]);
+  const Vec last = vecset(s2[l2 - 1]);
+  size_t n = l1 - l2 + 1;  /* number of positions to check */
+  size_t i;
+  for (i = 0; i + 2 * VECSIZE <= n; i += 2 * VECSIZE) {  /* 2 blocks */
+    const char *e = s1 + i + l2 - 1;  /* ends of candidates */
+    unsigned m0 = veceqmask(first, vecload(s1 + i), last, vecload(e));
+    unsigned m1 = veceqmask(first, vecload(s1 + i + VECSIZE),
+                            last, vecload(e + VECSIZE));
+    size_t base = i;
+    while ((m0 | m1) != 0) {
+      size_t pos;
+      if (m0 == 0) {  /* go to second block */
+        m0 = m1; m1 = 0;
+        base += VECSIZE;
+      }
+      pos = base + cast_uint(__builtin_ctz(m0));
+      if (memcmp(s1 + pos + 1, s2 + 1, l2 - 2) == 0)
+        return s1 + pos;
+      m0 &= m0 - 1;  /* clear that position */
+    }
+  }
+  *next = s1 + i;
+  return NULL;
+}
+
+#endif
+
+
+/*
+** Number of false candidates found by 'memchr' after which 'lmemfind'
+** switches to 'vecfind': 'memchr' is the fastest way to skip to a rare
+** first char, but it slows down when that char is frequent.
+*/
+#if !defined(MAXMEMCHRMISSES)
+#define MAXMEMCHRMISSES		8
+#endif
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
   else {
-    const char *init;  /* to search for a '*s2' inside 's1' */
+    const char *init = NULL;  /* to search for a '*s2' inside 's1' */
+#if defined(VECSIZE)
+    int misses = 0;  /* false candidates found by 'memchr' */
+#endif
     l2--;  /* 1st char will be checked by 'memchr' */
     l1 = l1-l2;  /* 's2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
@@ -677,11 +819,541 @@ static const char *lmemfind (const char *s1, size_t l1,
         l1 -= ct_diff2sz(init - s1);
         s1 = init;
       }
+#if defined(VECSIZE)
+      if (++misses == MAXMEMCHRMISSES && l2 >= 1 && l1 >= 2 * VECSIZE) {
+        /* 1st char is frequent; filter the rest with 'vecfind' */
+        const char *res = vecfind(s1, l1 + l2, s2, l2 + 1, &init);
+        if (res != NULL)
+          return res;
+        l1 -= ct_diff2sz(init - s1);  /* check the remaining tail */
+        s1 = init;
+      }
+#endif
     }
     return NULL;  /* not found */
   }
 }
 
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** COMPILED PATTERNS
+** =======================================================
+*/
+
+/*
+** 'find', 'match', 'gmatch' and 'gsub' compile their patterns into a
+** vector of items, which 'pmatch' runs following the same steps as
+** 'match' but without re-parsing the pattern. Each single-char class
+** becomes a 256-bit set, computed with 'classmatch' itself so that it
+** keeps its meaning, and runs of plain chars become one literal, which
+** also lets the search skip ahead to where a match can start.
+** Compiled patterns are cached in a registry table, keyed by the
+** pattern string. (Sets are computed with the locale current when the
+** pattern is compiled; changing the locale does not flush the cache.)
+** A pattern with an error that 'match' would only raise when reaching
+** it (e.g. '%b' with no arguments) is cached as 'false' and always
+** interpreted, so that it fails exactly as before.
+*/
+
+
+/* key in the registry for the cache of compiled patterns */
+#define PATCACHE	"_PATCACHE"
+
+/* maximum number of patterns in the cache before it is flushed */
+#if !defined(PATCACHESIZE)
+#define PATCACHESIZE	128
+#endif
+
+/* longer patterns are not compiled */
+#if !defined(MAXPATCOMPILE)
+#define MAXPATCOMPILE	256
+#endif
+
+
+/* kinds of items */
+#define PI_END		0	/* end of pattern */
+#define PI_CHAR		1	/* one char ('c') */
+#define PI_ANY		2	/* '.' */
+#define PI_SET		3	/* other single-char class ('set') */
+#define PI_LIT		4	/* plain chars ('lit', 'len'), with no suffix */
+#define PI_OPEN		5	/* '(' ('c' true for a position capture) */
+#define PI_CLOSE	6	/* ')' */
+#define PI_EOS		7	/* final '$' */
+#define PI_BAL		8	/* '%b' ('c', 'c2') */
+#define PI_FRONT	9	/* '%f' ('set') */
+#define PI_BACKREF	10	/* '%1'-'%9' ('c' is the capture index) */
+
+
+typedef struct PatItem {
+  lu_byte kind;
+  char suffix;  /* for single-char classes: '*', '+', '?', '-' or 0 */
+  char c, c2;
+  unsigned int len;  /* length of a literal */
+  union {
+    const lu_byte *set;  /* 32 bytes */
+    const char *lit;
+  } u;
+} PatItem;
+
+
+typedef struct PatProg {
+  int anchor;  /* pattern starts with '^' (not part of 'items') */
+  int first;  /* index of first item that consumes chars */
+  PatItem items[1];  /* variable size, ends with PI_END */
+} PatProg;
+
+
+#define inset(set,c)	((set)[cast_uchar(c) >> 3] & (1u << (cast_uchar(c) & 7)))
+
+
+/* state of the compiler */
+typedef struct CompState {
+  PatProg *pr;  /* program being built (NULL when only counting) */
+  lu_byte *extra;  /* space for sets and literals after the items */
+  int nitems;  /* number of items */
+  size_t nextra;  /* size of sets and literals */
+  int level;  /* number of captures opened so far */
+  lu_byte open[SIL_MAXCAPTURES];  /* whether each capture is still open */
+  PatItem scratch;  /* sink for items when only counting */
+} CompState;
+
+
+static PatItem *newitem (CompState *cs, int kind) {
+  PatItem *it = (cs->pr != NULL) ? &cs->pr->items[cs->nitems] : &cs->scratch;
+  cs->nitems++;
+  it->kind = cast_byte(kind);
+  it->suffix = 0;
+  it->c = it->c2 = 0;
+  it->len = 0;
+  it->u.lit = NULL;
+  return it;
+}
+
+
+/* reserve 'sz' bytes of extra space (NULL when only counting) */
+static lu_byte *newextra (CompState *cs, size_t sz) {
+  lu_byte *e = (cs->pr != NULL) ? cs->extra + cs->nextra : NULL;
+  cs->nextra += sz;
+  return e;
+}
+
+
+static const lu_byte *newset (CompState *cs, const char *p, const char *ep) {
+  lu_byte *set = newextra(cs, 32);
+  if (set != NULL) {
+    int c;
+    memset(set, 0, 32);
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      if (classmatch(c, p, ep))
+        set[c >> 3] |= cast_byte(1u << (c & 7));
+    }
+  }
+  return set;
+}
+
+
+/* same as 'classend', but returns NULL for a malformed class */
+static const char *cclassend (const char *p, const char *pend) {
+  switch (*p++) {
+    case L_ESC: {
+      return (p == pend) ? NULL : p+1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == pend)
+          return NULL;
+        if (*(p++) == L_ESC && p < pend)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+/*
+** Compile pattern 'p' (without its anchor) into 'cs'. Return false if
+** the pattern has an error that would only show up when matching.
+** Captures are numbered statically, so 'check_capture' and
+** 'capture_to_close' cannot fail on a compiled pattern.
+*/
+static int compile (CompState *cs, const char *p, const char *pend) {
+  PatItem *lit = NULL;  /* literal being built */
+  while (p < pend) {
+    PatItem *it;
+    switch (*p) {
+      case '(': {
+        if (cs->level >= SIL_MAXCAPTURES)
+          return 0;  /* too many captures */
+        it = newitem(cs, PI_OPEN);
+        it->c = (*(p + 1) == ')');  /* position capture? */
+        cs->open[cs->level++] = !it->c;
+        p += (it->c) ? 2 : 1;
+        break;
+      }
+      case ')': {
+        int l = cs->level - 1;
+        while (l >= 0 && !cs->open[l]) l--;
+        if (l < 0)
+          return 0;  /* invalid pattern capture */
+        cs->open[l] = 0;
+        newitem(cs, PI_CLOSE);
+        p++;
+        break;
+      }
+      case '$': {
+        if ((p + 1) != pend)  /* is the '$' the last char in pattern? */
+          goto dflt;  /* no; go to default */
+        newitem(cs, PI_EOS);
+        p++;
+        break;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= pend - 1)
+              return 0;  /* missing arguments to '%b' */
+            it = newitem(cs, PI_BAL);
+            it->c = *(p + 2);
+            it->c2 = *(p + 3);
+            p += 4;
+            break;
+          }
+          case 'f': {
+            const char *ep;
+            p += 2;
+            if (*p != '[' || (ep = cclassend(p, pend)) == NULL)
+              return 0;  /* malformed frontier */
+            it = newitem(cs, PI_FRONT);
+            it->u.set = newset(cs, p, ep);
+            p = ep;
+            break;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            int l = *(p + 1) - '1';
+            if (l < 0 || l >= cs->level || cs->open[l])
+              return 0;  /* invalid capture index */
+            it = newitem(cs, PI_BACKREF);
+            it->c = cast_char(l);
+            p += 2;
+            break;
+          }
+          default: goto dflt;
+        }
+        break;
+      }
+      default: dflt: {  /* pattern class plus optional suffix */
+        const char *ep = cclassend(p, pend);
+        char suffix = 0;
+        if (ep == NULL)
+          return 0;  /* malformed class */
+        if (ep < pend && (*ep == '*' || *ep == '+' || *ep == '?' ||
+                          *ep == '-'))
+          suffix = *ep;
+        if (suffix == 0 && ep == p + 1 && *p != '.') {  /* plain char? */
+          lu_byte *c = newextra(cs, 1);
+          if (c != NULL) *c = cast_byte(*p);
+          if (lit == NULL) {  /* start a new literal? */
+            lit = newitem(cs, PI_LIT);
+            lit->u.lit = cast_charp(c);
+          }
+          lit->len++;
+          p = ep;
+          continue;  /* keep building the literal */
+        }
+        if (ep == p + 1)
+          it = newitem(cs, (*p == '.') ? PI_ANY : PI_CHAR);
+        else {
+          it = newitem(cs, PI_SET);
+          it->u.set = newset(cs, p, ep);
+        }
+        it->c = *p;
+        it->suffix = suffix;
+        p = ep + (suffix != 0);
+        break;
+      }
+    }
+    lit = NULL;  /* any other item ends the literal */
+  }
+  newitem(cs, PI_END);
+  return 1;
+}
+
+
+/*
+** Compile the pattern at index 'arg' and push the result: a userdata
+** with its program, or false if it cannot be compiled.
+*/
+static void newprog (sil_State *L, int arg) {
+  size_t lp;
+  const char *p = sil_tolstring(L, arg, &lp);
+  const char *pend = p + lp;
+  int anchor = (*p == '^');
+  CompState cs;
+  size_t sz;
+  if (anchor) p++;
+  memset(&cs, 0, sizeof(cs));
+  if (lp > MAXPATCOMPILE || !compile(&cs, p, pend)) {  /* first pass */
+    sil_pushboolean(L, 0);
+    return;
+  }
+  sz = offsetof(PatProg, items) + cast_sizet(cs.nitems) * sizeof(PatItem);
+  cs.pr = cast(PatProg *, sil_newuserdatauv(L, sz + cs.nextra, 0));
+  cs.extra = cast(lu_byte *, cs.pr) + sz;
+  cs.nitems = 0; cs.nextra = 0; cs.level = 0;
+  compile(&cs, p, pend);  /* second pass fills the program */
+  cs.pr->anchor = anchor;
+  for (cs.pr->first = 0; cs.pr->items[cs.pr->first].kind == PI_OPEN;
+       cs.pr->first++) ;  /* skip captures at the start */
+}
+
+
+/*
+** Push the compiled form of the pattern at index 'arg' (or false) and
+** return its program, or NULL if it must be interpreted. The value
+** stays on the stack to anchor the program while it is in use.
+*/
+static const PatProg *getprog (sil_State *L, int arg) {
+  if (sil_getfield(L, SIL_REGISTRYINDEX, PATCACHE) != SIL_TTABLE) {
+    sil_pop(L, 1);
+    sil_createtable(L, 1, PATCACHESIZE);
+    sil_pushvalue(L, -1);
+    sil_setfield(L, SIL_REGISTRYINDEX, PATCACHE);
+  }
+  sil_pushvalue(L, arg);
+  if (sil_rawget(L, -2) == SIL_TNIL) {  /* not in the cache? */
+    sil_Integer n;
+    sil_pop(L, 1);
+    sil_rawgeti(L, -1, 1);  /* cache keeps its number of entries at [1] */
+    n = sil_tointeger(L, -1) + 1;
+    sil_pop(L, 1);
+    if (n > PATCACHESIZE) {  /* cache is full? */
+      sil_pop(L, 1);
+      sil_createtable(L, 1, PATCACHESIZE);  /* start a new one */
+      sil_pushvalue(L, -1);
+      sil_setfield(L, SIL_REGISTRYINDEX, PATCACHE);
+      n = 1;
+    }
+    sil_pushinteger(L, n);
+    sil_rawseti(L, -2, 1);
+    newprog(L, arg);
+    sil_pushvalue(L, arg);
+    sil_pushvalue(L, -2);
+    sil_rawset(L, -4);  /* cache[pattern] = program */
+  }
+  sil_remove(L, -2);  /* remove cache */
+  return cast(const PatProg *, sil_touserdata(L, -1));
+}
+
+
+static const char *pmatch (MatchState *ms, const char *s, const PatItem *it);
+
+
+/* does the single-char class 'it' match at 's'? */
+static int psinglematch (MatchState *ms, const char *s, const PatItem *it) {
+  if (s >= ms->src_end)
+    return 0;
+  switch (it->kind) {
+    case PI_ANY: return 1;
+    case PI_CHAR: return (*s == it->c);
+    default: return inset(it->u.set, *s);
+  }
+}
+
+
+static const char *pmax_expand (MatchState *ms, const char *s,
+                                const PatItem *it) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  ptrdiff_t n = ms->src_end - s;
+  switch (it->kind) {
+    case PI_ANY: i = n; break;
+    case PI_CHAR: while (i < n && s[i] == it->c) i++; break;
+    default: while (i < n && inset(it->u.set, s[i])) i++; break;
+  }
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = pmatch(ms, (s+i), it+1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *pmin_expand (MatchState *ms, const char *s,
+                                const PatItem *it) {
+  for (;;) {
+    const char *res = pmatch(ms, s, it+1);
+    if (res != NULL)
+      return res;
+    else if (psinglematch(ms, s, it))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *pstart_capture (MatchState *ms, const char *s,
+                                   const PatItem *it, int what) {
+  const char *res;
+  int level = ms->level;
+  sil_assert(level < SIL_MAXCAPTURES);  /* checked by 'compile' */
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=pmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *pend_capture (MatchState *ms, const char *s,
+                                 const PatItem *it) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = pmatch(ms, s, it)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+/* same as 'match', over a compiled pattern */
+static const char *pmatch (MatchState *ms, const char *s, const PatItem *it) {
+  if (l_unlikely(ms->matchdepth-- == 0))
+    silL_error(ms->L, "pattern too complex");
+  init: /* using goto to optimize tail recursion */
+  switch (it->kind) {
+    case PI_END: break;
+    case PI_LIT: {
+      if (cast_sizet(ms->src_end - s) >= it->len &&
+          memcmp(s, it->u.lit, it->len) == 0) {
+        s += it->len; it++; goto init;
+      }
+      s = NULL;  /* fail */
+      break;
+    }
+    case PI_OPEN: {
+      s = pstart_capture(ms, s, it + 1, it->c ? CAP_POSITION
+                                              : CAP_UNFINISHED);
+      break;
+    }
+    case PI_CLOSE: {
+      s = pend_capture(ms, s, it + 1);
+      break;
+    }
+    case PI_EOS: {
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    }
+    case PI_BAL: {
+      s = balance(ms, s, it->c, it->c2);
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    case PI_FRONT: {
+      char previous = (s == ms->src_init) ? '\0' : *(s - 1);
+      if (!inset(it->u.set, previous) && inset(it->u.set, *s)) {
+        it++; goto init;
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case PI_BACKREF: {
+      s = match_capture(ms, s, it->c + '1');
+      if (s != NULL) {
+        it++; goto init;
+      }
+      break;
+    }
+    default: {  /* single-char class plus optional suffix */
+      if (!psinglematch(ms, s, it)) {  /* does not match at least once? */
+        if (it->suffix == '*' || it->suffix == '?' || it->suffix == '-') {
+          it++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (it->suffix) {  /* handle optional suffix */
+          case '?': {  /* optional */
+            const char *res;
+            if ((res = pmatch(ms, s + 1, it + 1)) != NULL)
+              s = res;
+            else {
+              it++; goto init;
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = pmax_expand(ms, s, it);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = pmin_expand(ms, s, it);
+            break;
+          default:  /* no suffix */
+            s++; it++; goto init;
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth++;
+  return s;
+}
+
+
+/*
+** Return the first position from 's' on where a match of the
+** (unanchored) compiled pattern can start, or the end of the subject
+** if there is none: the first item that consumes chars must match
+** there.
+*/
+static const char *skipto (MatchState *ms, const char *s) {
+  const PatItem *it = &ms->prog->items[ms->prog->first];
+  const char *e = ms->src_end;
+  switch (it->kind) {
+    case PI_LIT: {
+      const char *r = lmemfind(s, ct_diff2sz(e - s), it->u.lit, it->len);
+      return (r != NULL) ? r : e;
+    }
+    case PI_CHAR: case PI_SET: {
+      if (it->suffix != 0 && it->suffix != '+')
+        break;  /* item can match the empty string */
+      if (it->kind == PI_CHAR) {
+        const char *r = cast_charp(memchr(s, it->c, ct_diff2sz(e - s)));
+        return (r != NULL) ? r : e;
+      }
+      while (s < e && !inset(it->u.set, *s)) s++;
+      return s;
+    }
+    default: break;
+  }
+  return s;
+}
+
+
+/* match at 's', with the compiled pattern if there is one */
+#define domatch(ms,s,p)  \
+	((ms)->prog ? pmatch(ms, s, (ms)->prog->items) : match(ms, s, p))
+
+/* }====================================================== */
+
+
 
 /*
 ** get information about the i-th capture. If there are no captures
@@ -753,6 +1425,7 @@ static void prepstate (MatchState *ms, sil_State *L,
   ms->src_init = s;
   ms->src_end = s + ls;
   ms->p_end = p + lp;
+  ms->prog = NULL;
 }
 
 
@@ -789,10 +1462,13 @@ static int str_find_aux (sil_State *L, int find) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
+    ms.prog = getprog(L, 2);
     do {
       const char *res;
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if (ms.prog != NULL && !anchor)
+        s1 = skipto(&ms, s1);
+      if ((res=domatch(&ms, s1, p)) != NULL) {
         if (find) {
           sil_pushinteger(L, ct_diff2S(s1 - s) + 1);  /* start */
           sil_pushinteger(L, ct_diff2S(res - s));   /* end */
@@ -828,13 +1504,15 @@ typedef struct GMatchState {
 
 
 static int gmatch_aux (sil_State *L) {
-  GMatchState *gm = (GMatchState *)sil_touserdata(L, sil_upvalueindex(3));
+  GMatchState *gm = (GMatchState *)sil_touserdata(L, sil_upvalueindex(4));
   const char *src;
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    if (gm->ms.prog != NULL)
+      src = skipto(&gm->ms, src);
+    if ((e = domatch(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -848,14 +1526,18 @@ static int gmatch (sil_State *L) {
   const char *s = silL_checklstring(L, 1, &ls);
   const char *p = silL_checklstring(L, 2, &lp);
   size_t init = posrelatI(silL_optinteger(L, 3, 1), ls) - 1;
+  const PatProg *prog;
   GMatchState *gm;
   sil_settop(L, 2);  /* keep strings on closure to avoid being collected */
+  prog = getprog(L, 2);  /* and the compiled pattern too */
   gm = (GMatchState *)sil_newuserdatauv(L, sizeof(GMatchState), 0);
   if (init > ls)  /* start after string's end? */
     init = ls + 1;  /* avoid overflows in 's + init' */
   prepstate(&gm->ms, L, s, ls, p, lp);
+  if (prog != NULL && !prog->anchor)  /* ('^' is not an anchor here) */
+    gm->ms.prog = prog;
   gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
-  sil_pushcclosure(L, gmatch_aux, 3);
+  sil_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -944,18 +1626,27 @@ static int str_gsub (sil_State *L) {
   int changed = 0;  /* change flag */
   MatchState ms;
   silL_Buffer b;
+  const PatProg *prog;
   silL_argexpected(L, tr == SIL_TNUMBER || tr == SIL_TSTRING ||
                    tr == SIL_TFUNCTION || tr == SIL_TTABLE, 3,
                       "string/function/table");
+  sil_settop(L, 4);  /* compiled pattern goes to index 5 */
+  prog = getprog(L, 2);
   silL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
   prepstate(&ms, L, src, srcl, p, lp);
+  ms.prog = prog;
   while (n < max_s) {
     const char *e;
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    if (ms.prog != NULL && !anchor) {  /* skip what cannot match */
+      const char *s1 = skipto(&ms, src);
+      silL_addlstring(&b, src, ct_diff2sz(s1 - src));
+      src = s1;
+    }
+    if ((e = domatch(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
       changed = add_value(&ms, &b, src, e, tr) | changed;
       src = lastmatch = e;
@@ -975,6 +1666,86 @@ static int str_gsub (sil_State *L) {
   return 2;
 }
 
+
+/*
+** Find the next (non-empty) match of the separator in 'ms' from 'src'
+** on. Return its start and put its end in '*e', or return NULL if
+** there is none.
+*/
+static const char *nextsep (MatchState *ms, const char *src, const char *p,
+                            const char **e) {
+  for (;;) {
+    reprepstate(ms);
+    if (ms->prog != NULL)
+      src = skipto(ms, src);
+    if ((*e = domatch(ms, src, p)) != NULL && *e != src)
+      return src;
+    else if (src < ms->src_end)
+      src++;  /* empty or no match; try next position */
+    else
+      return NULL;
+  }
+}
+
+
+/*
+** string.split(s, sep [, plain [, limit]]): table with the pieces of
+** 's' between occurrences of 'sep', a pattern unless 'plain' is true
+** or it has no special characters. (Empty matches of a pattern are not
+** separators; '^' has no special meaning.) With 'limit', there are at
+** most 'limit' pieces, the last one holding the rest of 's'. Plain
+** separators are counted first, so that the table is created with its
+** final size.
+*/
+static int str_split (sil_State *L) {
+  size_t ls, lsep;
+  const char *s = silL_checklstring(L, 1, &ls);
+  const char *sep = silL_checklstring(L, 2, &lsep);
+  int plain = sil_toboolean(L, 3) || nospecials(sep, lsep);
+  sil_Integer limit = silL_optinteger(L, 4, SIL_MAXINTEGER);
+  const char *e = s + ls;
+  sil_Integer n = 1;  /* number of pieces */
+  silL_argcheck(L, limit > 0, 4, "out of range");
+  sil_settop(L, 4);
+  if (plain) {
+    const char *p = s;
+    const char *q;
+    silL_argcheck(L, lsep > 0, 2, "empty separator");
+    while (n < limit &&
+           (q = lmemfind(p, ct_diff2sz(e - p), sep, lsep)) != NULL) {
+      n++;  /* count pieces */
+      p = q + lsep;
+    }
+    sil_createtable(L, (n <= INT_MAX) ? cast_int(n) : INT_MAX, 0);
+    limit = n;
+    for (n = 1, p = s; n < limit; n++) {
+      q = lmemfind(p, ct_diff2sz(e - p), sep, lsep);
+      sil_pushlstring(L, p, ct_diff2sz(q - p));
+      sil_rawseti(L, -2, n);
+      p = q + lsep;
+    }
+    sil_pushlstring(L, p, ct_diff2sz(e - p));  /* last piece */
+  }
+  else {
+    MatchState ms;
+    const PatProg *prog = getprog(L, 2);
+    const char *p = s;  /* start of current piece */
+    const char *q, *qe;
+    prepstate(&ms, L, s, ls, sep, lsep);
+    if (prog != NULL && !prog->anchor)  /* ('^' is not an anchor here) */
+      ms.prog = prog;
+    sil_createtable(L, 4, 0);
+    while (n < limit && (q = nextsep(&ms, p, sep, &qe)) != NULL) {
+      sil_pushlstring(L, p, ct_diff2sz(q - p));
+      sil_rawseti(L, -2, n++);
+      p = qe;
+    }
+    sil_pushlstring(L, p, ct_diff2sz(e - p));  /* last piece */
+  }
+  sil_rawseti(L, -2, n);
+  return 1;
+}
+
 /* }====================================================== */
 
 
@@ -1844,11 +2615,13 @@ static const silL_Reg strlib[] = {
   {"format", str_format},
   {"gmatch", gmatch},
   {"gsub", str_gsub},
+  {"join", str_join},
   {"len", str_len},
   {"lower", str_lower},
   {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
+  {"split", str_split},
   {"sub", str_sub},
   {"upper", str_upper},
   {"pack", str_pack},
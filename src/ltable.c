@@ -40,6 +40,11 @@
 #include "lvm.h"
 
 
+#if SIL_USE_SWISS && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
 /*
 ** Only hash parts with at least 2^LIMFORLAST have a 'lastfree' field
 ** that optimizes finding a free slot. That field is stored just before
@@ -50,17 +55,34 @@
 
 /*
 ** The union 'Limbox' stores 'lastfree' and ensures that what follows it
-** is properly aligned to store a Node.
+** is properly aligned to store a Node. It also keeps the old hash part
+** of a table that is being rehashed incrementally (see 'startmigration').
 */
-typedef struct { Node *dummy; Node follows_pNode; } Limbox_aux;
+typedef struct {
+  union {
+    Node *lastfree;
+    unsigned growth;  /* free nodes that can still be used (Swiss layout) */
+  } u;
+  Node *oldnode;  /* old hash part being moved into this one */
+  unsigned moved;  /* number of nodes of 'oldnode' already moved */
+  lu_byte oldlsize;  /* log2 of the size of 'oldnode' */
+} Limfields;
+
+typedef struct { Limfields dummy; Node follows_pNode; } Limbox_aux;
 
 typedef union {
-  Node *lastfree;
+  Limfields f;
   char padding[offsetof(Limbox_aux, follows_pNode)];
 } Limbox;
 
+#if !SIL_USE_SWISS
 #define haslastfree(t)     ((t)->lsizenode >= LIMFORLAST)
-#define getlastfree(t)     ((cast(Limbox *, (t)->node) - 1)->lastfree)
+#else
+#define haslastfree(t)     1
+#endif
+#define getlimbox(t)       (&(cast(Limbox *, (t)->node) - 1)->f)
+#define getlastfree(t)     (getlimbox(t)->u.lastfree)
+#define getgrowth(t)       (getlimbox(t)->u.growth)
 
 
 /*
@@ -119,19 +141,45 @@ typedef union {
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
 
-#define dummynode		(&dummynode_)
-
 /*
 ** Common hash part for tables with empty hash parts. That allows all
 ** tables to have a hash part, avoiding an extra check ("is there a hash
 ** part?") when indexing. Its sole node has an empty value and a key
 ** (DEADKEY, NULL) that is different from any valid TValue.
 */
+#if !SIL_USE_SWISS
+
+#define dummynode		(&dummynode_)
+
 static const Node dummynode_ = {
   {{NULL}, SIL_VEMPTY,  /* value's value and type */
    SIL_TDEADKEY, 0, {NULL}}  /* key type, next, and key value */
 };
 
+#else
+
+/*
+** In the Swiss layout, the dummy node is followed by a group of free
+** control bytes, so that searches need no special case for it.
+*/
+#define GROUPSIZE	16
+#define CTRLEMPTY	0x80
+
+#define dummynode		(&dummynode_.n)
+
+#define CTRL4	CTRLEMPTY, CTRLEMPTY, CTRLEMPTY, CTRLEMPTY
+
+static const struct {
+  Node n;
+  lu_byte ctrl[GROUPSIZE];
+} dummynode_ = {
+  {{{NULL}, SIL_VEMPTY,  /* value's value and type */
+    SIL_TDEADKEY, 0, {NULL}}},  /* key type, next, and key value */
+  {CTRL4, CTRL4, CTRL4, CTRL4}
+};
+
+#endif
+
 
 static const TValue absentkey = {ABSTKEYCONSTANT};
 
@@ -273,12 +321,14 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
 }
 
 
+#if !SIL_USE_SWISS
+
 /*
-** "Generic" get version. (Not that generic: not valid for integers,
-** which may be in array part, nor for floats with integral values.)
+** Search for a key in the hash part 't->node' (but not in an old part).
 ** See explanation about 'deadok' in function 'equalkey'.
 */
-static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
+static const TValue *getgenericpart (Table *t, const TValue *key,
+                                                 int deadok) {
   Node *n = mainpositionTV(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (equalkey(key, n, deadok))
@@ -292,6 +342,271 @@ static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
   }
 }
 
+#else
+
+/*
+** {=============================================================
+** Swiss-table hash part
+** ==============================================================
+** With SIL_USE_SWISS, the hash part is an open-addressing table that
+** is probed in groups of GROUPSIZE nodes. After the node array comes
+** one control byte per node: CTRLEMPTY for a free node, or the top 7
+** bits of the key's hash for a used one. Then come copies of the first
+** GROUPSIZE - 1 control bytes, so that the group starting at any node
+** can be loaded with one unaligned read. A search loads the group at
+** the key's home position, compares all its control bytes with the
+** key's tag at once, checks only the nodes that match, and stops at the
+** first group with a free node. Groups are visited in triangular steps,
+** which cover the whole (power-of-2 sized) table. The home position of
+** a key is its main position in the chained layout (so that keys created
+** in sequence still land close together); its tag comes from a
+** multiplicative hash of the same hash value.
+** As in the chained layout, a removed entry keeps its key (which may
+** become dead) with an empty value until the next rehash, so that
+** 'next' can still find it. So, nodes are never freed; the 'Limbox'
+** keeps how many free nodes can still be used, always leaving at least
+** one free node to stop searches.
+*/
+
+#define getctrl(t)	cast(lu_byte *, gnode(t, sizenode(t)))
+
+/* number of control bytes for a hash part with 'size' nodes */
+#define sizectrl(size)	(cast_sizet(size) + GROUPSIZE - 1)
+
+#define homepos(t,n)	cast_uint((n) - gnode(t, 0))
+
+/* tag of a hash value (its top 7 bits after a Fibonacci hashing) */
+#define hashtag(h)	cast_byte(((h) * 0x9e3779b1u) >> 25)
+
+
+/* number of nodes of a hash part that can be used (7/8 of its size) */
+static unsigned maxgrowth (unsigned size) {
+  return (size < 8) ? size - 1 : size - (size >> 3);
+}
+
+
+#if defined(__SSE2__)
+
+/* mask with the positions in group 'g' whose control byte is 'tag' */
+l_sinline unsigned matchtag (const lu_byte *g, lu_byte tag) {
+  __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, g));
+  __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(cast(char, tag)));
+  return cast_uint(_mm_movemask_epi8(eq));
+}
+
+/* mask with the free positions in group 'g' */
+l_sinline unsigned matchempty (const lu_byte *g) {
+  __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, g));
+  return cast_uint(_mm_movemask_epi8(ctrl));
+}
+
+#else
+
+l_sinline unsigned matchtag (const lu_byte *g, lu_byte tag) {
+  unsigned m = 0;
+  int i;
+  for (i = GROUPSIZE - 1; i >= 0; i--)
+    m = (m << 1) | (g[i] == tag);
+  return m;
+}
+
+l_sinline unsigned matchempty (const lu_byte *g) {
+  return matchtag(g, CTRLEMPTY);
+}
+
+#endif
+
+
+#if defined(__GNUC__)
+#define firstbit(m)	cast_uint(__builtin_ctz(m))
+#else
+static unsigned firstbit (unsigned m) {
+  unsigned i = 0;
+  while (!(m & 1u)) { m >>= 1; i++; }
+  return i;
+}
+#endif
+
+
+l_sinline lu_byte inttag (sil_Integer i) {
+  sil_Unsigned ui = l_castS2U(i);
+  return hashtag(cast_uint(ui ^ (ui >> 31 >> 1)));
+}
+
+
+/*
+** Same as 'mainpositionTV', also computing the tag of the key.
+*/
+static Node *homeTV (const Table *t, const TValue *key, lu_byte *tag) {
+  unsigned h;
+  switch (ttypetag(key)) {
+    case SIL_VNUMINT: {
+      sil_Integer i = ivalue(key);
+      *tag = inttag(i);
+      return hashint(t, i);
+    }
+    case SIL_VNUMFLT:
+      h = l_hashfloat(fltvalue(key));
+      *tag = hashtag(h);
+      return hashmod(t, h);
+    case SIL_VSHRSTR:
+      h = tsvalue(key)->hash;
+      *tag = hashtag(h);
+      return hashpow2(t, h);
+    case SIL_VLNGSTR:
+      h = silS_hashlongstr(tsvalue(key));
+      *tag = hashtag(h);
+      return hashpow2(t, h);
+    case SIL_VFALSE: case SIL_VTRUE:
+      h = ttistrue(key);
+      *tag = hashtag(h);
+      return hashboolean(t, h);
+    case SIL_VLIGHTUSERDATA:
+      h = point2uint(pvalue(key));
+      break;
+    case SIL_VLCF:
+      h = point2uint(fvalue(key));
+      break;
+    default:
+      h = point2uint(gcvalue(key));
+      break;
+  }
+  *tag = hashtag(h);  /* pointers */
+  return hashmod(t, h);
+}
+
+
+/*
+** Set the control byte of node 'i', and its copies at the end of
+** the control bytes.
+*/
+static void setctrl (Table *t, unsigned i, lu_byte c) {
+  lu_byte *ctrl = getctrl(t);
+  unsigned size = sizenode(t);
+  ctrl[i] = c;
+  for (i += size; i < size + GROUPSIZE - 1; i += size)
+    ctrl[i] = c;
+}
+
+
+/*
+** Search for a key with the given home node and tag in the hash part.
+** 'found' is an expression on node 'n' that tells whether it has the
+** key.
+*/
+#define swisssearch(t,home,tag,n,found)  \
+  { unsigned mask_ = sizenode(t) - 1u;  \
+    unsigned i_ = homepos(t, home), step_ = 0;  \
+    lu_byte tag_ = (tag);  \
+    for (;;) {  \
+      const lu_byte *g_ = getctrl(t) + i_;  \
+      unsigned m_ = matchtag(g_, tag_);  \
+      for (; m_ != 0; m_ &= m_ - 1) {  \
+        n = gnode(t, (i_ + firstbit(m_)) & mask_);  \
+        if (found) return gval(n);  \
+      }  \
+      if (matchempty(g_) != 0) return &absentkey;  \
+      step_ += GROUPSIZE;  \
+      i_ = (i_ + step_) & mask_;  \
+    } }
+
+
+/*
+** Return a free node for a new key with the given home node and tag.
+*/
+static Node *getfreenode (Table *t, Node *home, lu_byte tag) {
+  unsigned mask = sizenode(t) - 1u;
+  unsigned i = homepos(t, home), step = 0;
+  for (;;) {
+    unsigned m = matchempty(getctrl(t) + i);
+    if (m != 0) {
+      i = (i + firstbit(m)) & mask;
+      setctrl(t, i, tag);
+      getgrowth(t)--;
+      return gnode(t, i);
+    }
+    step += GROUPSIZE;
+    i = (i + step) & mask;
+  }
+}
+
+
+static const TValue *getgenericpart (Table *t, const TValue *key,
+                                                 int deadok) {
+  lu_byte tag;
+  Node *home = homeTV(t, key, &tag);
+  Node *n;
+  swisssearch(t, home, tag, n, equalkey(key, n, deadok));
+}
+
+/* }============================================================= */
+
+#endif
+
+
+/*
+** Put in 'old' a view of the old hash part of a table that is being
+** rehashed incrementally, so that it can be searched as a table.
+*/
+static void getoldpart (const Table *t, Table *old) {
+  Limfields *lb = getlimbox(t);
+  sil_assert(ismigrating(t));
+  old->flags = 0;
+  old->lsizenode = lb->oldlsize;
+  old->asize = 0;
+  old->node = lb->oldnode;
+  old->shape = NULL;
+}
+
+
+/*
+** Entries in the hash part of a table are numbered from 0; entries in
+** an old part (if any) are numbered after them.
+*/
+static unsigned numhashnodes (const Table *t) {
+  unsigned n = sizenode(t);
+  if (l_unlikely(ismigrating(t)))
+    n += twoto(getlimbox(t)->oldlsize);
+  return n;
+}
+
+
+static Node *hashnode (const Table *t, unsigned i) {
+  if (i < sizenode(t))
+    return gnode(t, i);
+  else {
+    sil_assert(ismigrating(t));
+    return getlimbox(t)->oldnode + (i - sizenode(t));
+  }
+}
+
+
+static unsigned nodeindex (const Table *t, const TValue *slot) {
+  Node *n = nodefromval(slot);
+  if (l_unlikely(ismigrating(t))) {
+    Limfields *lb = getlimbox(t);
+    if (lb->oldnode <= n && n < lb->oldnode + twoto(lb->oldlsize))
+      return sizenode(t) + cast_uint(n - lb->oldnode);
+  }
+  return cast_uint(n - gnode(t, 0));
+}
+
+
+/*
+** "Generic" get version. (Not that generic: not valid for integers,
+** which may be in array part, nor for floats with integral values.)
+** Keys not found in the hash part may still be in an old part.
+*/
+static const TValue *getgeneric (Table *t, const TValue *key, int deadok) {
+  const TValue *slot = getgenericpart(t, key, deadok);
+  if (l_unlikely(ismigrating(t)) && isabstkey(slot)) {
+    Table old;
+    getoldpart(t, &old);
+    slot = getgenericpart(&old, key, deadok);
+  }
+  return slot;
+}
+
 
 /*
 ** Return the index 'k' (converted to an unsigned) if it is inside
@@ -325,6 +640,202 @@ static unsigned keyinarray (Table *t, const TValue *key) {
 }
 
 
+/*
+** {=============================================================
+** Shapes
+** ==============================================================
+*/
+
+/*
+** A table gets a shape when its first key in the hash part is a short
+** string, and keeps it while new keys are short strings, up to
+** SILI_MAXSHAPE keys. A table with a shape has no nodes (its hash part
+** is the dummy node), so any search for other keys fails without
+** looking at the shape. Any other key, or too many keys, move the keys
+** of the shape to a regular hash part (see 'rehash'). Removed keys stay
+** in the shape, with an empty value, as dead keys stay in nodes.
+** Shapes are not collectable objects: each one counts the tables and
+** kids using it, and the collector frees those not used anymore (see
+** 'silH_sweepshapes'). Their keys are marked by the tables using them.
+*/
+
+/* maximum number of keys in a shape */
+#if !defined(SILI_MAXSHAPE)
+#define SILI_MAXSHAPE		16
+#endif
+
+/* maximum number of kids of a shape */
+#if !defined(SILI_MAXSHAPEKIDS)
+#define SILI_MAXSHAPEKIDS	64
+#endif
+
+
+/* size of a shape with 'n' keys */
+#define sizeshape(n)  \
+	(offsetof(Shape, keys) + cast_sizet(n) * sizeof(TString *))
+
+
+/*
+** Number of slots for the values of a shape with 'n' keys. Slots grow
+** in powers of 2, so that adding keys one by one does not reallocate
+** them each time.
+*/
+static unsigned sizeslots (unsigned n) {
+  if (n == 0)
+    return 0;
+  else if (n <= 4)
+    return 4;
+  else
+    return twoto(silO_ceillog2(n));
+}
+
+
+static Shape *findkid (Shape *s, TString *key) {
+  Shape *k;
+  for (k = s->kids; k != NULL; k = k->next) {
+    if (k->keys[k->nkeys - 1] == key)
+      return k;
+  }
+  return NULL;
+}
+
+
+/*
+** Create the shape for the keys of 's' plus 'key'. It starts with no
+** users; it is linked in 's' (and so holds a reference to it).
+*/
+static Shape *newshape (sil_State *L, Shape *s, TString *key) {
+  unsigned n = s->nkeys;
+  Shape *k = cast(Shape *, silM_newblock(L, sizeshape(n + 1)));
+  k->parent = s;
+  k->kids = NULL;
+  k->refs = 0;
+  k->nkids = 0;
+  k->nkeys = cast(unsigned short, n + 1);
+  if (n > 0)
+    memcpy(k->keys, s->keys, n * sizeof(TString *));
+  k->keys[n] = key;
+  k->next = s->kids;
+  s->kids = k;
+  s->nkids++;
+  s->refs++;
+  return k;
+}
+
+
+/*
+** Free the kids of 's' (and their kids) that are not used anymore or,
+** if 'all', all of them. A shape with kids is used by them, so unused
+** shapes are always leaves.
+*/
+static void sweepkids (sil_State *L, Shape *s, int all) {
+  Shape **p = &s->kids;
+  while (*p != NULL) {
+    Shape *k = *p;
+    sweepkids(L, k, all);
+    if (all || k->refs == 0) {
+      *p = k->next;  /* remove 'k' from the list */
+      s->nkids--;
+      s->refs--;
+      silM_freemem(L, k, sizeshape(k->nkeys));
+    }
+    else
+      p = &k->next;
+  }
+}
+
+
+/*
+** Free the shapes not used by any table. Tables only drop references
+** to their shapes; unused shapes are freed here, at the end of each
+** collection cycle, so that freeing a table frees only its own memory
+** (and a shape dropped by a table can be reused until then).
+*/
+void silH_sweepshapes (sil_State *L, int all) {
+  sweepkids(L, &G(L)->rootshape, all);
+}
+
+
+/*
+** Search for 'key' in the shape of table 't'.
+*/
+static const TValue *getslot (Table *t, TString *key) {
+  Shape *s = t->shape;
+  unsigned i;
+  for (i = 0; i < s->nkeys; i++) {
+    if (s->keys[i] == key)
+      return &t->slots[i];
+  }
+  return &absentkey;
+}
+
+
+/*
+** Insert a new key into a table with a shape, if the shape for its
+** keys plus the new one already exists and there is space for the new
+** value. Return 0 if could not insert the key.
+*/
+static int insertslot (Table *t, const TValue *key, TValue *value) {
+  Shape *s = t->shape;
+  Shape *k;
+  if (!ttisshrstring(key))
+    return 0;
+  k = findkid(s, tsvalue(key));
+  if (k == NULL || sizeslots(k->nkeys) != sizeslots(s->nkeys))
+    return 0;
+  sil_assert(s->refs > 1);  /* 'k' also uses 's' */
+  k->refs++;
+  s->refs--;
+  t->shape = k;
+  setobj2t(cast(sil_State *, 0), &t->slots[s->nkeys], value);
+  return 1;
+}
+
+
+/*
+** Insert a new key into the shape of a table, creating the new shape
+** and growing the slots as needed. A table without a shape gets one
+** if its hash part is empty. Return 0 if the table cannot have a shape
+** with that key.
+*/
+static int newslot (sil_State *L, Table *t, const TValue *key,
+                                            TValue *value) {
+  Shape *s = t->shape;
+  Shape *k;
+  unsigned n, oldsize, newsize;
+  if (!ttisshrstring(key))
+    return 0;
+  if (s == NULL) {  /* table without a shape? */
+    if (!isdummy(t))
+      return 0;  /* it already uses its hash part */
+    s = &G(L)->rootshape;
+  }
+  n = s->nkeys;
+  if (n >= SILI_MAXSHAPE)
+    return 0;
+  k = findkid(s, tsvalue(key));
+  if (k == NULL) {
+    if (s->nkids >= SILI_MAXSHAPEKIDS)
+      return 0;
+    k = newshape(L, s, tsvalue(key));
+  }
+  oldsize = sizeslots(n);
+  newsize = sizeslots(n + 1);
+  if (newsize != oldsize)
+    t->slots = silM_reallocvector(L, t->slots, oldsize, newsize, TValue);
+  k->refs++;
+  if (t->shape != NULL)
+    t->shape->refs--;  /* 'k' still uses it */
+  t->shape = k;
+  setobj2t(L, &t->slots[n], value);
+  return 1;
+}
+
+/*
+** }=============================================================
+*/
+
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
@@ -338,52 +849,133 @@ static unsigned findindex (sil_State *L, Table *t, TValue *key,
   if (i != 0)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
   else {
-    const TValue *n = getgeneric(t, key, 1);
+    const TValue *n;
+    if (t->shape != NULL && ttisshrstring(key))
+      n = getslot(t, tsvalue(key));
+    else {
+      /* a key removed and inserted again may also have a dead copy,
+         which must not be taken for the live one */
+      n = getgeneric(t, key, 0);
+      if (isabstkey(n))  /* not found? */
+        n = getgeneric(t, key, 1);  /* 'key' may be dead */
+    }
     if (l_unlikely(isabstkey(n)))
       silG_runerror(L, "invalid key to 'next'");  /* key not found */
-    i = cast_uint(nodefromval(n) - gnode(t, 0));  /* key index in hash table */
+    if (t->shape != NULL)
+      i = cast_uint(n - t->slots);  /* key index in the slots */
+    else
+      i = nodeindex(t, n);  /* key index in hash table */
     /* hash elements are numbered after array ones */
     return (i + 1) + asize;
   }
 }
 
 
-int silH_next (sil_State *L, Table *t, StkId key) {
+/*
+** Put in 'key' and 'key + 1' the first non-empty entry at or after
+** traversal index 'i' (as returned by 'findindex'). Returns the index
+** that follows that entry, or 0 if there are no more elements.
+*/
+static unsigned traverse (sil_State *L, Table *t, StkId key,
+                              unsigned int i) {
   unsigned int asize = t->asize;
-  unsigned int i = findindex(L, t, s2v(key), asize);  /* find original key */
   for (; i < asize; i++) {  /* try first array part */
     lu_byte tag = *getArrTag(t, i);
     if (!tagisempty(tag)) {  /* a non-empty entry? */
       setivalue(s2v(key), cast_int(i) + 1);
       farr2val(t, i, tag, s2v(key + 1));
-      return 1;
+      return i + 1;
     }
   }
-  for (i -= asize; i < sizenode(t); i++) {  /* hash part */
-    if (!isempty(gval(gnode(t, i)))) {  /* a non-empty entry? */
-      Node *n = gnode(t, i);
+  if (t->shape != NULL) {  /* hash part is in a shape? */
+    for (i -= asize; i < t->shape->nkeys; i++) {
+      if (!isempty(&t->slots[i])) {  /* a non-empty entry? */
+        setsvalue(L, s2v(key), t->shape->keys[i]);
+        setobj2s(L, key + 1, &t->slots[i]);
+        return (i + 1) + asize;
+      }
+    }
+    return 0;  /* no more elements */
+  }
+  for (i -= asize; i < numhashnodes(t); i++) {  /* hash part */
+    Node *n = hashnode(t, i);
+    if (!isempty(gval(n))) {  /* a non-empty entry? */
       getnodekey(L, s2v(key), n);
       setobj2s(L, key + 1, gval(n));
-      return 1;
+      return (i + 1) + asize;
     }
   }
   return 0;  /* no more elements */
 }
 
 
+int silH_next (sil_State *L, Table *t, StkId key) {
+  unsigned int i = findindex(L, t, s2v(key), t->asize);
+  return (traverse(L, t, key, i) != 0);
+}
+
+
+/*
+** Check whether entry 'i' of the hash part of 't' holds 'key'.
+*/
+static int hashkeyat (Table *t, const TValue *key, unsigned int i) {
+  if (t->shape != NULL)
+    return (i < t->shape->nkeys && ttisshrstring(key) &&
+            t->shape->keys[i] == tsvalue(key));
+  else
+    return (i < numhashnodes(t) && equalkey(key, hashnode(t, i), 1));
+}
+
+
+/*
+** Variant of 'silH_next' for traversals that keep their position in
+** '*hint' between steps (as a generic 'for' over 'next' does), so that
+** they do not search the key in the hash part. Returns -1, without
+** doing anything, if the entry before '*hint' does not hold 'key'
+** anymore (e.g., the table was rehashed) and 'key' is not in the array
+** part; the caller must then use 'silH_next'.
+*/
+int silH_nextfrom (sil_State *L, Table *t, StkId key, unsigned *hint) {
+  unsigned int asize = t->asize;
+  unsigned int i = *hint;
+  if (ttisnil(s2v(key)))
+    i = 0;  /* first iteration */
+  else if (!(asize < i && hashkeyat(t, s2v(key), i - asize - 1))) {
+    i = keyinarray(t, s2v(key));
+    if (i == 0)  /* not in the array part? */
+      return -1;
+  }
+  *hint = traverse(L, t, key, i);
+  return (*hint != 0);
+}
+
+
 /* Extra space in Node array if it has a lastfree entry */
 #define extraLastfree(t)	(haslastfree(t) ? sizeof(Limbox) : 0)
 
 /* 'node' size in bytes */
+#if !SIL_USE_SWISS
 static size_t sizehash (Table *t) {
   return cast_sizet(sizenode(t)) * sizeof(Node) + extraLastfree(t);
 }
+#else
+static size_t sizehash (Table *t) {
+  return cast_sizet(sizenode(t)) * sizeof(Node) + extraLastfree(t) +
+         sizectrl(sizenode(t));
+}
+#endif
 
 
 static void freehash (sil_State *L, Table *t) {
   if (!isdummy(t)) {
+    char *arr;
+    if (ismigrating(t)) {  /* free also its old part */
+      Table old;
+      getoldpart(t, &old);
+      freehash(L, &old);
+    }
     /* get pointer to the beginning of Node array */
-    char *arr = cast_charp(t->node) - extraLastfree(t);
+    arr = cast_charp(t->node) - extraLastfree(t);
     silM_freearray(L, arr, sizehash(t));
   }
 }
@@ -514,8 +1106,13 @@ static void numusehash (const Table *t, Counters *ct) {
   while (i--) {
     Node *n = &t->node[i];
     if (isempty(gval(n))) {
+#if !SIL_USE_SWISS
       sil_assert(!keyisnil(n));  /* entry was deleted; key cannot be nil */
       ct->deleted = 1;
+#else
+      if (!keyisnil(n))  /* entry was deleted? (else node was never used) */
+        ct->deleted = 1;
+#endif
     }
     else {
       total++;
@@ -524,6 +1121,11 @@ static void numusehash (const Table *t, Counters *ct) {
     }
   }
   ct->total += total;
+  if (ismigrating(t)) {  /* count also keys in its old part */
+    Table old;
+    getoldpart(t, &old);
+    numusehash(&old, ct);
+  }
 }
 
 
@@ -539,6 +1141,76 @@ static size_t concretesize (unsigned int size) {
 }
 
 
+/*
+** {=============================================================
+** Cards (see 'ltable.h')
+** ==============================================================
+*/
+
+#define sizecards(n)	(offsetof(Cards, c) + (n))
+
+
+static void freecards (sil_State *L, Table *t) {
+  Cards *cs = t->cards;
+  if (cs != NULL) {
+    silM_freemem(L, cs, sizecards(cs->na + cs->nn));
+    t->cards = NULL;
+  }
+}
+
+
+/*
+** Give table 't' the cards for the current sizes of its parts. After
+** a resize, entries can be anywhere; so, if any old card was marked,
+** all new cards are marked. New cards are marked too, as the table
+** could have been touched before having cards.
+*/
+static void setcards (sil_State *L, Table *t) {
+  Cards *cs = t->cards;
+  unsigned na = cardsfor(t->asize);
+  unsigned nn = cardsfor(allocsizenode(t));
+  lu_byte mark = CARDDIRTY;
+  if (cs != NULL) {
+    unsigned i;
+    mark = CARDCLEAN;
+    for (i = 0; i < cs->na + cs->nn; i++) {
+      if (cs->c[i] != CARDCLEAN)
+        mark = CARDDIRTY;
+    }
+    if (cs->na + cs->nn != na + nn)  /* cannot reuse old cards? */
+      freecards(L, t);
+  }
+  if (na + nn == 0)  /* table too small for cards? */
+    return;
+  if (t->cards == NULL)
+    t->cards = cast(Cards *, silM_newblock(L, sizecards(na + nn)));
+  t->cards->na = na;
+  t->cards->nn = nn;
+  memset(t->cards->c, mark, na + nn);
+}
+
+
+#if !SIL_USE_SWISS
+
+/*
+** An entry moved from node 'from' to node 'to' takes its card mark
+** with it.
+*/
+static void movecard (Table *t, Node *from, Node *to) {
+  Cards *cs = t->cards;
+  if (cs != NULL) {
+    unsigned i = cast_uint(from - gnode(t, 0)) >> SILI_CARDBITS;
+    unsigned j = cast_uint(to - gnode(t, 0)) >> SILI_CARDBITS;
+    if (i < cs->nn && j < cs->nn && cs->c[cs->na + j] < cs->c[cs->na + i])
+      cs->c[cs->na + j] = cs->c[cs->na + i];
+  }
+}
+
+#endif
+
+/* }============================================================= */
+
+
 /*
 ** Resize the array part of a table. If new size is equal to the old,
 ** do nothing. Else, if new size is zero, free the old array. (It must
@@ -598,9 +1270,14 @@ static void setnodevector (sil_State *L, Table *t, unsigned size) {
   else {
     int i;
     int lsize = silO_ceillog2(size);
+#if SIL_USE_SWISS
+    if (maxgrowth(twoto(lsize)) < size)  /* not enough usable nodes? */
+      lsize++;
+#endif
     if (lsize > MAXHBITS || (1 << lsize) > MAXHSIZE)
       silG_runerror(L, "table overflow");
     size = twoto(lsize);
+#if !SIL_USE_SWISS
     if (lsize < LIMFORLAST)  /* no 'lastfree' field? */
       t->node = silM_newvector(L, size, Node);
     else {
@@ -610,6 +1287,16 @@ static void setnodevector (sil_State *L, Table *t, unsigned size) {
       getlastfree(t) = gnode(t, size);  /* all positions are free */
     }
     t->lsizenode = cast_byte(lsize);
+#else
+    {
+      size_t bsize = size * sizeof(Node) + sizeof(Limbox) + sizectrl(size);
+      char *node = silM_newblock(L, bsize);
+      t->node = cast(Node *, node + sizeof(Limbox));
+      t->lsizenode = cast_byte(lsize);
+      getgrowth(t) = maxgrowth(size);
+      memset(getctrl(t), CTRLEMPTY, sizectrl(size));
+    }
+#endif
     setnodummy(t);
     for (i = 0; i < cast_int(size); i++) {
       Node *n = gnode(t, i);
@@ -637,25 +1324,32 @@ static void reinserthash (sil_State *L, Table *ot, Table *t) {
       newcheckedkey(t, &k, gval(old));
     }
   }
+  if (ismigrating(ot)) {  /* reinsert also elements from its old part */
+    Table old;
+    getoldpart(ot, &old);
+    reinserthash(L, &old, t);
+  }
 }
 
 
 /*
 ** Exchange the hash part of 't1' and 't2'. (In 'flags', only the
-** dummy bit must be exchanged: The 'isrealasize' is not related
-** to the hash part, and the metamethod bits do not change during
+** dummy and migrate bits must be exchanged: The 'isrealasize' is not
+** related to the hash part, and the metamethod bits do not change during
 ** a resize, so the "real" table can keep their values.)
 */
+#define HASHBITS	(BITDUMMY | BITMIGRATE)
+
 static void exchangehashpart (Table *t1, Table *t2) {
   lu_byte lsizenode = t1->lsizenode;
   Node *node = t1->node;
-  int bitdummy1 = t1->flags & BITDUMMY;
+  int bits1 = t1->flags & HASHBITS;
   t1->lsizenode = t2->lsizenode;
   t1->node = t2->node;
-  t1->flags = cast_byte((t1->flags & NOTBITDUMMY) | (t2->flags & BITDUMMY));
+  t1->flags = cast_byte((t1->flags & ~HASHBITS) | (t2->flags & HASHBITS));
   t2->lsizenode = lsizenode;
   t2->node = node;
-  t2->flags = cast_byte((t2->flags & NOTBITDUMMY) | bitdummy1);
+  t2->flags = cast_byte((t2->flags & ~HASHBITS) | bits1);
 }
 
 
@@ -708,6 +1402,7 @@ void silH_resize (sil_State *L, Table *t, unsigned newasize,
   Table newt;  /* to keep the new hash part */
   unsigned oldasize = t->asize;
   Value *newarray;
+  sil_assert(t->shape == NULL || nhsize == 0);  /* shape is kept */
   if (newasize > MAXASIZE)
     silG_runerror(L, "table overflow");
   /* create new hash part with appropriate size into 'newt' */
@@ -735,19 +1430,177 @@ void silH_resize (sil_State *L, Table *t, unsigned newasize,
   /* re-insert elements from old hash part into new parts */
   reinserthash(L, &newt, t);  /* 'newt' now has the old hash */
   freehash(L, &newt);  /* free old hash part */
+  setcards(L, t);
+}
+
+
+/*
+** Give a new table room for 'nasize' array entries and 'nhsize' hash
+** entries. Small hash parts are not created in advance, so that the
+** table can get a shape if its keys are short strings (as in most
+** constructors).
+*/
+void silH_presize (sil_State *L, Table *t, unsigned nasize,
+                                           unsigned nhsize) {
+  if (nhsize <= SILI_MAXSHAPE)
+    nhsize = 0;
+  if (nasize > 0 || nhsize > 0)
+    silH_resize(L, t, nasize, nhsize);
 }
 
 
 void silH_resizearray (sil_State *L, Table *t, unsigned int nasize) {
   unsigned nsize = allocsizenode(t);
+  if (ismigrating(t))
+    nsize = numhashnodes(t);  /* room also for the entries in old part */
   silH_resize(L, t, nasize, nsize);
 }
 
 
+/*
+** Move the entries of a table with a shape to a regular hash part.
+** Return the number of entries moved.
+*/
+static unsigned unshape (sil_State *L, Table *t) {
+  Shape *s = t->shape;
+  TValue *slots = t->slots;
+  Table newt;  /* to keep the new hash part */
+  unsigned i, n = 0;
+  sil_assert(isdummy(t));
+  for (i = 0; i < s->nkeys; i++) {  /* count the values */
+    if (!isempty(&slots[i]))
+      n++;
+  }
+  newt.flags = 0;
+  setnodevector(L, &newt, n);
+  exchangehashpart(t, &newt);  /* 'newt' now has the dummy node */
+  t->shape = NULL;
+  t->slots = NULL;
+  for (i = 0; i < s->nkeys; i++) {
+    if (!isempty(&slots[i])) {
+      TValue k;
+      setsvalue(L, &k, s->keys[i]);
+      newcheckedkey(t, &k, &slots[i]);
+    }
+  }
+  silM_freearray(L, slots, sizeslots(s->nkeys));
+  s->refs--;
+  return n;
+}
+
+
+/*
+** {=============================================================
+** Incremental rehash
+** ==============================================================
+** A large hash part does not grow in one step. Instead, the table gets
+** a new hash part while the old one is kept in the 'Limbox' of the new
+** one. Searches that miss in the new part also look in the old part;
+** each new key then moves up to SILI_MIGRATESTEP nodes of the old part
+** to the new one. Moved nodes keep their keys, but dead and with empty
+** values, so that searches cannot find them in the old part anymore.
+** When all nodes have been moved, the old part is freed. Traversals
+** ('next' and the collector) go through both parts. Lookups do not move
+** entries, as a traversal can do lookups (but not create new keys).
+*/
+
+/* log2 of the minimum size of a hash part grown incrementally */
+#if !defined(SILI_MIGRATEBITS)
+#define SILI_MIGRATEBITS	12
+#endif
+
+/* number of nodes of the old part moved with each new key */
+#if !defined(SILI_MIGRATESTEP)
+#define SILI_MIGRATESTEP	8
+#endif
+
+
+/*
+** Check whether table 't' should grow its hash part to 'nsize'
+** incrementally.
+*/
+static int canmigrate (Table *t, unsigned nsize) {
+  return (!ismigrating(t) && t->lsizenode >= SILI_MIGRATEBITS &&
+          nsize > sizenode(t));
+}
+
+
+static void startmigration (sil_State *L, Table *t, unsigned nsize) {
+  Table newt;  /* to keep the new hash part */
+  Limfields *lb;
+  newt.flags = 0;
+  setnodevector(L, &newt, nsize);
+  lb = getlimbox(&newt);
+  lb->oldnode = t->node;
+  lb->oldlsize = t->lsizenode;
+  lb->moved = 0;
+  t->node = newt.node;
+  t->lsizenode = newt.lsizenode;
+  t->flags |= BITMIGRATE;
+  setcards(L, t);
+}
+
+
+/*
+** Move the next SILI_MIGRATESTEP nodes of the old part of table 't' to
+** its new hash part, freeing the old part after its last node. If the
+** new part runs out of free nodes, the entry stays where it is; the
+** rehash that follows moves all entries from both parts.
+*/
+static void migrate (sil_State *L, Table *t) {
+  Limfields *lb = getlimbox(t);
+  unsigned size = twoto(lb->oldlsize);
+  unsigned i = lb->moved;
+  unsigned limit = (size - i > SILI_MIGRATESTEP) ? i + SILI_MIGRATESTEP
+                                                 : size;
+  for (; i < limit; i++) {
+    Node *n = lb->oldnode + i;
+    if (!isempty(gval(n))) {
+      TValue k, v;
+      getnodekey(L, &k, n);
+      setobj2t(L, &v, gval(n));
+      setempty(gval(n));  /* remove entry from the old part... */
+      setdeadkey(n);
+      if (!insertkey(t, &k, &v)) {  /* ...and put it in the new part */
+        setnodekey(n, &k);  /* no space; restore entry */
+        setobj2t(L, gval(n), &v);
+        break;
+      }
+    }
+    else
+      setdeadkey(n);
+  }
+  lb->moved = i;
+  if (i == size) {  /* moved all nodes? */
+    Table old;
+    getoldpart(t, &old);
+    t->flags &= cast_byte(~BITMIGRATE);
+    freehash(L, &old);
+  }
+}
+
+
+Node *silH_oldnode (const Table *t, unsigned *size) {
+  if (ismigrating(t)) {
+    Limfields *lb = getlimbox(t);
+    *size = twoto(lb->oldlsize);
+    return lb->oldnode;
+  }
+  else {
+    *size = 0;
+    return NULL;
+  }
+}
+
+/* }============================================================= */
+
+
 /*
 ** Rehash a table. First, count its keys. If there are array indices
 ** outside the array part, compute the new best size for that part.
-** Then, resize the table.
+** Then, resize the table. A table with a shape keeps it if the new
+** key goes to the array part; otherwise, the keys of its shape go
+** to a regular hash part first.
 */
 static void rehash (sil_State *L, Table *t, const TValue *ek) {
   unsigned asize;  /* optimal size for array part */
@@ -777,6 +1630,12 @@ static void rehash (sil_State *L, Table *t, const TValue *ek) {
        avoid repeated resizings */
     nsize += nsize >> 2;
   }
+  if (t->shape != NULL && nsize > 0)  /* new key needs a hash part? */
+    nsize += unshape(L, t);  /* keys from the shape go there too */
+  else if (asize == t->asize && canmigrate(t, nsize)) {
+    startmigration(L, t, nsize);  /* grow the hash part incrementally */
+    return;
+  }
   /* resize the table to new computed sizes */
   silH_resize(L, t, asize, nsize);
 }
@@ -793,6 +1652,9 @@ Table *silH_new (sil_State *L) {
   t->flags = maskflags;  /* table has no metamethod fields */
   t->array = NULL;
   t->asize = 0;
+  t->shape = NULL;
+  t->slots = NULL;
+  t->cards = NULL;
   setnodevector(L, t, 0);
   return t;
 }
@@ -802,6 +1664,15 @@ lu_mem silH_size (Table *t) {
   lu_mem sz = cast(lu_mem, sizeof(Table)) + concretesize(t->asize);
   if (!isdummy(t))
     sz += sizehash(t);
+  if (ismigrating(t)) {
+    Table old;
+    getoldpart(t, &old);
+    sz += sizehash(&old);
+  }
+  if (t->shape != NULL)
+    sz += sizeslots(t->shape->nkeys) * sizeof(TValue);
+  if (t->cards != NULL)
+    sz += sizecards(t->cards->na + t->cards->nn);
   return sz;
 }
 
@@ -810,12 +1681,19 @@ lu_mem silH_size (Table *t) {
 ** Frees a table.
 */
 void silH_free (sil_State *L, Table *t) {
+  if (t->shape != NULL) {
+    silM_freearray(L, t->slots, sizeslots(t->shape->nkeys));
+    t->shape->refs--;
+  }
   freehash(L, t);
   resizearray(L, t, t->asize, 0);
+  freecards(L, t);
   silM_free(L, t);
 }
 
 
+#if !SIL_USE_SWISS
+
 static Node *getfreepos (Table *t) {
   if (haslastfree(t)) {  /* does it have 'lastfree' information? */
     /* look for a spot before 'lastfree', updating 'lastfree' */
@@ -847,7 +1725,10 @@ static Node *getfreepos (Table *t) {
 ** could not insert key (could not find a free space).
 */
 static int insertkey (Table *t, const TValue *key, TValue *value) {
-  Node *mp = mainpositionTV(t, key);
+  Node *mp;
+  if (t->shape != NULL)
+    return insertslot(t, key, value);
+  mp = mainpositionTV(t, key);
   /* table cannot already contain the key */
   sil_assert(isabstkey(getgeneric(t, key, 0)));
   if (!isempty(gval(mp)) || isdummy(t)) {  /* main position is taken? */
@@ -863,6 +1744,7 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
         othern += gnext(othern);
       gnext(othern) = cast_int(f - othern);  /* rechain to point to 'f' */
       *f = *mp;  /* copy colliding node into free pos. (mp->next also goes) */
+      movecard(t, mp, f);
       if (gnext(mp) != 0) {
         gnext(f) += cast_int(mp - f);  /* correct 'next' */
         gnext(mp) = 0;  /* now 'mp' is free */
@@ -884,6 +1766,32 @@ static int insertkey (Table *t, const TValue *key, TValue *value) {
   return 1;
 }
 
+#else
+
+/*
+** Inserts a new key into a hash table, in the first free node along
+** its probe sequence. Return 0 if could not insert key (no more nodes
+** can be used).
+*/
+static int insertkey (Table *t, const TValue *key, TValue *value) {
+  Node *n;
+  lu_byte tag;
+  if (t->shape != NULL)
+    return insertslot(t, key, value);
+  /* table cannot already contain the key */
+  sil_assert(isabstkey(getgeneric(t, key, 0)));
+  if (isdummy(t) || getgrowth(t) == 0)  /* no free node can be used? */
+    return 0;
+  n = homeTV(t, key, &tag);
+  n = getfreenode(t, n, tag);
+  setnodekey(n, key);
+  sil_assert(isempty(gval(n)));
+  setobj2t(cast(sil_State *, 0), gval(n), value);
+  return 1;
+}
+
+#endif
+
 
 /*
 ** Insert a key in a table where there is space for that key, the
@@ -904,21 +1812,25 @@ static void newcheckedkey (Table *t, const TValue *key, TValue *value) {
 static void silH_newkey (sil_State *L, Table *t, const TValue *key,
                                                  TValue *value) {
   if (!ttisnil(value)) {  /* do not insert nil values */
-    int done = insertkey(t, key, value);
+    int done;
+    if (l_unlikely(ismigrating(t)))
+      migrate(L, t);  /* each new key moves some old entries */
+    done = insertkey(t, key, value) || newslot(L, t, key, value);
     if (!done) {  /* could not find a free place? */
       rehash(L, t, key);  /* grow table */
       newcheckedkey(t, key, value);  /* insert key in grown table */
     }
-    silC_barrierback(L, obj2gco(t), key);
+    silC_barriertable(L, t, key, key);
     /* for debugging only: any new key may force an emergency collection */
     condchangemem(L, (void)0, (void)0, 1);
   }
 }
 
 
-static const TValue *getintfromhash (Table *t, sil_Integer key) {
+#if !SIL_USE_SWISS
+
+static const TValue *getintpart (Table *t, sil_Integer key) {
   Node *n = hashint(t, key);
-  sil_assert(!ikeyinarray(t, key));
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisinteger(n) && keyival(n) == key)
       return gval(n);  /* that's it */
@@ -931,6 +1843,29 @@ static const TValue *getintfromhash (Table *t, sil_Integer key) {
   return &absentkey;
 }
 
+#else
+
+static const TValue *getintpart (Table *t, sil_Integer key) {
+  Node *n;
+  swisssearch(t, hashint(t, key), inttag(key), n,
+              keyisinteger(n) && keyival(n) == key);
+}
+
+#endif
+
+
+static const TValue *getintfromhash (Table *t, sil_Integer key) {
+  const TValue *slot;
+  sil_assert(!ikeyinarray(t, key));
+  slot = getintpart(t, key);
+  if (l_unlikely(ismigrating(t)) && isabstkey(slot)) {
+    Table old;
+    getoldpart(t, &old);
+    slot = getintpart(&old, key);
+  }
+  return slot;
+}
+
 
 static int hashkeyisempty (Table *t, sil_Unsigned key) {
   const TValue *val = getintfromhash(t, l_castU2S(key));
@@ -962,9 +1897,10 @@ lu_byte silH_getint (Table *t, sil_Integer key, TValue *res) {
 /*
 ** search function for short strings
 */
-const TValue *silH_Hgetshortstr (Table *t, TString *key) {
-  Node *n = hashstr(t, key);
-  sil_assert(strisshr(key));
+static const TValue *getshortstrpart (Table *t, TString *key) {
+  Node *n;
+#if !SIL_USE_SWISS
+  n = hashstr(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (keyisshrstr(n) && eqshrstr(keystrval(n), key))
       return gval(n);  /* that's it */
@@ -975,6 +1911,25 @@ const TValue *silH_Hgetshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#else
+  swisssearch(t, hashstr(t, key), hashtag(key->hash), n,
+              keyisshrstr(n) && eqshrstr(keystrval(n), key));
+#endif
+}
+
+
+const TValue *silH_Hgetshortstr (Table *t, TString *key) {
+  const TValue *slot;
+  sil_assert(strisshr(key));
+  if (t->shape != NULL)
+    return getslot(t, key);
+  slot = getshortstrpart(t, key);
+  if (l_unlikely(ismigrating(t)) && isabstkey(slot)) {
+    Table old;
+    getoldpart(t, &old);
+    slot = getshortstrpart(&old, key);
+  }
+  return slot;
 }
 
 
@@ -983,6 +1938,20 @@ lu_byte silH_getshortstr (Table *t, TString *key, TValue *res) {
 }
 
 
+/*
+** Slow path of 'silH_fastgetshortstr': do a regular search and, if the
+** key is present, remember its node (or slot) in the inline cache 'ic'.
+*/
+lu_byte silH_getshortstrcache (Table *t, TString *key, TValue *res,
+                                         unsigned int *ic) {
+  const TValue *slot = silH_Hgetshortstr(t, key);
+  if (!isabstkey(slot))
+    *ic = (t->shape != NULL) ? cast_uint(slot - t->slots)
+                             : nodeindex(t, slot);
+  return finishnodeget(slot, res);
+}
+
+
 static const TValue *Hgetlongstr (Table *t, TString *key) {
   TValue ko;
   sil_assert(!strisshr(key));
@@ -1039,13 +2008,28 @@ lu_byte silH_get (Table *t, const TValue *key, TValue *res) {
 static int retpsetcode (Table *t, const TValue *slot) {
   if (isabstkey(slot))
     return HNOTFOUND;  /* no slot with that key */
+  else if (t->shape != NULL)  /* return index in the slots encoded */
+    return cast_int(slot - t->slots) + HFIRSTNODE;
   else  /* return node encoded */
-    return cast_int((cast(Node*, slot) - t->node)) + HFIRSTNODE;
+    return cast_int(nodeindex(t, slot)) + HFIRSTNODE;
 }
 
 
+/*
+** A store into a table with cards that needs a barrier is left to
+** 'silH_finishset', so that the barrier gets the card from the result
+** code instead of searching the key again (see 'silH_cardofres').
+** Not with a '__newindex' metamethod, which the caller would then try.
+*/
+#define needcard(t,v)  \
+	((t)->cards != NULL && iscollectable(v) && isblack(t) && \
+	 iswhite(gcvalue(v)) && checknoTM((t)->metatable, TM_NEWINDEX))
+
+
 static int finishnodeset (Table *t, const TValue *slot, TValue *val) {
   if (!ttisnil(slot)) {
+    if (l_unlikely(needcard(t, val)))
+      return retpsetcode(t, slot);
     setobj(((sil_State*)NULL), cast(TValue*, slot), val);
     return HOK;  /* success */
   }
@@ -1088,6 +2072,8 @@ static int psetint (Table *t, sil_Integer key, TValue *val) {
 int silH_psetshortstr (Table *t, TString *key, TValue *val) {
   const TValue *slot = silH_Hgetshortstr(t, key);
   if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
+    if (l_unlikely(needcard(t, val)))
+      return retpsetcode(t, slot);
     setobj(((sil_State*)NULL), cast(TValue*, slot), val);  /* update it */
     return HOK;  /* done */
   }
@@ -1095,7 +2081,8 @@ int silH_psetshortstr (Table *t, TString *key, TValue *val) {
     if (ttisnil(val))  /* new value is nil? */
       return HOK;  /* done (value is already nil/absent) */
     if (isabstkey(slot) &&  /* key is absent? */
-       !(isblack(t) && iswhite(key))) {  /* and don't need barrier? */
+       !(isblack(t) && iswhite(key)) &&  /* and don't need barrier? */
+       !ismigrating(t)) {  /* and no entries to move? */
       TValue tk;  /* key as a TValue */
       setsvalue(cast(sil_State *, NULL), &tk, key);
       if (insertkey(t, &tk, val)) {  /* insert key, if there is space */
@@ -1160,8 +2147,10 @@ void silH_finishset (sil_State *L, Table *t, const TValue *key,
     }
     silH_newkey(L, t, key, value);
   }
-  else if (hres > 0) {  /* regular Node? */
-    setobj2t(L, gval(gnode(t, hres - HFIRSTNODE)), value);
+  else if (hres > 0) {  /* regular Node (or slot)? */
+    unsigned i = cast_uint(hres - HFIRSTNODE);
+    TValue *slot = (t->shape != NULL) ? &t->slots[i] : gval(hashnode(t, i));
+    setobj2t(L, slot, value);
   }
   else {  /* array entry */
     hres = ~hres;  /* real index */
@@ -1200,6 +2189,88 @@ void silH_setint (sil_State *L, Table *t, sil_Integer key, TValue *value) {
 }
 
 
+/*
+** Card of the entry at 'slot' in the hash part of table 't'.
+*/
+static int nodecard (Table *t, const TValue *slot) {
+  Cards *cs = t->cards;
+  if (cs->nn == 0)
+    return NOCARD;  /* hash part has no cards */
+  else if (isabstkey(slot))  /* no such entry? (should not happen) */
+    return -1;  /* be conservative */
+  else {
+    unsigned i = cast_uint(nodefromval(slot) - gnode(t, 0));
+    return cast_int(cs->na + (i >> SILI_CARDBITS));
+  }
+}
+
+
+/*
+** Return the index of the card of the entry with key 'key' in table
+** 't', which must have cards. Return NOCARD if the entry is not
+** covered by cards and -1 if its card is not known (and so all cards
+** must be marked).
+*/
+int silH_cardofint (Table *t, sil_Integer key) {
+  if (!cardsok(t))
+    return -1;
+  else if (ikeyinarray(t, key))
+    return (t->cards->na > 0)
+           ? cast_int((l_castS2U(key) - 1u) >> SILI_CARDBITS)
+           : NOCARD;
+  else
+    return nodecard(t, getintfromhash(t, key));
+}
+
+
+int silH_cardof (Table *t, const TValue *key) {
+  switch (ttypetag(key)) {
+    case SIL_VNUMINT:
+      return silH_cardofint(t, ivalue(key));
+    case SIL_VNUMFLT: {
+      sil_Integer k;
+      if (silV_flttointeger(fltvalue(key), &k, F2Ieq)) /* integral index? */
+        return silH_cardofint(t, k);
+      break;
+    }
+    default:
+      break;
+  }
+  if (!cardsok(t))
+    return -1;
+  else if (t->cards->nn == 0)  /* no cards for the hash part? */
+    return NOCARD;  /* (e.g., slots of a shape, always traversed) */
+  else
+    return nodecard(t, getgeneric(t, key, 0));
+}
+
+
+/*
+** Card of the entry that 'silH_finishset' has just set with key 'key'
+** and result 'hres' of a 'pset'. Unless the entry is new, 'hres' gives
+** its position, so there is no need to search the key. The slots of a
+** shape have no cards, as they are always traversed.
+*/
+int silH_cardofres (Table *t, int hres, const TValue *key) {
+  Cards *cs = t->cards;
+  if (hres == HOK || hres == HNOTFOUND)  /* position not known? */
+    return silH_cardof(t, key);
+  else if (!cardsok(t))
+    return -1;
+  else if (hres > 0) {  /* node or slot */
+    unsigned i = cast_uint(hres - HFIRSTNODE);
+    if (t->shape != NULL || cs->nn == 0)  /* slots, or no node cards? */
+      return NOCARD;
+    else
+      return cast_int(cs->na + (i >> SILI_CARDBITS));
+  }
+  else {  /* array entry */
+    unsigned i = cast_uint(~hres);
+    return (cs->na > 0) ? cast_int(i >> SILI_CARDBITS) : NOCARD;
+  }
+}
+
+
 /*
 ** Try to find a boundary in the hash part of table 't'. From the
 ** caller, we know that 'j' is zero or present and that 'j + 1' is
@@ -10,6 +10,15 @@
 #include "lobject.h"
 
 
+/*
+** When true, hash parts use an open-addressing layout probed in groups
+** of nodes (a "Swiss table") instead of chained scatter. See ltable.c.
+*/
+#if !defined(SIL_USE_SWISS)
+#define SIL_USE_SWISS		0
+#endif
+
+
 #define gnode(t,i)	(&(t)->node[i])
 #define gval(n)		(&(n)->i_val)
 #define gnext(n)	((n)->u.next)
@@ -36,11 +45,57 @@
 #define setdummy(t)		((t)->flags |= BITDUMMY)
 
 
+/*
+** Bit BITMIGRATE set in 'flags' means the table is being rehashed
+** incrementally: besides its hash part, it has an old hash part whose
+** entries are still being moved to the new one.
+*/
+
+#define BITMIGRATE		(1 << 7)
+#define ismigrating(t)		((t)->flags & BITMIGRATE)
+
+
 
 /* allocated size for hash nodes */
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
 
 
+/*
+** Card marking. In generational mode, a store of a young value into an
+** old table does not make the whole table be traversed again: each part
+** of a large table (with at least SILI_CARDMIN entries) is divided in
+** regions of 2^SILI_CARDBITS entries, each with a card, and the barrier
+** marks only the card of the entry being set. Young collections then
+** traverse only the regions with marked cards. A part with no cards is
+** always traversed in full. A card is CARDDIRTY when marked; the
+** collector advances it to CARDOLD and then to CARDCLEAN, as the values
+** in the region need to be seen in two young collections.
+*/
+#if !defined(SILI_CARDBITS)
+#define SILI_CARDBITS	8
+#endif
+
+#if !defined(SILI_CARDMIN)
+#define SILI_CARDMIN	(1u << 14)
+#endif
+
+#define CARDCLEAN	0
+#define CARDOLD		1
+#define CARDDIRTY	2
+
+/* card for an entry not covered by cards ('silH_cardof') */
+#define NOCARD		(-2)
+
+/* number of cards for a part with 'n' entries */
+#define cardsfor(n)  \
+	((n) >= SILI_CARDMIN ? (((n) - 1u) >> SILI_CARDBITS) + 1u : 0u)
+
+/* true iff the cards of table 't' match its current parts */
+#define cardsok(t)  ((t)->cards != NULL && !ismigrating(t) && \
+	(t)->cards->na == cardsfor((t)->asize) && \
+	(t)->cards->nn == cardsfor(allocsizenode(t)))
+
+
 /* returns the Node, given the value of a table entry */
 #define nodefromval(v)	cast(Node *, (v))
 
@@ -64,6 +119,31 @@
     else { hres = silH_psetint(h, k, val); }}
 
 
+/*
+** Fast track for short-string keys using an inline cache. 'ic' points
+** to the index of the node where the key was last found by the same
+** instruction. A hit only checks that this node still holds the key;
+** as any rehash moves keys around, a stale index simply fails that
+** check and falls back to a regular search, which refreshes the cache.
+** (The test against 'sizenode' protects against indices coming from
+** other, larger tables. The dummy node never holds a string key.)
+** For a table with a shape, the index is that of its slot, and a hit
+** checks the key at that index in the shape: all tables with the same
+** shape hit the same cache entry.
+*/
+#define silH_fastgetshortstr(t,key,res,ic,tag) \
+  { Table *h = t; unsigned ix = *(ic); const TValue *hv = NULL; \
+    if (h->shape != NULL) { \
+      if (ix < h->shape->nkeys && h->shape->keys[ix] == (key)) \
+        hv = &h->slots[ix]; } \
+    else if (ix < sizenode(h) && keyisshrstr(gnode(h, ix)) && \
+             keystrval(gnode(h, ix)) == (key)) \
+      hv = gval(gnode(h, ix)); \
+    if (hv != NULL) { tag = ttypetag(hv); \
+      if (!tagisempty(tag)) { setobj(((sil_State*)NULL), res, hv); }} \
+    else { tag = silH_getshortstrcache(h, (key), res, ic); }}
+
+
 /* results from pset */
 #define HOK		0
 #define HNOTFOUND	1
@@ -81,6 +161,8 @@
 ** value because there might be a metamethod.) If the slot is in the
 ** hash part, the encoding is (HFIRSTNODE + hash index); if the slot is
 ** in the array part, the encoding is (~array index), a negative value.
+** They also return that encoding for a present value in a table with
+** cards, when the store needs a barrier (see 'silH_cardofres').
 ** The value HNOTATABLE is used by the fast macros to signal that the
 ** value being indexed is not a table.
 ** (The size for the array part is limited by the maximum power of two
@@ -148,6 +230,8 @@
 
 SILI_FUNC lu_byte silH_get (Table *t, const TValue *key, TValue *res);
 SILI_FUNC lu_byte silH_getshortstr (Table *t, TString *key, TValue *res);
+SILI_FUNC lu_byte silH_getshortstrcache (Table *t, TString *key, TValue *res,
+                                                 unsigned int *ic);
 SILI_FUNC lu_byte silH_getstr (Table *t, TString *key, TValue *res);
 SILI_FUNC lu_byte silH_getint (Table *t, sil_Integer key, TValue *res);
 
@@ -169,11 +253,20 @@ SILI_FUNC void silH_finishset (sil_State *L, Table *t, const TValue *key,
 SILI_FUNC Table *silH_new (sil_State *L);
 SILI_FUNC void silH_resize (sil_State *L, Table *t, unsigned nasize,
                                                     unsigned nhsize);
+SILI_FUNC void silH_presize (sil_State *L, Table *t, unsigned nasize,
+                                                     unsigned nhsize);
 SILI_FUNC void silH_resizearray (sil_State *L, Table *t, unsigned nasize);
 SILI_FUNC lu_mem silH_size (Table *t);
 SILI_FUNC void silH_free (sil_State *L, Table *t);
 SILI_FUNC int silH_next (sil_State *L, Table *t, StkId key);
+SILI_FUNC int silH_nextfrom (sil_State *L, Table *t, StkId key,
+                                             unsigned *hint);
 SILI_FUNC sil_Unsigned silH_getn (Table *t);
+SILI_FUNC void silH_sweepshapes (sil_State *L, int all);
+SILI_FUNC Node *silH_oldnode (const Table *t, unsigned *size);
+SILI_FUNC int silH_cardof (Table *t, const TValue *key);
+SILI_FUNC int silH_cardofint (Table *t, sil_Integer key);
+SILI_FUNC int silH_cardofres (Table *t, int hres, const TValue *key);
 
 
 #if defined(SIL_DEBUG)
@@ -260,6 +260,47 @@ void silT_adjustvarargs (sil_State *L, int nfixparams, CallInfo *ci,
 }
 
 
+/*
+** Put in 'ra' the first 'wanted' results (all, if negative) of
+** 'select(n, ...)', where 'n' is in 'ra + 1', reading them from the
+** vararg frame. Return false, doing nothing, in the cases left to
+** 'select' itself: errors and calls that want all the values of a
+** numeric selection.
+*/
+int silT_selectvarargs (sil_State *L, CallInfo *ci, StkId ra, int wanted) {
+  int nextra = ci->u.l.nextraargs;
+  const TValue *n = s2v(ra + 1);
+  sil_Integer first;
+  int i;
+  if (ttisstring(n) && getstr(tsvalue(n))[0] == '#') {
+    setivalue(s2v(ra), nextra);
+    if (wanted < 0)
+      L->top.p = ra + 1;  /* next instruction will need top */
+    for (i = 1; i < wanted; i++)
+      setnilvalue(s2v(ra + i));
+    return 1;
+  }
+  if (wanted < 0 || !tointeger(n, &first))
+    return 0;
+  if (first < 0) {
+    if (first < -nextra)
+      return 0;  /* index out of range */
+    first += nextra;
+  }
+  else if (first == 0)
+    return 0;  /* index out of range */
+  else if (first > nextra)
+    first = nextra;  /* no values */
+  else
+    first--;
+  for (i = 0; i < wanted && first + i < nextra; i++)
+    setobjs2s(L, ra + i, ci->func.p - nextra + first + i);
+  for (; i < wanted; i++)  /* complete required results with nil */
+    setnilvalue(s2v(ra + i));
+  return 1;
+}
+
+
 void silT_getvarargs (sil_State *L, CallInfo *ci, StkId where, int wanted) {
   int i;
   int nextra = ci->u.l.nextraargs;
@@ -97,6 +97,8 @@ SILI_FUNC int silT_callorderiTM (sil_State *L, const TValue *p1, int v2,
 
 SILI_FUNC void silT_adjustvarargs (sil_State *L, int nfixparams,
                                    struct CallInfo *ci, const Proto *p);
+SILI_FUNC int silT_selectvarargs (sil_State *L, struct CallInfo *ci,
+                                  StkId ra, int wanted);
 SILI_FUNC void silT_getvarargs (sil_State *L, struct CallInfo *ci,
                                               StkId where, int wanted);
 
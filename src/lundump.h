@@ -26,7 +26,12 @@
 */
 #define SILC_VERSION	(SIL_VERSION_MAJOR_N*16+SIL_VERSION_MINOR_N)
 
-#define SILC_FORMAT	0	/* this is the official format */
+/*
+** Format of the code in a binary chunk: it must change whenever the
+** opcodes or their encoding change, so that 'sil_load' rejects chunks
+** dumped by an incompatible build. (1: added OP_VARSELECT.)
+*/
+#define SILC_FORMAT	1
 
 
 /* load one chunk; from lundump.c */
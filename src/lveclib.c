@@ -0,0 +1,957 @@
+/*
+** $Id: lveclib.c $
+** Vectorized kernels over numeric arrays
+** See Copyright Notice in sil.h
+*/
+
+#define lveclib_c
+#define SIL_LIB
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+
+#include "sil.h"
+
+#include "lauxlib.h"
+#include "sillib.h"
+#include "larray.h"
+
+
+/*
+** The operands of these functions ("vectors") are typed arrays (see
+** 'larraylib.c') or tables, whose elements 1..#t must be numbers. The
+** kernels work on contiguous vectors of floats: f64 arrays are used in
+** place; other operands are converted into a temporary buffer (for a
+** table, 'sil_rawgetnums' copies its array part in one go) and, when
+** they receive a result, converted back. Results that are new vectors
+** are f64 arrays when the (first) operand is an array, tables
+** otherwise.
+**
+** When all vector operands hold only integers (i64, i32 and u8 arrays
+** and tables of integers) and all scalar operands are integers, the
+** functions work on vectors of integers instead, with the integer
+** arithmetic of the language: results are exact, wrap around on
+** overflow and stay integers (new vectors are then i64 arrays).
+**
+** The kernels for sums, dot products, extrema and elementwise
+** operations are selected when the library is opened, among SSE2, AVX2
+** and AVX-512 versions (x86-64 with gcc or clang) and a scalar one.
+** Wider kernels add in a different order, so sums and dot products can
+** differ in the last bits from one machine to another.
+*/
+
+
+#define ARRAYNAME	"array"
+
+
+#if SIL_FLOAT_TYPE == SIL_FLOAT_DOUBLE
+#define F64DIRECT	1	/* f64 arrays can be used in place */
+#else
+#define F64DIRECT	0
+#endif
+
+#if F64DIRECT && (defined(__GNUC__) || defined(__clang__)) && \
+    defined(__x86_64__)
+#define VEC_X86		1
+#include <immintrin.h>
+#else
+#define VEC_X86		0
+#endif
+
+
+
+/*
+** {======================================================
+** Kernels
+** =======================================================
+*/
+
+typedef struct Kernels {
+  const char *name;
+  sil_Number (*sum) (const sil_Number *x, size_t n);
+  sil_Number (*dot) (const sil_Number *x, const sil_Number *y, size_t n);
+  sil_Number (*min) (const sil_Number *x, size_t n);  /* 'n' > 0 */
+  sil_Number (*max) (const sil_Number *x, size_t n);  /* 'n' > 0 */
+  void (*axpy) (sil_Number a, const sil_Number *x, sil_Number *y, size_t n);
+  void (*scale) (sil_Number a, sil_Number *x, size_t n);
+  void (*add) (const sil_Number *x, const sil_Number *y, sil_Number *z,
+               size_t n);
+  void (*mul) (const sil_Number *x, const sil_Number *y, sil_Number *z,
+               size_t n);
+} Kernels;
+
+
+/* same results as 'minpd'/'maxpd' (second operand if any is NaN) */
+#define nummin(a,b)	((a) < (b) ? (a) : (b))
+#define nummax(a,b)	((a) > (b) ? (a) : (b))
+
+
+static sil_Number sum_scalar (const sil_Number *x, size_t n) {
+  sil_Number s = 0;
+  size_t i;
+  for (i = 0; i < n; i++)
+    s += x[i];
+  return s;
+}
+
+static sil_Number dot_scalar (const sil_Number *x, const sil_Number *y,
+                              size_t n) {
+  sil_Number s = 0;
+  size_t i;
+  for (i = 0; i < n; i++)
+    s += x[i] * y[i];
+  return s;
+}
+
+static sil_Number min_scalar (const sil_Number *x, size_t n) {
+  sil_Number m = x[0];
+  size_t i;
+  for (i = 1; i < n; i++)
+    m = nummin(x[i], m);
+  return m;
+}
+
+static sil_Number max_scalar (const sil_Number *x, size_t n) {
+  sil_Number m = x[0];
+  size_t i;
+  for (i = 1; i < n; i++)
+    m = nummax(x[i], m);
+  return m;
+}
+
+static void axpy_scalar (sil_Number a, const sil_Number *x, sil_Number *y,
+                         size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    y[i] = a * x[i] + y[i];
+}
+
+static void scale_scalar (sil_Number a, sil_Number *x, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    x[i] = a * x[i];
+}
+
+static void add_scalar (const sil_Number *x, const sil_Number *y,
+                        sil_Number *z, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    z[i] = x[i] + y[i];
+}
+
+static void mul_scalar (const sil_Number *x, const sil_Number *y,
+                        sil_Number *z, size_t n) {
+  size_t i;
+  for (i = 0; i < n; i++)
+    z[i] = x[i] * y[i];
+}
+
+static const Kernels k_scalar = {
+  "scalar", sum_scalar, dot_scalar, min_scalar, max_scalar,
+  axpy_scalar, scale_scalar, add_scalar, mul_scalar
+};
+
+
+#if VEC_X86
+
+/*
+** SIMD kernels, instantiated for each instruction set with its vector
+** type 'VT' of 'W' doubles and its intrinsics. Reductions keep two
+** accumulators to hide the latency of additions; the last 'n % W'
+** elements (at most) go through the scalar code.
+*/
+#define SIMDKERNELS(isa,attr,VT,W,LOAD,STORE,SET1,ADD,MUL,MIN,MAX) \
+attr static sil_Number sum_##isa (const sil_Number *x, size_t n) { \
+  VT s0 = SET1(0.0), s1 = SET1(0.0); \
+  sil_Number r[W]; \
+  sil_Number s = 0; \
+  size_t i; \
+  int k; \
+  for (i = 0; i + 2 * W <= n; i += 2 * W) { \
+    s0 = ADD(s0, LOAD(x + i)); \
+    s1 = ADD(s1, LOAD(x + i + W)); \
+  } \
+  STORE(r, ADD(s0, s1)); \
+  for (k = 0; k < W; k++) s += r[k]; \
+  return s + sum_scalar(x + i, n - i); \
+} \
+attr static sil_Number dot_##isa (const sil_Number *x, const sil_Number *y, \
+                                  size_t n) { \
+  VT s0 = SET1(0.0), s1 = SET1(0.0); \
+  sil_Number r[W]; \
+  sil_Number s = 0; \
+  size_t i; \
+  int k; \
+  for (i = 0; i + 2 * W <= n; i += 2 * W) { \
+    s0 = ADD(s0, MUL(LOAD(x + i), LOAD(y + i))); \
+    s1 = ADD(s1, MUL(LOAD(x + i + W), LOAD(y + i + W))); \
+  } \
+  STORE(r, ADD(s0, s1)); \
+  for (k = 0; k < W; k++) s += r[k]; \
+  return s + dot_scalar(x + i, y + i, n - i); \
+} \
+attr static sil_Number min_##isa (const sil_Number *x, size_t n) { \
+  VT m = SET1(x[0]); \
+  sil_Number r[W]; \
+  size_t i; \
+  int k; \
+  for (i = 0; i + W <= n; i += W) \
+    m = MIN(LOAD(x + i), m); \
+  STORE(r, m); \
+  for (k = 1; k < W; k++) r[0] = nummin(r[k], r[0]); \
+  for (; i < n; i++) r[0] = nummin(x[i], r[0]); \
+  return r[0]; \
+} \
+attr static sil_Number max_##isa (const sil_Number *x, size_t n) { \
+  VT m = SET1(x[0]); \
+  sil_Number r[W]; \
+  size_t i; \
+  int k; \
+  for (i = 0; i + W <= n; i += W) \
+    m = MAX(LOAD(x + i), m); \
+  STORE(r, m); \
+  for (k = 1; k < W; k++) r[0] = nummax(r[k], r[0]); \
+  for (; i < n; i++) r[0] = nummax(x[i], r[0]); \
+  return r[0]; \
+} \
+attr static void axpy_##isa (sil_Number a, const sil_Number *x, \
+                             sil_Number *y, size_t n) { \
+  VT va = SET1(a); \
+  size_t i; \
+  for (i = 0; i + W <= n; i += W) \
+    STORE(y + i, ADD(MUL(va, LOAD(x + i)), LOAD(y + i))); \
+  axpy_scalar(a, x + i, y + i, n - i); \
+} \
+attr static void scale_##isa (sil_Number a, sil_Number *x, size_t n) { \
+  VT va = SET1(a); \
+  size_t i; \
+  for (i = 0; i + W <= n; i += W) \
+    STORE(x + i, MUL(va, LOAD(x + i))); \
+  scale_scalar(a, x + i, n - i); \
+} \
+attr static void add_##isa (const sil_Number *x, const sil_Number *y, \
+                            sil_Number *z, size_t n) { \
+  size_t i; \
+  for (i = 0; i + W <= n; i += W) \
+    STORE(z + i, ADD(LOAD(x + i), LOAD(y + i))); \
+  add_scalar(x + i, y + i, z + i, n - i); \
+} \
+attr static void mul_##isa (const sil_Number *x, const sil_Number *y, \
+                            sil_Number *z, size_t n) { \
+  size_t i; \
+  for (i = 0; i + W <= n; i += W) \
+    STORE(z + i, MUL(LOAD(x + i), LOAD(y + i))); \
+  mul_scalar(x + i, y + i, z + i, n - i); \
+} \
+static const Kernels k_##isa = { \
+  #isa, sum_##isa, dot_##isa, min_##isa, max_##isa, \
+  axpy_##isa, scale_##isa, add_##isa, mul_##isa \
+};
+
+
+SIMDKERNELS(sse2, , __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+            _mm_add_pd, _mm_mul_pd, _mm_min_pd, _mm_max_pd)
+
+SIMDKERNELS(avx2, __attribute__((target("avx2"))), __m256d, 4,
+            _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+            _mm256_add_pd, _mm256_mul_pd, _mm256_min_pd, _mm256_max_pd)
+
+SIMDKERNELS(avx512, __attribute__((target("avx512f"))), __m512d, 8,
+            _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+            _mm512_add_pd, _mm512_mul_pd, _mm512_min_pd, _mm512_max_pd)
+
+#endif
+
+
+/* choose the widest kernels the machine supports */
+static const Kernels *getkernels (void) {
+#if VEC_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return &k_avx512;
+  else if (__builtin_cpu_supports("avx2"))
+    return &k_avx2;
+  else if (__builtin_cpu_supports("sse2"))  /* (always, in x86-64) */
+    return &k_sse2;
+  else
+    return &k_scalar;
+#else
+  return &k_scalar;
+#endif
+}
+
+
+#define getK(L)	cast(const Kernels *, sil_touserdata(L, sil_upvalueindex(1)))
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Vectors
+** =======================================================
+*/
+
+typedef struct Vec {
+  sil_Number *v;  /* elements */
+  sil_Integer *iv;  /* elements, for an integer vector */
+  size_t n;  /* number of elements */
+  int arg;  /* stack index of the operand */
+  ArrayHeader *a;  /* the operand, if it is a typed array */
+} Vec;
+
+
+#define isdirect(x)	(F64DIRECT && (x)->a != NULL && (x)->a->h.kind == ARR_F64)
+
+
+/* push a new temporary buffer for 'n' floats */
+static sil_Number *newbuff (sil_State *L, size_t n) {
+  if (l_unlikely(n > MAX_SIZE / sizeof(sil_Number)))
+    silL_error(L, "vector too large");
+  return cast(sil_Number *, sil_newuserdatauv(L, n * sizeof(sil_Number), 0));
+}
+
+
+/* push a new temporary buffer for 'n' integers */
+static sil_Integer *newibuff (sil_State *L, size_t n) {
+  if (l_unlikely(n > MAX_SIZE / sizeof(sil_Integer)))
+    silL_error(L, "vector too large");
+  return cast(sil_Integer *,
+              sil_newuserdatauv(L, n * sizeof(sil_Integer), 0));
+}
+
+
+/* make 'x' refer to the operand at stack index 'arg' */
+static void refvec (sil_State *L, int arg, Vec *x) {
+  x->arg = arg;
+  x->a = cast(ArrayHeader *, silL_testudata(L, arg, ARRAYNAME));
+  if (x->a != NULL)
+    x->n = x->a->h.size;
+  else {
+    silL_argexpected(L, sil_istable(L, arg), arg, "array or table");
+    x->n = cast_sizet(sil_rawlen(L, arg));
+  }
+}
+
+
+/* give 'x' room for its 'n' elements (without their values) */
+static void setbuff (sil_State *L, Vec *x) {
+  if (isdirect(x))
+    x->v = arrelems(x->a, sil_Number);
+  else
+    x->v = newbuff(L, x->n);
+}
+
+
+/* give integer vector 'x' room for its 'n' elements */
+static void setibuff (sil_State *L, Vec *x) {
+  if (x->a != NULL && x->a->h.kind == ARR_I64)
+    x->iv = arrelems(x->a, sil_Integer);
+  else
+    x->iv = newibuff(L, x->n);
+}
+
+
+static int numexpected (sil_State *L, int arg, size_t i) {
+  return silL_argerror(L, arg, sil_pushfstring(L,
+                                 "number expected at index %I",
+                                 cast(sil_Integer, i) + 1));
+}
+
+
+/* get the vector at stack index 'arg' */
+static void getvec (sil_State *L, int arg, Vec *x) {
+  size_t i;
+  refvec(L, arg, x);
+  setbuff(L, x);
+  if (x->a != NULL) {
+    ArrayHeader *a = x->a;
+    switch (a->h.kind) {
+      case ARR_F64:
+        if (!F64DIRECT) {
+          for (i = 0; i < x->n; i++)
+            x->v[i] = cast_num(arrelems(a, double)[i]);
+        }
+        break;
+      case ARR_F32:
+        for (i = 0; i < x->n; i++)
+          x->v[i] = cast_num(arrelems(a, float)[i]);
+        break;
+      case ARR_I64:
+        for (i = 0; i < x->n; i++)
+          x->v[i] = cast_num(arrelems(a, sil_Integer)[i]);
+        break;
+      case ARR_I32:
+        for (i = 0; i < x->n; i++)
+          x->v[i] = cast_num(arrelems(a, l_int32)[i]);
+        break;
+      default:
+        for (i = 0; i < x->n; i++)
+          x->v[i] = cast_num(arrelems(a, lu_byte)[i]);
+        break;
+    }
+  }
+  else {  /* table */
+    i = cast_sizet(sil_rawgetnums(L, arg, x->v, x->n));  /* array part */
+    for (; i < x->n; i++) {  /* rest, one by one */
+      if (l_unlikely(sil_rawgeti(L, arg, cast(sil_Integer, i) + 1)
+                     != SIL_TNUMBER))
+        numexpected(L, arg, i);
+      x->v[i] = sil_tonumber(L, -1);
+      sil_pop(L, 1);
+    }
+  }
+}
+
+
+static sil_Integer tointeger (sil_State *L, sil_Number f) {
+  sil_Integer k = 0;
+  if (l_unlikely(l_mathop(floor)(f) != f || !sil_numbertointeger(f, &k)))
+    silL_error(L, "result has no integer representation");
+  return k;
+}
+
+
+/* store the elements of 'x' back into its operand */
+static void putvec (sil_State *L, Vec *x) {
+  size_t i;
+  if (isdirect(x))
+    return;  /* already in place */
+  else if (x->a != NULL) {
+    ArrayHeader *a = x->a;
+    if (a->h.kind != ARR_F64 && a->h.kind != ARR_F32) {
+      for (i = 0; i < x->n; i++)  /* check all elements before storing */
+        tointeger(L, x->v[i]);
+    }
+    switch (a->h.kind) {
+      case ARR_F64:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, double)[i] = cast(double, x->v[i]);
+        break;
+      case ARR_F32:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, float)[i] = cast(float, x->v[i]);
+        break;
+      case ARR_I64:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, sil_Integer)[i] = tointeger(L, x->v[i]);
+        break;
+      case ARR_I32:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, l_int32)[i] =
+              cast(l_int32, cast(l_uint32, tointeger(L, x->v[i])));
+        break;
+      default:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, lu_byte)[i] = cast_byte(tointeger(L, x->v[i]));
+        break;
+    }
+  }
+  else {  /* table */
+    i = cast_sizet(sil_rawsetnums(L, x->arg, x->v, x->n));  /* array part */
+    for (; i < x->n; i++) {  /* rest, one by one */
+      sil_pushnumber(L, x->v[i]);
+      sil_rawseti(L, x->arg, cast(sil_Integer, i) + 1);
+    }
+  }
+}
+
+
+/*
+** Get the vector at stack index 'arg' as an integer vector. Return 0,
+** leaving 'x' for 'getvec', if it holds some float.
+*/
+static int getivec (sil_State *L, int arg, Vec *x) {
+  size_t i;
+  refvec(L, arg, x);
+  if (x->a != NULL) {
+    ArrayHeader *a = x->a;
+    switch (a->h.kind) {
+      case ARR_I64:
+        x->iv = arrelems(a, sil_Integer);
+        break;
+      case ARR_I32:
+        x->iv = newibuff(L, x->n);
+        for (i = 0; i < x->n; i++)
+          x->iv[i] = arrelems(a, l_int32)[i];
+        break;
+      case ARR_U8:
+        x->iv = newibuff(L, x->n);
+        for (i = 0; i < x->n; i++)
+          x->iv[i] = arrelems(a, lu_byte)[i];
+        break;
+      default:  /* float arrays */
+        return 0;
+    }
+  }
+  else {  /* table */
+    x->iv = newibuff(L, x->n);
+    i = cast_sizet(sil_rawgetints(L, arg, x->iv, x->n));  /* array part */
+    for (; i < x->n; i++) {  /* rest, one by one */
+      if (l_unlikely(sil_rawgeti(L, arg, cast(sil_Integer, i) + 1)
+                     != SIL_TNUMBER))
+        numexpected(L, arg, i);
+      if (!sil_isinteger(L, -1))
+        return 0;
+      x->iv[i] = sil_tointeger(L, -1);
+      sil_pop(L, 1);
+    }
+  }
+  return 1;
+}
+
+
+/* store the elements of integer vector 'x' back into its operand */
+static void putivec (sil_State *L, Vec *x) {
+  size_t i;
+  if (x->a != NULL) {
+    ArrayHeader *a = x->a;
+    switch (a->h.kind) {
+      case ARR_F64:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, double)[i] = cast(double, x->iv[i]);
+        break;
+      case ARR_F32:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, float)[i] = cast(float, x->iv[i]);
+        break;
+      case ARR_I64:  /* already in place */
+        sil_assert(x->iv == arrelems(a, sil_Integer));
+        break;
+      case ARR_I32:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, l_int32)[i] = cast(l_int32, cast(l_uint32, x->iv[i]));
+        break;
+      default:
+        for (i = 0; i < x->n; i++)
+          arrelems(a, lu_byte)[i] = cast_byte(x->iv[i]);
+        break;
+    }
+  }
+  else {  /* table */
+    i = cast_sizet(sil_rawsetints(L, x->arg, x->iv, x->n));  /* array part */
+    for (; i < x->n; i++) {  /* rest, one by one */
+      sil_pushinteger(L, x->iv[i]);
+      sil_rawseti(L, x->arg, cast(sil_Integer, i) + 1);
+    }
+  }
+}
+
+
+/*
+** Push a new vector with 'n' elements, of kind 'kind' (f64, i64 or u8)
+** if 'like' is a typed array or a table otherwise, and make 'z' refer
+** to it. (Only f64 and i64 vectors get a buffer.)
+*/
+static void newvec (sil_State *L, const Vec *like, int kind, size_t n,
+                    Vec *z) {
+  if (like->a != NULL) {
+    size_t esize = (kind == ARR_U8) ? sizeof(lu_byte)
+                 : (kind == ARR_I64) ? sizeof(sil_Integer) : sizeof(double);
+    ArrayHeader *a;
+    sil_assert(kind == ARR_F64 || kind == ARR_I64 || kind == ARR_U8);
+    if (l_unlikely(n > (MAX_SIZE - sizeof(ArrayHeader)) / esize))
+      silL_error(L, "vector too large");
+    a = cast(ArrayHeader *, sil_newuserdatauv(L, sizeof(ArrayHeader) +
+                                                 n * esize, 0));
+    a->h.size = n;
+    a->h.kind = cast_byte(kind);
+    silL_setmetatable(L, ARRAYNAME);
+  }
+  else {
+    if (l_unlikely(n > cast_sizet(INT_MAX)))
+      silL_error(L, "vector too large");
+    sil_createtable(L, cast_int(n), 0);
+  }
+  refvec(L, sil_gettop(L), z);
+  z->n = n;  /* (a new table has length 0) */
+  if (kind == ARR_F64)
+    setbuff(L, z);
+  else if (kind == ARR_I64)
+    setibuff(L, z);
+}
+
+
+/*
+** Get the output vector for a result with 'n' elements: the operand
+** at 'arg', if given, or a new vector like 'like'.
+*/
+static void getout (sil_State *L, int arg, const Vec *like, size_t n,
+                    Vec *z) {
+  if (sil_isnoneornil(L, arg))
+    newvec(L, like, ARR_F64, n, z);
+  else {
+    refvec(L, arg, z);
+    if (z->a == NULL)  /* table? */
+      z->n = n;  /* result may change its length */
+    else
+      silL_argcheck(L, z->n == n, arg, "vectors of different lengths");
+    setbuff(L, z);
+  }
+}
+
+
+/* same as 'getout', for an integer result */
+static void getiout (sil_State *L, int arg, const Vec *like, size_t n,
+                     Vec *z) {
+  if (sil_isnoneornil(L, arg))
+    newvec(L, like, ARR_I64, n, z);
+  else {
+    refvec(L, arg, z);
+    if (z->a == NULL)  /* table? */
+      z->n = n;  /* result may change its length */
+    else
+      silL_argcheck(L, z->n == n, arg, "vectors of different lengths");
+    setibuff(L, z);
+  }
+}
+
+
+static void checksamelen (sil_State *L, const Vec *x, const Vec *y) {
+  silL_argcheck(L, x->n == y->n, y->arg, "vectors of different lengths");
+}
+
+/* }====================================================== */
+
+
+
+#define intop(op,v1,v2)	l_castU2S(l_castS2U(v1) op l_castS2U(v2))
+
+
+/* vec.sum(x) */
+static int vec_sum (sil_State *L) {
+  Vec x;
+  if (getivec(L, 1, &x)) {
+    sil_Integer s = 0;
+    size_t i;
+    for (i = 0; i < x.n; i++)
+      s = intop(+, s, x.iv[i]);
+    sil_pushinteger(L, s);
+  }
+  else {
+    getvec(L, 1, &x);
+    sil_pushnumber(L, getK(L)->sum(x.v, x.n));
+  }
+  return 1;
+}
+
+
+/* vec.dot(x, y) */
+static int vec_dot (sil_State *L) {
+  Vec x, y;
+  if (getivec(L, 1, &x) && getivec(L, 2, &y)) {
+    sil_Integer s = 0;
+    size_t i;
+    checksamelen(L, &x, &y);
+    for (i = 0; i < x.n; i++)
+      s = intop(+, s, intop(*, x.iv[i], y.iv[i]));
+    sil_pushinteger(L, s);
+  }
+  else {
+    getvec(L, 1, &x);
+    getvec(L, 2, &y);
+    checksamelen(L, &x, &y);
+    sil_pushnumber(L, getK(L)->dot(x.v, y.v, x.n));
+  }
+  return 1;
+}
+
+
+static int extremum (sil_State *L, int max) {
+  Vec x;
+  if (getivec(L, 1, &x)) {
+    sil_Integer m;
+    size_t i;
+    if (x.n == 0) {
+      sil_pushnil(L);
+      return 1;
+    }
+    m = x.iv[0];
+    for (i = 1; i < x.n; i++) {
+      if (max ? x.iv[i] > m : x.iv[i] < m)
+        m = x.iv[i];
+    }
+    sil_pushinteger(L, m);
+  }
+  else {
+    getvec(L, 1, &x);
+    if (x.n == 0)
+      sil_pushnil(L);
+    else if (max)
+      sil_pushnumber(L, getK(L)->max(x.v, x.n));
+    else
+      sil_pushnumber(L, getK(L)->min(x.v, x.n));
+  }
+  return 1;
+}
+
+
+/* vec.min(x): smallest element, or nil if 'x' is empty */
+static int vec_min (sil_State *L) {
+  return extremum(L, 0);
+}
+
+
+/* vec.max(x): largest element, or nil if 'x' is empty */
+static int vec_max (sil_State *L) {
+  return extremum(L, 1);
+}
+
+
+/* vec.axpy(a, x, y): y = a*x + y; returns 'y' */
+static int vec_axpy (sil_State *L) {
+  Vec x, y;
+  if (sil_isinteger(L, 1) && getivec(L, 2, &x) && getivec(L, 3, &y)) {
+    sil_Integer a = sil_tointeger(L, 1);
+    size_t i;
+    checksamelen(L, &x, &y);
+    for (i = 0; i < x.n; i++)
+      y.iv[i] = intop(+, intop(*, a, x.iv[i]), y.iv[i]);
+    putivec(L, &y);
+  }
+  else {
+    sil_Number a = silL_checknumber(L, 1);
+    getvec(L, 2, &x);
+    getvec(L, 3, &y);
+    checksamelen(L, &x, &y);
+    getK(L)->axpy(a, x.v, y.v, x.n);
+    putvec(L, &y);
+  }
+  sil_settop(L, 3);
+  return 1;
+}
+
+
+/* vec.scale(a, x): x = a*x; returns 'x' */
+static int vec_scale (sil_State *L) {
+  Vec x;
+  if (sil_isinteger(L, 1) && getivec(L, 2, &x)) {
+    sil_Integer a = sil_tointeger(L, 1);
+    size_t i;
+    for (i = 0; i < x.n; i++)
+      x.iv[i] = intop(*, a, x.iv[i]);
+    putivec(L, &x);
+  }
+  else {
+    sil_Number a = silL_checknumber(L, 1);
+    getvec(L, 2, &x);
+    getK(L)->scale(a, x.v, x.n);
+    putvec(L, &x);
+  }
+  sil_settop(L, 2);
+  return 1;
+}
+
+
+static int elementwise (sil_State *L, int mul) {
+  const Kernels *K = getK(L);
+  Vec x, y, z;
+  sil_settop(L, 3);  /* buffers go above the arguments */
+  if (getivec(L, 1, &x) && getivec(L, 2, &y)) {
+    size_t i;
+    checksamelen(L, &x, &y);
+    getiout(L, 3, &x, x.n, &z);
+    if (mul) {
+      for (i = 0; i < x.n; i++)
+        z.iv[i] = intop(*, x.iv[i], y.iv[i]);
+    }
+    else {
+      for (i = 0; i < x.n; i++)
+        z.iv[i] = intop(+, x.iv[i], y.iv[i]);
+    }
+    putivec(L, &z);
+  }
+  else {
+    getvec(L, 1, &x);
+    getvec(L, 2, &y);
+    checksamelen(L, &x, &y);
+    getout(L, 3, &x, x.n, &z);
+    if (mul)
+      K->mul(x.v, y.v, z.v, x.n);
+    else
+      K->add(x.v, y.v, z.v, x.n);
+    putvec(L, &z);
+  }
+  sil_pushvalue(L, z.arg);
+  return 1;
+}
+
+
+/* vec.add(x, y [, z]): z = x + y; returns 'z' (default a new vector) */
+static int vec_add (sil_State *L) {
+  return elementwise(L, 0);
+}
+
+
+/* vec.mul(x, y [, z]): z = x * y; returns 'z' (default a new vector) */
+static int vec_mul (sil_State *L) {
+  return elementwise(L, 1);
+}
+
+
+/*
+** vec.prefixsum(x [, z]): z[i] = x[1] + ... + x[i]; returns 'z'
+** (default a new vector). Each sum depends on the previous one, so
+** this kernel is scalar.
+*/
+static int vec_prefixsum (sil_State *L) {
+  Vec x, z;
+  size_t i;
+  sil_settop(L, 2);  /* buffers go above the arguments */
+  if (getivec(L, 1, &x)) {
+    sil_Integer s = 0;
+    getiout(L, 2, &x, x.n, &z);
+    for (i = 0; i < x.n; i++) {
+      s = intop(+, s, x.iv[i]);
+      z.iv[i] = s;
+    }
+    putivec(L, &z);
+  }
+  else {
+    sil_Number s = 0;
+    getvec(L, 1, &x);
+    getout(L, 2, &x, x.n, &z);
+    for (i = 0; i < x.n; i++) {
+      s += x.v[i];
+      z.v[i] = s;
+    }
+    putvec(L, &z);
+  }
+  sil_pushvalue(L, z.arg);
+  return 1;
+}
+
+
+/* m[i] = (x[i] op v), in loops simple enough for the compiler to vectorize */
+#define cmpkernel(op,m,x,v,n)  \
+  switch (op) {  \
+    case 0: for (i = 0; i < (n); i++) (m)[i] = ((x)[i] < (v)); break;  \
+    case 1: for (i = 0; i < (n); i++) (m)[i] = ((x)[i] <= (v)); break;  \
+    case 2: for (i = 0; i < (n); i++) (m)[i] = ((x)[i] > (v)); break;  \
+    case 3: for (i = 0; i < (n); i++) (m)[i] = ((x)[i] >= (v)); break;  \
+    case 4: for (i = 0; i < (n); i++) (m)[i] = ((x)[i] == (v)); break;  \
+    default: for (i = 0; i < (n); i++) (m)[i] = ((x)[i] != (v)); break;  \
+  }
+
+
+/*
+** vec.cmp(x, op, v): mask with 1 where 'x[i] op v' and 0 elsewhere,
+** as a new u8 array (or a table of integers, if 'x' is a table);
+** 'op' is one of "<", "<=", ">", ">=", "==" and "!=".
+*/
+static int vec_cmp (sil_State *L) {
+  static const char *const opnames[] = {"<", "<=", ">", ">=", "==", "!=",
+                                        NULL};
+  int op = silL_checkoption(L, 2, NULL, opnames);
+  Vec x, z;
+  lu_byte *m;
+  size_t i;
+  int isint = sil_isinteger(L, 3) && getivec(L, 1, &x);
+  sil_Number v = silL_checknumber(L, 3);
+  if (!isint)
+    getvec(L, 1, &x);
+  newvec(L, &x, ARR_U8, x.n, &z);
+  m = (z.a != NULL) ? arrelems(z.a, lu_byte)
+                    : cast(lu_byte *, sil_newuserdatauv(L, x.n, 0));
+  if (isint) {
+    sil_Integer iv = sil_tointeger(L, 3);
+    cmpkernel(op, m, x.iv, iv, x.n);
+  }
+  else {
+    cmpkernel(op, m, x.v, v, x.n);
+  }
+  if (z.a == NULL) {  /* result is a table? */
+    for (i = 0; i < x.n; i++) {
+      sil_pushinteger(L, m[i]);
+      sil_rawseti(L, z.arg, cast(sil_Integer, i) + 1);
+    }
+  }
+  sil_pushvalue(L, z.arg);
+  return 1;
+}
+
+
+/*
+** vec.gather(x, idx [, z]): z[i] = x[idx[i]]; returns 'z' (default a
+** new vector). All indices are checked before 'z' is written. 'z' may
+** be 'x' itself.
+*/
+static int vec_gather (sil_State *L) {
+  Vec x, idx, z;
+  size_t i;
+  int isint;
+  sil_settop(L, 3);  /* buffers go above the arguments */
+  isint = getivec(L, 1, &x);
+  if (!isint)
+    getvec(L, 1, &x);
+  getvec(L, 2, &idx);
+  for (i = 0; i < idx.n; i++) {
+    sil_Number f = idx.v[i];
+    if (l_unlikely(!(1 <= f && f <= cast_num(x.n)) ||
+                   l_mathop(floor)(f) != f))
+      return silL_argerror(L, 2, sil_pushfstring(L,
+                                   "invalid index at position %I",
+                                   cast(sil_Integer, i) + 1));
+  }
+  if (isint) {
+    const sil_Integer *src = x.iv;
+    getiout(L, 3, &x, idx.n, &z);
+    if (z.iv == x.iv) {  /* gathering in place? */
+      sil_Integer *buff = newibuff(L, x.n);
+      memcpy(buff, x.iv, x.n * sizeof(sil_Integer));
+      src = buff;
+    }
+    for (i = 0; i < idx.n; i++)
+      z.iv[i] = src[cast_sizet(idx.v[i]) - 1];
+    putivec(L, &z);
+  }
+  else {
+    const sil_Number *src = x.v;
+    getout(L, 3, &x, idx.n, &z);
+    if (z.v == x.v) {  /* gathering in place? */
+      sil_Number *buff = newbuff(L, x.n);
+      memcpy(buff, x.v, x.n * sizeof(sil_Number));
+      src = buff;
+    }
+    for (i = 0; i < idx.n; i++)
+      z.v[i] = src[cast_sizet(idx.v[i]) - 1];
+    putvec(L, &z);
+  }
+  sil_pushvalue(L, z.arg);
+  return 1;
+}
+
+
+static const silL_Reg vec_funcs[] = {
+  {"sum", vec_sum},
+  {"dot", vec_dot},
+  {"min", vec_min},
+  {"max", vec_max},
+  {"axpy", vec_axpy},
+  {"scale", vec_scale},
+  {"add", vec_add},
+  {"mul", vec_mul},
+  {"prefixsum", vec_prefixsum},
+  {"cmp", vec_cmp},
+  {"gather", vec_gather},
+  /* placeholders */
+  {"isa", NULL},
+  {NULL, NULL}
+};
+
+
+SILMOD_API int silopen_vec (sil_State *L) {
+  const Kernels *K = getkernels();
+  silL_newlibtable(L, vec_funcs);
+  sil_pushlightuserdata(L, cast(void *, K));
+  silL_setfuncs(L, vec_funcs, 1);  /* kernels are upvalue of all functions */
+  sil_pushstring(L, K->name);
+  sil_setfield(L, -2, "isa");
+  return 1;
+}
+
@@ -23,6 +23,8 @@
 #include "ldo.h"
 #include "lfunc.h"
 #include "lgc.h"
+#include "larray.h"
+#include "ljit.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -31,6 +33,10 @@
 #include "ltm.h"
 #include "lvm.h"
 
+#if SIL_USE_OPSTATS > 1
+#include <x86intrin.h>  /* for '__rdtsc' */
+#endif
+
 
 /*
 ** By default, use jump tables in the main interpreter loop on gcc
@@ -45,6 +51,41 @@
 #endif
 
 
+/*
+** Direct threading (which needs jump tables) gives each prototype, on
+** its first run, a side array with the address of the handler of each
+** instruction, so that dispatch jumps through the entry of the current
+** position and does not wait for the instruction to decode its opcode.
+** It is off by default.
+*/
+#if !defined(SIL_USE_THREADED)
+#define SIL_USE_THREADED	0
+#elif SIL_USE_THREADED && !SIL_USE_JUMPTABLE
+#undef SIL_USE_THREADED
+#define SIL_USE_THREADED	0
+#endif
+
+
+
+/*
+** Quickening (see the note about quickened opcodes in lopcodes.h) is
+** off by default: recording operand types costs a little in every
+** generic arithmetic and order instruction, which only pays off in
+** monomorphic numeric code.
+*/
+#if !defined(SIL_USE_QUICKEN)
+#define SIL_USE_QUICKEN		0
+#endif
+
+
+/*
+** Number of consecutive executions with the same operand types before
+** an instruction is quickened.
+*/
+#if !defined(SILI_QUICKENLIMIT)
+#define SILI_QUICKENLIMIT	16
+#endif
+
 
 /* limit for table tag-method chains (to avoid infinite loops) */
 #define MAXTAGLOOP	2000
@@ -285,11 +326,151 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** Try to do the call of a generic for loop (see OP_TFORCALL) without
+** calling its iterator, when it is the original 'next' or the iterator
+** of 'ipairs' over a table. Returns false if the call must be done.
+** For 'next', the closing variable (always nil or false for these
+** loops) keeps the traversal position, so that each step does not
+** need to search the key in the table. For 'ipairs', only the present
+** values are read here; an absent one (the end of the loop or a
+** possible '__index') goes through the call. With call or return
+** hooks set, the iterator is always called, so that the hooks see it.
+*/
+static int forcall (sil_State *L, StkId ra, int nres) {
+  const TValue *f = s2v(ra);
+  Table *t;
+  if (!ttislcf(f) || !ttistable(s2v(ra + 1)) ||
+      (L->hookmask & (SIL_MASKCALL | SIL_MASKRET)))
+    return 0;
+  t = hvalue(s2v(ra + 1));
+  if (fvalue(f) == G(L)->builtin[SIL_BINEXT]) {
+    TValue *pos = s2v(ra + 2);
+    unsigned hint;
+    if (ttisinteger(pos))
+      hint = cast_uint(ivalue(pos));
+    else if (ttisnil(pos))
+      hint = 0;
+    else
+      return 0;
+    switch (silH_nextfrom(L, t, ra + 3, &hint)) {
+      case -1: return 0;  /* lost position; 'next' must find the key */
+      case 0: setnilvalue(s2v(ra + 3)); break;  /* end of the loop */
+      default: break;
+    }
+    setivalue(pos, cast(sil_Integer, hint));
+  }
+  else if (fvalue(f) == G(L)->builtin[SIL_BIIPAIRS]) {
+    TValue *ctl = s2v(ra + 3);
+    sil_Integer n;
+    lu_byte tag;
+    if (!ttisinteger(ctl))
+      return 0;
+    n = intop(+, ivalue(ctl), 1);
+    silH_fastgeti(t, n, s2v(ra + 4), tag);
+    if (tagisempty(tag))
+      return 0;
+    setivalue(ctl, n);
+  }
+  else
+    return 0;
+  for (; nres > 2; nres--)  /* other variables get nil */
+    setnilvalue(s2v(ra + 2 + nres));
+  return 1;
+}
+
+
+/*
+** {==================================================================
+** Typed arrays
+** ===================================================================
+*/
+
+/*
+** Is 'o' a typed array (see 'larray.h')? The VM reads and writes
+** their elements in place, without calling their metamethods, when
+** the key is an integer in range and, for a write, the value can be
+** stored without a conversion that could fail. The metatable is enough
+** to tell: 'sil_setmetatable' gives it only to userdata with the
+** layout of a typed array (see 'arrisvalid').
+*/
+#define ttisarray(L,o)  \
+	(ttisfulluserdata(o) && uvalue(o)->metatable == G(L)->arraymt && \
+	 G(L)->arraymt != NULL)
+
+#define arrayof(o)	cast(ArrayHeader *, getudatamem(uvalue(o)))
+
+
+/*
+** Try 'res = a[k]' for a typed array 'a'; return false if 'k' is out
+** of bounds.
+*/
+l_sinline int arraygeti (const TValue *o, sil_Integer k, TValue *res) {
+  ArrayHeader *a = arrayof(o);
+  size_t i = l_castS2U(k) - 1u;
+  if (l_unlikely(i >= a->h.size))  /* also catches 'k <= 0' */
+    return 0;
+  switch (a->h.kind) {
+    case ARR_F64: setfltvalue(res, cast_num(arrelems(a, double)[i])); break;
+    case ARR_F32: setfltvalue(res, cast_num(arrelems(a, float)[i])); break;
+    case ARR_I64: setivalue(res, arrelems(a, sil_Integer)[i]); break;
+    case ARR_I32: setivalue(res, arrelems(a, l_int32)[i]); break;
+    default: setivalue(res, arrelems(a, lu_byte)[i]); break;
+  }
+  return 1;
+}
+
+
+/*
+** Try 'a[k] = v' for a typed array 'a'; return false if 'k' is out of
+** bounds or if 'v' is not a number of the right type (the metamethod
+** then converts it or raises the error).
+*/
+l_sinline int arrayseti (const TValue *o, sil_Integer k, const TValue *v) {
+  ArrayHeader *a = arrayof(o);
+  size_t i = l_castS2U(k) - 1u;
+  if (l_unlikely(i >= a->h.size))
+    return 0;
+  switch (a->h.kind) {
+    case ARR_F64: case ARR_F32: {
+      sil_Number n;
+      if (ttisfloat(v)) n = fltvalue(v);
+      else if (ttisinteger(v)) n = cast_num(ivalue(v));
+      else return 0;
+      if (a->h.kind == ARR_F64)
+        arrelems(a, double)[i] = cast(double, n);
+      else
+        arrelems(a, float)[i] = cast(float, n);
+      return 1;
+    }
+    default: {
+      sil_Integer n;
+      if (!ttisinteger(v)) return 0;
+      n = ivalue(v);
+      switch (a->h.kind) {
+        case ARR_I64: arrelems(a, sil_Integer)[i] = n; break;
+        case ARR_I32:
+          arrelems(a, l_int32)[i] = cast(l_int32, cast(l_uint32, n));
+          break;
+        default: arrelems(a, lu_byte)[i] = cast_byte(n); break;
+      }
+      return 1;
+    }
+  }
+}
+
+/* }================================================================== */
+
+
 /*
 ** Finish the table access 'val = t[key]' and return the tag of the result.
+** If 'ic' is not NULL, 'key' is a short string and 'ic' is the inline
+** cache of the instruction doing the access; tables reached through
+** '__index' also use that cache. (In a method call, the key is usually
+** absent from the object, so the cache ends up serving its class.)
 */
-lu_byte silV_finishget (sil_State *L, const TValue *t, TValue *key,
-                                      StkId val, lu_byte tag) {
+l_sinline lu_byte finishget (sil_State *L, const TValue *t, TValue *key,
+                             StkId val, lu_byte tag, unsigned int *ic) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
@@ -313,7 +494,10 @@ lu_byte silV_finishget (sil_State *L, const TValue *t, TValue *key,
       return tag;  /* return tag of the result */
     }
     t = tm;  /* else try to access 'tm[key]' */
-    silV_fastget(t, key, s2v(val), silH_get, tag);
+    if (ic != NULL)
+      silV_fastgetcache(t, tsvalue(key), s2v(val), ic, tag);
+    else
+      silV_fastget(t, key, s2v(val), silH_get, tag);
     if (!tagisempty(tag))
       return tag;  /* done */
     /* else repeat (tail call 'silV_finishget') */
@@ -323,6 +507,22 @@ lu_byte silV_finishget (sil_State *L, const TValue *t, TValue *key,
 }
 
 
+lu_byte silV_finishget (sil_State *L, const TValue *t, TValue *key,
+                                      StkId val, lu_byte tag) {
+  return finishget(L, t, key, val, tag, NULL);
+}
+
+
+/*
+** Finish the access 'val = t[key]' of a field instruction with inline
+** cache 'ic'.
+*/
+static lu_byte finishgetfield (sil_State *L, const TValue *t, TValue *key,
+                               StkId val, lu_byte tag, unsigned int *ic) {
+  return finishget(L, t, key, val, tag, ic);
+}
+
+
 /*
 ** Finish a table assignment 't[key] = val'.
 ** About anchoring the table before the call to 'silH_finishset':
@@ -345,7 +545,7 @@ void silV_finishset (sil_State *L, const TValue *t, TValue *key,
         silH_finishset(L, h, key, val, hres);  /* set new value */
         L->top.p--;
         invalidateTMcache(h);
-        silC_barrierback(L, obj2gco(h), val);
+        silC_barrierset(L, h, hres, key, val);
         return;
       }
       /* else will try the metamethod */
@@ -363,7 +563,7 @@ void silV_finishset (sil_State *L, const TValue *t, TValue *key,
     t = tm;  /* else repeat assignment over 'tm' */
     silV_fastset(t, key, val, hres, silH_pset);
     if (hres == HOK) {
-      silV_finishfastset(L, t, val);
+      silV_finishfastset(L, t, key, val);
       return;  /* done */
     }
     /* else 'return silV_finishset(L, t, key, val, slot)' (loop) */
@@ -711,6 +911,12 @@ void silV_objlen (sil_State *L, StkId ra, const TValue *rb) {
       setivalue(s2v(ra), cast_st2S(tsvalue(rb)->u.lnglen));
       return;
     }
+    case SIL_VUSERDATA: {
+      if (ttisarray(L, rb)) {  /* typed array? */
+        setivalue(s2v(ra), cast_st2S(arrayof(rb)->h.size));
+        return;
+      }
+    }  /* FALLTHROUGH */
     default: {  /* try metamethod */
       tm = silT_gettmbyobj(L, rb, TM_LEN);
       if (l_unlikely(notm(tm)))  /* no metamethod? */
@@ -814,13 +1020,75 @@ static void pushclosure (sil_State *L, Proto *p, UpVal **encup, StkId base,
 }
 
 
+/*
+** {==================================================================
+** Quickening
+** ===================================================================
+*/
+
+/*
+** Generic arithmetic and order instructions keep their type feedback
+** in their inline-cache slot: the kind of their last operands in the
+** two lower bits and, above them, how many consecutive times they saw
+** that kind.
+*/
+#define QK_OTHER	0u  /* mixed or non-numeric operands */
+#define QK_INT		1u  /* both operands are integers */
+#define QK_FLT		2u  /* both operands are floats */
+#define QK_NEVER	3u  /* do not quicken this instruction (anymore) */
+
+#define qkind(q)	((q) & 3u)
+#define qcount(q)	((q) >> 2)
+
+
+#if SIL_USE_QUICKEN
+
+/*
+** Record the kind of operands 'v1' and 'v2' seen by the generic
+** instruction with feedback slot 'q'. After SILI_QUICKENLIMIT executions
+** with the same kind, rewrite the instruction into its variant 'opi'
+** (integers) or 'opf' (floats), and return true. Code in fixed memory
+** is never changed. (Not inlined, to keep the generic instructions
+** small.)
+*/
+static int quicken (Proto *p, unsigned int *q, const TValue *v1,
+                    const TValue *v2, OpCode opi, OpCode opf) {
+  unsigned int kind;
+  if (qkind(*q) == QK_NEVER)
+    return 0;
+  if (ttisinteger(v1) && ttisinteger(v2))
+    kind = QK_INT;
+  else if (ttisfloat(v1) && ttisfloat(v2))
+    kind = QK_FLT;
+  else
+    kind = QK_OTHER;
+  if (kind == QK_OTHER || qkind(*q) != kind)
+    *q = kind;  /* restart counting */
+  else if (qcount(*q) + 1 < SILI_QUICKENLIMIT)
+    *q += 4u;  /* one more execution with the same kind */
+  else if (p->flag & PF_FIXED)
+    *q = QK_NEVER;
+  else {
+    Instruction *inst = p->code + (q - p->icache);
+    SET_OPCODE(*inst, (kind == QK_INT) ? opi : opf);
+    return 1;  /* instruction was rewritten */
+  }
+  return 0;
+}
+
+#endif
+
+/* }================================================================== */
+
+
 /*
 ** finish execution of an opcode interrupted by a yield
 */
 void silV_finishOp (sil_State *L) {
   CallInfo *ci = L->ci;
   StkId base = ci->func.p + 1;
-  Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
+  /* interrupted instruction (another coroutine may have quickened it) */
+  Instruction inst = silP_unquicken(*(ci->u.l.savedpc - 1));
   OpCode op = GET_OPCODE(inst);
   switch (op) {  /* finish its execution */
     case OP_MMBIN: case OP_MMBINI: case OP_MMBINK: {
@@ -1053,6 +1321,64 @@ void silV_finishOp (sil_State *L) {
   }  \
   docondjump(); }
 
+/*
+** Quickened arithmetic operations with register operands. If the type
+** guard fails, go back to the generic instruction 'gop' and run it.
+*/
+#define op_arithII(L,iop,fop,gop) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {  \
+    StkId ra = RA(i);  \
+    pc++; setivalue(s2v(ra), iop(L, ivalue(v1), ivalue(v2)));  \
+  }  \
+  else {  \
+    deoptimize(gop);  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  }}
+
+
+#define op_arithFF(L,iop,fop,gop) {  \
+  TValue *v1 = vRB(i);  \
+  TValue *v2 = vRC(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    StkId ra = RA(i);  \
+    pc++; setfltvalue(s2v(ra), fop(L, fltvalue(v1), fltvalue(v2)));  \
+  }  \
+  else {  \
+    deoptimize(gop);  \
+    op_arith_aux(L, v1, v2, iop, fop);  \
+  }}
+
+
+/*
+** Quickened order operations with register operands.
+*/
+#define op_orderII(L,opi,opn,other,gop) {  \
+  TValue *v1 = s2v(RA(i));  \
+  TValue *v2 = vRB(i);  \
+  if (l_likely(ttisinteger(v1) && ttisinteger(v2))) {  \
+    int cond = opi(ivalue(v1), ivalue(v2));  \
+    docondjump();  \
+  }  \
+  else {  \
+    deoptimize(gop);  \
+    op_order(L, opi, opn, other);  \
+  }}
+
+
+#define op_orderFF(L,opi,opf,opn,other,gop) {  \
+  TValue *v1 = s2v(RA(i));  \
+  TValue *v2 = vRB(i);  \
+  if (l_likely(ttisfloat(v1) && ttisfloat(v2))) {  \
+    int cond = opf(fltvalue(v1), fltvalue(v2));  \
+    docondjump();  \
+  }  \
+  else {  \
+    deoptimize(gop);  \
+    op_order(L, opi, opn, other);  \
+  }}
+
 /* }================================================================== */
 
 
@@ -1076,6 +1402,143 @@ void silV_finishOp (sil_State *L) {
 #define KC(i)	(k+GETARG_C(i))
 #define RKC(i)	((TESTARG_k(i)) ? k + GETARG_C(i) : s2v(base + GETARG_C(i)))
 
+/* inline cache of the current instruction ('pc' already points to next) */
+#define ICACHE()	(icache + (pc - cl->p->code) - 1)
+
+
+#if SIL_USE_THREADED
+
+/*
+** Build the threaded code of 'p': the handler (from 'disptab') of each
+** of its instructions.
+*/
+static void buildthreaded (sil_State *L, Proto *p,
+                           const void *const *disptab) {
+  const void **th = silM_newvector(L, p->sizecode, const void *);
+  int j;
+  for (j = 0; j < p->sizecode; j++)
+    th[j] = disptab[GET_OPCODE(p->code[j])];
+  p->threaded = th;
+}
+
+#define threadproto(p)  \
+	{ if (l_unlikely((p)->threaded == NULL)) buildthreaded(L, p, disptab); }
+
+/* update the handler of the current instruction after rewriting it */
+#define rethread()  (th[pc - code - 1] = disptab[GET_OPCODE(*(pc - 1))])
+
+#else
+
+#define threadproto(p)	((void)0)
+#define rethread()	((void)0)
+
+#endif
+
+
+/*
+** Record the operand types of a generic instruction that has
+** quickened variants.
+*/
+#if SIL_USE_QUICKEN
+#define quickenop(v1,v2,opi,opf)  \
+	{ if (quicken(cl->p, ICACHE(), v1, v2, opi, opf)) rethread(); }
+#else
+#define quickenop(v1,v2,opi,opf)  ((void)0)
+#endif
+
+
+#if SIL_USE_PROFILE
+
+static lu_byte proftype (const TValue *o) {
+  switch (ttypetag(o)) {
+    case SIL_VNUMINT: return ptbit(PT_INTEGER);
+    case SIL_VNUMFLT: return ptbit(PT_FLOAT);
+    default: switch (ttype(o)) {
+      case SIL_TNIL: return ptbit(PT_NIL);
+      case SIL_TBOOLEAN: return ptbit(PT_BOOLEAN);
+      case SIL_TSTRING: return ptbit(PT_STRING);
+      case SIL_TTABLE: return ptbit(PT_TABLE);
+      case SIL_TFUNCTION: return ptbit(PT_FUNCTION);
+      default: return ptbit(PT_OTHER);
+    }
+  }
+}
+
+
+/*
+** Record in the profile one execution of the instruction just fetched,
+** if it is an arithmetic, comparison, or table instruction, with the
+** types of its two main operands. (Immediate operands are numbers of
+** known type; quickened and fused instructions are recorded as their
+** generic forms.)
+*/
+static void profileop (LClosure *cl, const Instruction *pc, StkId base) {
+  Proto *p = cl->p;
+  TValue *k = p->k;
+  Instruction i = silP_unquicken(*(pc - 1));
+  ProfSite *ps = &p->prof[pc - 1 - p->code];
+  const TValue *v1;
+  const TValue *v2 = NULL;
+  lu_byte t2 = 0;  /* type of an immediate second operand */
+  switch (GET_OPCODE(i)) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_GETTABLE:
+      v1 = vRB(i); v2 = vRC(i); break;
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK: case OP_POWK:
+    case OP_DIVK: case OP_IDIVK: case OP_BANDK: case OP_BORK: case OP_BXORK:
+    case OP_GETFIELD:
+      v1 = vRB(i); v2 = KC(i); break;
+    case OP_ADDI: case OP_SHRI: case OP_SHLI: case OP_GETI:
+      v1 = vRB(i); t2 = ptbit(PT_INTEGER); break;
+    case OP_UNM: case OP_BNOT: case OP_LEN:
+      v1 = vRB(i); break;
+    case OP_SELF:
+      v1 = vRB(i); v2 = RKC(i); break;
+    case OP_GETTABUP:
+      v1 = cl->upvals[GETARG_B(i)]->v.p; v2 = KC(i); break;
+    case OP_EQ: case OP_LT: case OP_LE: case OP_SETTABLE:
+      v1 = s2v(RA(i)); v2 = vRB(i); break;
+    case OP_EQK: case OP_SETFIELD:
+      v1 = s2v(RA(i)); v2 = KB(i); break;
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+      v1 = s2v(RA(i));
+      t2 = GETARG_C(i) ? ptbit(PT_FLOAT) : ptbit(PT_INTEGER);
+      break;
+    case OP_SETI:
+      v1 = s2v(RA(i)); t2 = ptbit(PT_INTEGER); break;
+    case OP_SETTABUP:
+      v1 = cl->upvals[GETARG_A(i)]->v.p; v2 = KB(i); break;
+    default: return;  /* not profiled */
+  }
+  ps->count++;
+  ps->types[0] |= proftype(v1);
+  ps->types[1] |= (v2 != NULL) ? proftype(v2) : t2;
+}
+
+/* count a call to a SIL function */
+#define profcall(p)	((p)->prof[(p)->sizecode].count++)
+/* count a taken back edge of the loop instruction at 'j' */
+#define profedge(j)	(cl->p->prof[(j) - cl->p->code].count++)
+#define profop()	profileop(cl, pc, base)
+
+#else
+
+#define profcall(p)	((void)0)
+#define profedge(j)	((void)0)
+#define profop()	((void)0)
+
+#endif
+
+
+/*
+** Rewrite the current (quickened) instruction back into its generic
+** form 'gop', and never quicken it again.
+*/
+#define deoptimize(gop)  \
+	{ *ICACHE() = QK_NEVER; SET_OPCODE(*cast(Instruction *, pc - 1), gop); \
+	  rethread(); }
+
 
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
@@ -1095,7 +1558,9 @@ void silV_finishOp (sil_State *L) {
 
 
 /* for test instructions, execute the jump instruction that follows it */
-#define donextjump(ci)	{ Instruction ni = *pc; dojump(ci, ni, 1); }
+#define donextjump(ci)	{ Instruction ni = *pc; \
+  if (GETARG_sJ(ni) < 0) profedge(pc); \
+  dojump(ci, ni, 1); }
 
 /*
 ** do a conditional jump: skip next instruction if 'cond' is not what
@@ -1148,6 +1613,64 @@ void silV_finishOp (sil_State *L) {
            sili_threadyield(L); }
 
 
+#if SIL_USE_JIT
+
+/* count a call to a SIL function towards compiling it */
+#define jitcall(p)  \
+	{ if (l_likely((p)->hotcount < SILI_JITHOT)) (p)->hotcount++; }
+
+/*
+** A back edge just jumped to 'pc'. Run the loop natively if it has
+** been compiled; otherwise count the iteration towards compiling the
+** function. Native code cannot run while tracing.
+*/
+#define jitloop(ci)  { Proto *jp = cl->p; \
+  if (jp->jit != NULL) { \
+    if (!trap && silJ_enterable(jp->jit, pc - jp->code)) { \
+      pc = jp->code + silJ_run(jp->jit, ci, base, cast_int(pc - jp->code)); \
+      updatetrap(ci); \
+    } \
+  } \
+  else if (l_likely(jp->hotcount < SILI_JITHOT)) jp->hotcount++; \
+  else if (!trap) Protect(silJ_compile(L, jp)); }
+
+#else
+
+#define jitcall(p)	((void)0)
+#define jitloop(ci)	((void)0)
+
+#endif
+
+
+/*
+** Count the execution of instruction 'i' in the opcode statistics
+** and, with SIL_USE_OPSTATS > 1, charge the cycles since the previous
+** fetch to the previous opcode.
+*/
+#if SIL_USE_OPSTATS
+
+#if SIL_USE_OPSTATS > 1
+#define opcycles(s)  { unsigned long long now_ = __rdtsc(); \
+  if ((s)->lastop >= 0) (s)->cycles[(s)->lastop] += now_ - (s)->lasttsc; \
+  (s)->lasttsc = now_; }
+#else
+#define opcycles(s)	((void)0)
+#endif
+
+#define opstat(i)  { OpStats *s_ = G(L)->opstats; \
+  int op_ = cast_int(GET_OPCODE(i)); \
+  opcycles(s_); \
+  s_->count[op_]++; \
+  if (s_->lastop >= 0) s_->pairs[s_->lastop][op_]++; \
+  s_->lastop = op_; }
+
+#else
+
+#define opstat(i)	((void)0)
+
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
@@ -1155,27 +1678,94 @@ void silV_finishOp (sil_State *L) {
     updatebase(ci);  /* correct stack */ \
   } \
   i = *(pc++); \
+  opstat(i); \
+  profop(); \
 }
 
 #define vmdispatch(o)	switch(o)
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/*
+** Finish a superinstruction: unless tracing (which needs the full
+** 'vmfetch'), fetch its second instruction, known to be 'l', and go
+** straight to its handler, which must be a 'vmcasefused'. (Profiling
+** also needs the full 'vmfetch'.)
+*/
+#if SIL_USE_PROFILE
+#define vmfuse(l)	((void)0)
+#define vmcasefused(l)	vmcase(l)
+#else
+#define vmfuse(l)  \
+	{ if (l_likely(!trap)) { i = *(pc++); opstat(i); goto fused_##l; } }
+#define vmcasefused(l)	vmcase(l) fused_##l:
+#endif
+
+
+/*
+** Field accesses, shared by their opcodes and superinstructions
+*/
+#define op_gettabup(L) {  \
+  StkId ra = RA(i);  \
+  TValue *upval = cl->upvals[GETARG_B(i)]->v.p;  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  lu_byte tag;  \
+  silV_fastgetcache(upval, key, s2v(ra), ICACHE(), tag);  \
+  if (tagisempty(tag))  \
+    Protect(finishgetfield(L, upval, rc, ra, tag, ICACHE())); }
+
+
+#define op_getfield(L) {  \
+  StkId ra = RA(i);  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  lu_byte tag;  \
+  silV_fastgetcache(rb, key, s2v(ra), ICACHE(), tag);  \
+  if (tagisempty(tag))  \
+    Protect(finishgetfield(L, rb, rc, ra, tag, ICACHE())); }
+
+
+#define op_self(L) {  \
+  StkId ra = RA(i);  \
+  lu_byte tag;  \
+  TValue *rb = vRB(i);  \
+  TValue *rc = KC(i);  \
+  TString *key = tsvalue(rc);  /* key must be a short string */  \
+  setobj2s(L, ra + 1, rb);  \
+  silV_fastgetcache(rb, key, s2v(ra), ICACHE(), tag);  \
+  if (tagisempty(tag))  \
+    Protect(finishgetfield(L, rb, rc, ra, tag, ICACHE())); }
+
 
 void silV_execute (sil_State *L, CallInfo *ci) {
   LClosure *cl;
   TValue *k;
+  unsigned int *icache;
   StkId base;
   const Instruction *pc;
+#if SIL_USE_THREADED
+  const void **th;  /* threaded code */
+  const Instruction *code;  /* start of the code 'th' parallels */
+#endif
   int trap;
 #if SIL_USE_JUMPTABLE
 #include "ljumptab.h"
 #endif
  startfunc:
   trap = L->hookmask;
+  jitcall(ci_func(ci)->p);
+  profcall(ci_func(ci)->p);
+  threadproto(ci_func(ci)->p);
  returning:  /* trap already set */
   cl = ci_func(ci);
   k = cl->p->k;
+  icache = cl->p->icache;
+#if SIL_USE_THREADED
+  th = cl->p->threaded;
+  code = cl->p->code;
+#endif
   pc = ci->u.l.savedpc;
   if (l_unlikely(trap))
     trap = silG_tracecall(L);
@@ -1265,14 +1855,7 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_GETTABUP) {
-        StkId ra = RA(i);
-        TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        silV_fastget(upval, key, s2v(ra), silH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(silV_finishget(L, upval, rc, ra, tag));
+        op_gettabup(L);
         vmbreak;
       }
       vmcase(OP_GETTABLE) {
@@ -1282,6 +1865,10 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         lu_byte tag;
         if (ttisinteger(rc)) {  /* fast track for integers? */
           silV_fastgeti(rb, ivalue(rc), s2v(ra), tag);
+          if (tag == SIL_VNOTABLE && ttisarray(L, rb) &&
+              arraygeti(rb, ivalue(rc), s2v(ra))) {
+            vmbreak;
+          }
         }
         else
           silV_fastget(rb, rc, s2v(ra), silH_get, tag);
@@ -1295,6 +1882,10 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         int c = GETARG_C(i);
         lu_byte tag;
         silV_fastgeti(rb, c, s2v(ra), tag);
+        if (tag == SIL_VNOTABLE && ttisarray(L, rb) &&
+            arraygeti(rb, c, s2v(ra))) {
+          vmbreak;
+        }
         if (tagisempty(tag)) {
           TValue key;
           setivalue(&key, c);
@@ -1302,15 +1893,8 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         }
         vmbreak;
       }
-      vmcase(OP_GETFIELD) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        silV_fastget(rb, key, s2v(ra), silH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(silV_finishget(L, rb, rc, ra, tag));
+      vmcasefused(OP_GETFIELD) {
+        op_getfield(L);
         vmbreak;
       }
       vmcase(OP_SETTABUP) {
@@ -1321,7 +1905,7 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         TString *key = tsvalue(rb);  /* key must be a short string */
         silV_fastset(upval, key, rc, hres, silH_psetshortstr);
         if (hres == HOK)
-          silV_finishfastset(L, upval, rc);
+          silV_finishfastset(L, upval, rb, rc);
         else
           Protect(silV_finishset(L, upval, rb, rc, hres));
         vmbreak;
@@ -1333,12 +1917,16 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         TValue *rc = RKC(i);  /* value */
         if (ttisinteger(rb)) {  /* fast track for integers? */
           silV_fastseti(s2v(ra), ivalue(rb), rc, hres);
+          if (hres == HNOTATABLE && ttisarray(L, s2v(ra)) &&
+              arrayseti(s2v(ra), ivalue(rb), rc)) {
+            vmbreak;
+          }
         }
         else {
           silV_fastset(s2v(ra), rb, rc, hres, silH_pset);
         }
         if (hres == HOK)
-          silV_finishfastset(L, s2v(ra), rc);
+          silV_finishfastset(L, s2v(ra), rb, rc);
         else
           Protect(silV_finishset(L, s2v(ra), rb, rc, hres));
         vmbreak;
@@ -1349,8 +1937,12 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         int b = GETARG_B(i);
         TValue *rc = RKC(i);
         silV_fastseti(s2v(ra), b, rc, hres);
+        if (hres == HNOTATABLE && ttisarray(L, s2v(ra)) &&
+            arrayseti(s2v(ra), b, rc)) {
+          vmbreak;
+        }
         if (hres == HOK)
-          silV_finishfastset(L, s2v(ra), rc);
+          silV_finishfastseti(L, s2v(ra), b, rc);
         else {
           TValue key;
           setivalue(&key, b);
@@ -1366,7 +1958,7 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         TString *key = tsvalue(rb);  /* key must be a short string */
         silV_fastset(s2v(ra), key, rc, hres, silH_psetshortstr);
         if (hres == HOK)
-          silV_finishfastset(L, s2v(ra), rc);
+          silV_finishfastset(L, s2v(ra), rb, rc);
         else
           Protect(silV_finishset(L, s2v(ra), rb, rc, hres));
         vmbreak;
@@ -1387,21 +1979,12 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         L->top.p = ra + 1;  /* correct top in case of emergency GC */
         t = silH_new(L);  /* memory allocation */
         sethvalue2s(L, ra, t);
-        if (b != 0 || c != 0)
-          silH_resize(L, t, c, b);  /* idem */
+        silH_presize(L, t, c, b);  /* idem */
         checkGC(L, ra + 1);
         vmbreak;
       }
       vmcase(OP_SELF) {
-        StkId ra = RA(i);
-        lu_byte tag;
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        setobj2s(L, ra + 1, rb);
-        silV_fastget(rb, key, s2v(ra), silH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(silV_finishget(L, rb, rc, ra, tag));
+        op_self(L);
         vmbreak;
       }
       vmcase(OP_ADDI) {
@@ -1471,14 +2054,17 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_ADD) {
+        quickenop(vRB(i), vRC(i), OP_ADDII, OP_ADDFF);
         op_arith(L, l_addi, sili_numadd);
         vmbreak;
       }
       vmcase(OP_SUB) {
+        quickenop(vRB(i), vRC(i), OP_SUBII, OP_SUBFF);
         op_arith(L, l_subi, sili_numsub);
         vmbreak;
       }
       vmcase(OP_MUL) {
+        quickenop(vRB(i), vRC(i), OP_MULII, OP_MULFF);
         op_arith(L, l_muli, sili_nummul);
         vmbreak;
       }
@@ -1611,7 +2197,11 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_JMP) {
+        if (GETARG_sJ(i) < 0)  /* back edge? */
+          profedge(pc - 1);
         dojump(ci, i, 0);
+        if (GETARG_sJ(i) < 0)
+          jitloop(ci);
         vmbreak;
       }
       vmcase(OP_EQ) {
@@ -1623,10 +2213,12 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         vmbreak;
       }
       vmcase(OP_LT) {
+        quickenop(s2v(RA(i)), vRB(i), OP_LTII, OP_LTFF);
         op_order(L, l_lti, LTnum, lessthanothers);
         vmbreak;
       }
       vmcase(OP_LE) {
+        quickenop(s2v(RA(i)), vRB(i), OP_LEII, OP_LEFF);
         op_order(L, l_lei, LEnum, lessequalothers);
         vmbreak;
       }
@@ -1684,7 +2276,7 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         }
         vmbreak;
       }
-      vmcase(OP_CALL) {
+      vmcasefused(OP_CALL) {
         StkId ra = RA(i);
         CallInfo *newci;
         int b = GETARG_B(i);
@@ -1766,7 +2358,7 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         }
         goto ret;
       }
-      vmcase(OP_RETURN1) {
+      vmcasefused(OP_RETURN1) {
         if (l_unlikely(L->hookmask)) {
           StkId ra = RA(i);
           L->top.p = ra + 1;
@@ -1805,15 +2397,21 @@ void silV_execute (sil_State *L, CallInfo *ci) {
             chgivalue(s2v(ra), l_castU2S(count - 1));  /* update counter */
             idx = intop(+, idx, step);  /* add step to index */
             chgivalue(s2v(ra + 2), idx);  /* update control variable */
+            profedge(pc - 1);
             pc -= GETARG_Bx(i);  /* jump back */
+            updatetrap(ci);  /* allows a signal to break the loop */
+            jitloop(ci);
+            vmbreak;
           }
         }
-        else if (floatforloop(ra))  /* float loop */
+        else if (floatforloop(ra)) {  /* float loop */
+          profedge(pc - 1);
           pc -= GETARG_Bx(i);  /* jump back */
+        }
         updatetrap(ci);  /* allows a signal to break the loop */
         vmbreak;
       }
-      vmcase(OP_FORPREP) {
+      vmcasefused(OP_FORPREP) {
         StkId ra = RA(i);
         savestate(L, ci);  /* in case of errors */
         if (forprep(L, ra))
@@ -1848,12 +2446,14 @@ void silV_execute (sil_State *L, CallInfo *ci) {
            return will be the new value for the control variable.
         */
         StkId ra = RA(i);
-        setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
-        setobjs2s(L, ra + 4, ra + 1);  /* copy state */
-        setobjs2s(L, ra + 3, ra);  /* copy function */
-        L->top.p = ra + 3 + 3;
-        ProtectNT(silD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
-        updatestack(ci);  /* stack may have changed */
+        if (!forcall(L, ra, GETARG_C(i))) {
+          setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
+          setobjs2s(L, ra + 4, ra + 1);  /* copy state */
+          setobjs2s(L, ra + 3, ra);  /* copy function */
+          L->top.p = ra + 3 + 3;
+          ProtectNT(silD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
+          updatestack(ci);  /* stack may have changed */
+        }
         i = *(pc++);  /* go to next instruction */
         sil_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
         goto l_tforloop;
@@ -1861,8 +2461,10 @@ void silV_execute (sil_State *L, CallInfo *ci) {
       vmcase(OP_TFORLOOP) {
        l_tforloop: {
         StkId ra = RA(i);
-        if (!ttisnil(s2v(ra + 3)))  /* continue loop? */
+        if (!ttisnil(s2v(ra + 3))) {  /* continue loop? */
+          profedge(pc - 1);
           pc -= GETARG_Bx(i);  /* jump back */
+        }
         vmbreak;
       }}
       vmcase(OP_SETLIST) {
@@ -1888,8 +2490,8 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         for (; n > 0; n--) {
           TValue *val = s2v(ra + n);
           obj2arr(h, last - 1, val);
+          silC_barriertablei(L, h, last, val);
           last--;
-          silC_barrierback(L, obj2gco(h), val);
         }
         vmbreak;
       }
@@ -1919,6 +2521,86 @@ void silV_execute (sil_State *L, CallInfo *ci) {
         sil_assert(0);
         vmbreak;
       }
+      vmcase(OP_VARSELECT) {
+        StkId ra = RA(i);
+        Instruction call = *(pc + 1);  /* after the OP_VARARG */
+        TValue *f = s2v(ra);
+        /* with call or return hooks, 'select' must really be called */
+        if (ttislcf(f) && fvalue(f) == G(L)->builtin[SIL_BISELECT] &&
+            !(L->hookmask & (SIL_MASKCALL | SIL_MASKRET)) &&
+            GET_OPCODE(call) == OP_CALL &&
+            silT_selectvarargs(L, ci, ra, GETARG_C(call) - 1))
+          pc += 2;  /* skip OP_VARARG and OP_CALL */
+        vmbreak;
+      }
+      vmcase(OP_GETFIELDCALL) {
+        op_getfield(L);
+        vmfuse(OP_CALL);
+        vmbreak;
+      }
+      vmcase(OP_SELFCALL) {
+        op_self(L);
+        vmfuse(OP_CALL);
+        vmbreak;
+      }
+      vmcase(OP_GETTABUPFIELD) {
+        op_gettabup(L);
+        vmfuse(OP_GETFIELD);
+        vmbreak;
+      }
+      vmcase(OP_LOADIFORPREP) {
+        StkId ra = RA(i);
+        sil_Integer b = GETARG_sBx(i);
+        setivalue(s2v(ra), b);
+        vmfuse(OP_FORPREP);
+        vmbreak;
+      }
+      vmcase(OP_MOVERETURN1) {
+        StkId ra = RA(i);
+        setobjs2s(L, ra, RB(i));
+        vmfuse(OP_RETURN1);
+        vmbreak;
+      }
+      vmcase(OP_ADDII) {
+        op_arithII(L, l_addi, sili_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_ADDFF) {
+        op_arithFF(L, l_addi, sili_numadd, OP_ADD);
+        vmbreak;
+      }
+      vmcase(OP_SUBII) {
+        op_arithII(L, l_subi, sili_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_SUBFF) {
+        op_arithFF(L, l_subi, sili_numsub, OP_SUB);
+        vmbreak;
+      }
+      vmcase(OP_MULII) {
+        op_arithII(L, l_muli, sili_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_MULFF) {
+        op_arithFF(L, l_muli, sili_nummul, OP_MUL);
+        vmbreak;
+      }
+      vmcase(OP_LTII) {
+        op_orderII(L, l_lti, LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LTFF) {
+        op_orderFF(L, l_lti, sili_numlt, LTnum, lessthanothers, OP_LT);
+        vmbreak;
+      }
+      vmcase(OP_LEII) {
+        op_orderII(L, l_lei, LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
+      vmcase(OP_LEFF) {
+        op_orderFF(L, l_lei, sili_numle, LEnum, lessequalothers, OP_LE);
+        vmbreak;
+      }
     }
   }
 }
@@ -82,6 +82,17 @@ typedef enum {
   (tag = (!ttistable(t) ? SIL_VNOTABLE : f(hvalue(t), k, res)))
 
 
+/*
+** Special case of 'silV_fastget' for short strings, using the inline
+** cache 'ic' of the instruction doing the access.
+*/
+#define silV_fastgetcache(t,k,res,ic,tag) \
+  do { \
+    if (!ttistable(t)) tag = SIL_VNOTABLE; \
+    else { silH_fastgetshortstr(hvalue(t), k, res, ic, tag); } \
+  } while (0)
+
+
 /*
 ** Special case of 'silV_fastget' for integers, inlining the fast case
 ** of 'silH_getint'.
@@ -100,9 +111,11 @@ typedef enum {
 
 
 /*
-** Finish a fast set operation (when fast set succeeds).
+** Finish a fast set operation 't[k] = v' (when fast set succeeds).
 */
-#define silV_finishfastset(L,t,v)	silC_barrierback(L, gcvalue(t), v)
+#define silV_finishfastset(L,t,k,v)	silC_barriertable(L, hvalue(t), k, v)
+
+#define silV_finishfastseti(L,t,i,v)	silC_barriertablei(L, hvalue(t), i, v)
 
 
 /*
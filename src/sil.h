@@ -260,6 +260,10 @@ SIL_API int (sil_geti) (sil_State *L, int idx, sil_Integer n);
 SIL_API int (sil_rawget) (sil_State *L, int idx);
 SIL_API int (sil_rawgeti) (sil_State *L, int idx, sil_Integer n);
 SIL_API int (sil_rawgetp) (sil_State *L, int idx, const void *p);
+SIL_API sil_Unsigned (sil_rawgetnums) (sil_State *L, int idx, sil_Number *v,
+                                       sil_Unsigned n);
+SIL_API sil_Unsigned (sil_rawgetints) (sil_State *L, int idx, sil_Integer *v,
+                                       sil_Unsigned n);
 
 SIL_API void  (sil_createtable) (sil_State *L, int narr, int nrec);
 SIL_API void *(sil_newuserdatauv) (sil_State *L, size_t sz, int nuvalue);
@@ -277,6 +281,10 @@ SIL_API void  (sil_seti) (sil_State *L, int idx, sil_Integer n);
 SIL_API void  (sil_rawset) (sil_State *L, int idx);
 SIL_API void  (sil_rawseti) (sil_State *L, int idx, sil_Integer n);
 SIL_API void  (sil_rawsetp) (sil_State *L, int idx, const void *p);
+SIL_API sil_Unsigned (sil_rawsetnums) (sil_State *L, int idx,
+                                       const sil_Number *v, sil_Unsigned n);
+SIL_API sil_Unsigned (sil_rawsetints) (sil_State *L, int idx,
+                                       const sil_Integer *v, sil_Unsigned n);
 SIL_API int   (sil_setmetatable) (sil_State *L, int objindex);
 SIL_API int   (sil_setiuservalue) (sil_State *L, int idx, int n);
 
@@ -332,6 +340,10 @@ SIL_API void (sil_warning)  (sil_State *L, const char *msg, int tocont);
 #define SIL_GCGEN		7
 #define SIL_GCINC		8
 #define SIL_GCPARAM		9
+#define SIL_GCMARKTHREADS	10
+#define SIL_GCBGSWEEP		11
+#define SIL_GCSTEPTIME		12
+#define SIL_GCSTATS		13
 
 
 /*
@@ -354,6 +366,46 @@ SIL_API void (sil_warning)  (sil_State *L, const char *msg, int tocont);
 SIL_API int (sil_gc) (sil_State *L, int what, ...);
 
 
+/*
+** garbage-collection statistics (see option SIL_GCSTATS)
+*/
+
+/* timed phases */
+#define SIL_GCPHSTEP		0	/* whole incremental steps */
+#define SIL_GCPHPROPAGATE	1
+#define SIL_GCPHATOMIC		2
+#define SIL_GCPHSWEEP		3
+#define SIL_GCPHFINALIZE	4
+#define SIL_GCPHYOUNG		5	/* young (minor) collections */
+#define SIL_GCPHFULLGEN		6	/* full collections in generational mode */
+#define SIL_GCNPHASES		7
+
+/*
+** Slot 0 of a histogram counts periods shorter than 1 microsecond;
+** slot i counts periods from 2^(i-1) to 2^i microseconds; the last
+** slot also counts all longer periods.
+*/
+#define SIL_GCHISTSIZE		24
+
+typedef struct sil_GCPhaseStats {
+  sil_Unsigned count;  /* number of periods */
+  sil_Number total;  /* total time (in microseconds) */
+  sil_Number max;  /* longest period (in microseconds) */
+  sil_Unsigned hist[SIL_GCHISTSIZE];
+} sil_GCPhaseStats;
+
+typedef struct sil_GCStats {
+  sil_GCPhaseStats phase[SIL_GCNPHASES];
+  sil_Unsigned cycles;  /* number of complete incremental cycles */
+  sil_Unsigned bytesmarked;
+  sil_Unsigned bytesswept;  /* bytes freed by sweeps */
+  sil_Unsigned promoted;  /* objects made old by minor collections */
+  sil_Unsigned promotedbytes;
+  sil_Unsigned minor2major;  /* switches from minor to major collections */
+  sil_Unsigned major2minor;  /* switches from major to minor collections */
+} sil_GCStats;
+
+
 /*
 ** miscellaneous functions
 */
@@ -375,6 +427,23 @@ SIL_API void      (sil_setallocf) (sil_State *L, sil_Alloc f, void *ud);
 SIL_API void (sil_toclose) (sil_State *L, int idx);
 SIL_API void (sil_closeslot) (sil_State *L, int idx);
 
+/*
+** library functions that the VM may run inline (see 'sil_setbuiltin')
+*/
+#define SIL_BISELECT	0
+#define SIL_BINEXT	1
+#define SIL_BIIPAIRS	2	/* iterator returned by 'ipairs' */
+
+#define SIL_NUMBUILTINS	3
+
+SIL_API void (sil_setbuiltin) (sil_State *L, int b, sil_CFunction f);
+
+/*
+** metatable that marks typed arrays, whose elements the VM accesses
+** directly (see 'larray.h')
+*/
+SIL_API void (sil_setarraymeta) (sil_State *L, int objindex);
+
 
 /*
 ** {==============================================================
@@ -440,6 +509,8 @@ SIL_API void (sil_closeslot) (sil_State *L, int idx);
 
 #define sil_resetthread(L)	sil_closethread(L,NULL)
 
+#define sil_setselect(L,f)	sil_setbuiltin(L,SIL_BISELECT,f)
+
 /* }============================================================== */
 
 /*
@@ -484,6 +555,8 @@ SIL_API sil_Hook (sil_gethook) (sil_State *L);
 SIL_API int (sil_gethookmask) (sil_State *L);
 SIL_API int (sil_gethookcount) (sil_State *L);
 
+SIL_API int (sil_opstats) (sil_State *L, int reset);
+
 
 struct sil_Debug {
   int event;
@@ -35,6 +35,7 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int optimizing=0;		/* optimize bytecodes? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -63,6 +64,7 @@ static void usage(const char* message)
   "Available options are:\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O       optimize bytecodes\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -100,6 +102,8 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* optimize */
+   optimizing=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -177,7 +181,8 @@ static int pmain(sil_State* L)
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
-  if (silL_loadfile(L,filename)!=SIL_OK) fatal(sil_tostring(L,-1));
+  if (silL_loadfilex(L,filename,optimizing ? "btO" : NULL)!=SIL_OK)
+   fatal(sil_tostring(L,-1));
  }
  f=combine(L,argc);
  if (listing) silU_print(f,listing>1);
@@ -355,10 +360,10 @@ static void PrintCode(const Proto* f)
   printf("%-9s\t",opnames[o]);
   switch (o)
   {
-   case OP_MOVE:
+   case OP_MOVE: case OP_MOVERETURN1:
 	printf("%d %d",a,b);
 	break;
-   case OP_LOADI:
+   case OP_LOADI: case OP_LOADIFORPREP:
 	printf("%d %d",a,sbx);
 	break;
    case OP_LOADF:
@@ -393,7 +398,7 @@ static void PrintCode(const Proto* f)
 	printf("%d %d",a,b);
 	printf(COMMENT "%s",UPVALNAME(b));
 	break;
-   case OP_GETTABUP:
+   case OP_GETTABUP: case OP_GETTABUPFIELD:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT "%s",UPVALNAME(b));
 	printf(" "); PrintConstant(f,c);
@@ -404,7 +409,7 @@ static void PrintCode(const Proto* f)
    case OP_GETI:
 	printf("%d %d %d",a,b,c);
 	break;
-   case OP_GETFIELD:
+   case OP_GETFIELD: case OP_GETFIELDCALL:
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT); PrintConstant(f,c);
 	break;
@@ -431,7 +436,7 @@ static void PrintCode(const Proto* f)
 	printf("%d %d %d",a,b,c);
 	printf(COMMENT "%d",c+EXTRAARGC);
 	break;
-   case OP_SELF:
+   case OP_SELF: case OP_SELFCALL:
 	printf("%d %d %d%s",a,b,c,ISK);
 	if (isk) { printf(COMMENT); PrintConstant(f,c); }
 	break;
@@ -651,6 +656,16 @@ static void PrintCode(const Proto* f)
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
+   case OP_VARSELECT:
+	printf("%d",a);
+	break;
+   case OP_ADDII: case OP_ADDFF: case OP_SUBII: case OP_SUBFF:
+   case OP_MULII: case OP_MULFF:
+	printf("%d %d %d",a,b,c);
+	break;
+   case OP_LTII: case OP_LTFF: case OP_LEII: case OP_LEFF:
+	printf("%d %d %d",a,b,isk);
+	break;
 #if 0
    default:
 	printf("%d %d %d",a,b,c);
@@ -54,6 +54,22 @@ SILMOD_API int (silopen_table) (sil_State *L);
 #define SIL_UTF8LIBK	(SIL_TABLIBK << 1)
 SILMOD_API int (silopen_utf8) (sil_State *L);
 
+#define SIL_PROFLIBNAME	"profiler"
+#define SIL_PROFLIBK	(SIL_UTF8LIBK << 1)
+SILMOD_API int (silopen_profiler) (sil_State *L);
+
+#define SIL_ARRLIBNAME	"array"
+#define SIL_ARRLIBK	(SIL_PROFLIBK << 1)
+SILMOD_API int (silopen_array) (sil_State *L);
+
+#define SIL_VECLIBNAME	"vec"
+#define SIL_VECLIBK	(SIL_ARRLIBK << 1)
+SILMOD_API int (silopen_vec) (sil_State *L);
+
+#define SIL_BUFLIBNAME	"buffer"
+#define SIL_BUFLIBK	(SIL_VECLIBK << 1)
+SILMOD_API int (silopen_buffer) (sil_State *L);
+
 
 /* open selected libraries */
 SILLIB_API void (silL_openselectedlibs) (sil_State *L, int load, int preload);